@@ -406,14 +406,57 @@ NGBuffer *CreateNGBuffer(MemHeap *mem, int N, int size, char *fn, WordMap *wm)
    ngb->used = 0; ngb->fn = CopyString(mem,fn); ngb->fndx = 0;
    poolbytes = ngb->info.ng_full*size;
    ngb->next = ngb->pool = (UInt *) New(mem,poolbytes);
+   for (ngb->hsize=1024; ngb->hsize<2*size; ngb->hsize*=2);
+   ngb->htab = (int *) New(mem,ngb->hsize*sizeof(int));
+   ngb->hvalid = FALSE;
    return ngb;
 }
 
+/* NGramHash: return the hash table slot for N-gram ng in ngb */
+static int *NGramHash(NGBuffer *ngb, NGram ng)
+{
+   int i,N,*slot;
+   UInt h;
+
+   N = ngb->info.N;
+   for (h=0,i=0; i<N; i++)
+      h = h*31657 + ng[i];
+   h = (h ^ (h>>13)) & (ngb->hsize-1);
+   for (slot=ngb->htab+h; *slot>=0; slot=ngb->htab+h) {
+      if (SameGrams(N,ngb->pool+(*slot)*(N+1),ng))
+	 break;
+      h = (h+1) & (ngb->hsize-1);
+   }
+   return slot;
+}
+
+/* RebuildNGHash: index all N-grams currently in the pool of ngb */
+static void RebuildNGHash(NGBuffer *ngb)
+{
+   int i,N;
+
+   N = ngb->info.N;
+   for (i=0; i<ngb->hsize; i++) ngb->htab[i] = -1;
+   for (i=0; i<ngb->used; i++)
+      *NGramHash(ngb,ngb->pool+i*(N+1)) = i;
+   ngb->hvalid = TRUE;
+}
+
 /* EXPORT->StoreNGram: store ngram in buf into ngb, return TRUE if ngb is full */
 Boolean StoreNGram(NGBuffer *ngb, NGram ng)
 {
+   int N,*slot;
+
+   N = ngb->info.N;
+   if (!ngb->hvalid) RebuildNGHash(ngb);
+   slot = NGramHash(ngb,ng);
+   if (*slot>=0) {          /* already in pool so just add count */
+      ngb->pool[(*slot)*(N+1)+N] += ng[N];
+      return FALSE;
+   }
+   *slot = ngb->used;
    memcpy(ngb->next, ng, ngb->info.ng_full);
-   ngb->used++; ngb->next += ngb->info.N+1;
+   ngb->used++; ngb->next += N+1;
    return (ngb->used==ngb->poolsize);
 }
 
@@ -441,26 +484,64 @@ static int CmpNGram(WordMap *wm, int N, UInt *ng1, UInt *ng2)
    return 0;
 }
 
-static int        qs_cmpSize;   /* must set before using this routine */
-static WordMap    *qs_wmap;     /* word list to access mapentries */
-static NGInputSet *qs_inset;    /* input set */
+#define RADIXBITS 16                  /* bits per radix sort digit */
+#define RADIXSIZE (1<<RADIXBITS)
 
-/* qs_CmpNGram: compare two N-grams, used in qsort */
-static int qs_CmpNGram(const void *p1, const void *p2)
+/* SortKey: return the sort order of word ndx in wm */
+static UInt SortKey(WordMap *wm, UInt ndx)
 {
-   return CmpNGram(qs_wmap,qs_cmpSize,(UInt *)p1,(UInt *)p2);
+   int i;
+
+   if ((i = GetMEIndex(wm,ndx)) < 0)
+      HError(15395,"SortKey: Index %d not found in wordmap",ndx);
+   return wm->me[i].sort;
 }
 
-/* qs_CmpGFile: compare two NGSources on nxt field */
-static int qs_CmpGFile(const void *p1, const void *p2)
+/* RadixPass: stable sort n N-grams from src into dst on the RADIXBITS
+   digit of the sort order of word j starting at bit shift.  Returns
+   FALSE without moving anything if all keys share the same digit */
+static Boolean RadixPass(WordMap *wm, int N, int n, int j, int shift,
+                         UInt *src, UInt *dst, int *bucket, UInt *key)
 {
-   NGram p,q;
-   int *i1, *i2;
+   int i,k,isize,sum;
+   UInt *p;
+
+   isize = N+1;
+   for (k=0; k<RADIXSIZE; k++) bucket[k] = 0;
+   for (i=0,p=src+j; i<n; i++,p+=isize)
+      bucket[key[i] = (SortKey(wm,*p)>>shift) & (RADIXSIZE-1)]++;
+   if (bucket[key[0]] == n) return FALSE;
+   for (sum=0,k=0; k<RADIXSIZE; k++) {
+      i = bucket[k]; bucket[k] = sum; sum += i;
+   }
+   for (i=0,p=src; i<n; i++,p+=isize)
+      memcpy(dst+(bucket[key[i]]++)*isize, p, isize*sizeof(UInt));
+   return TRUE;
+}
 
-   i1 = (int *)p1; i2 = (int *)p2;
-   p = qs_inset->ngs[*i1].nxt;
-   q = qs_inset->ngs[*i2].nxt;
-   return CmpNGram(qs_inset->wm,qs_inset->N,p,q);
+/* RadixSortNGrams: sort the n N-grams in pool into word map order
+   using a least significant digit radix sort on the word sort keys */
+static void RadixSortNGrams(WordMap *wm, int N, int n, UInt *pool)
+{
+   MemHeap mem;
+   UInt *src,*dst,*tmp,*key;
+   int j,shift,maxShift,*bucket;
+
+   if (n < 2) return;
+   for (maxShift=0; (wm->used-1)>>maxShift >= RADIXSIZE; maxShift+=RADIXBITS);
+   CreateHeap(&mem,"NGsort",MSTAK,1,0.0,100000,100000);
+   bucket = (int *) New(&mem,RADIXSIZE*sizeof(int));
+   key = (UInt *) New(&mem,n*sizeof(UInt));
+   dst = (UInt *) New(&mem,n*(N+1)*sizeof(UInt));
+   src = pool;
+   for (j=N-1; j>=0; j--)
+      for (shift=0; shift<=maxShift; shift+=RADIXBITS)
+         if (RadixPass(wm,N,n,j,shift,src,dst,bucket,key)) {
+            tmp = src; src = dst; dst = tmp;
+         }
+   if (src != pool)
+      memcpy(pool,src,n*(N+1)*sizeof(UInt));
+   DeleteHeap(&mem);
 }
 
 /* EXPORT->SortNGBuffer: sort+uniqe N-grams in ngb  */
@@ -475,11 +556,11 @@ void SortNGBuffer(NGBuffer *ngb)
       printf(" Sorting %d N-grams (next write to %s)\n", ngb->used,fn);
    }
    SortWordMap(ngb->wm);
-   qs_cmpSize = N = ngb->info.N; qs_wmap = ngb->wm;
-   usort(ngb->pool,ngb->used,ngb->info.ng_full,qs_CmpNGram);
+   N = ngb->info.N;
+   RadixSortNGrams(ngb->wm,N,ngb->used,ngb->pool);
    p = ngb->pool; count = 1; isize = N + 1;
    for (q = ngb->pool + isize, i=1; i < ngb->used; i++, q += isize) {
-      if (CmpNGram(ngb->wm,ngb->info.N,p,q)==0) {
+      if (memcmp(p,q,N*sizeof(UInt))==0) {
 #ifdef LM_FLOAT_COUNT
 	pp = (float *) p+N;
 	qq = (float *) p+N;
@@ -492,7 +573,7 @@ void SortNGBuffer(NGBuffer *ngb)
          if (p != q) memcpy(p, q, ngb->info.ng_full);
       }
    }
-   ngb->used = count; ngb->next = p+isize;
+   ngb->used = count; ngb->next = p+isize; ngb->hvalid = FALSE;
    if (trace&T_SRT) {
       printf(" N-grams sorted %d remaining\n", ngb->used);
       fflush(stdout);
@@ -538,6 +619,7 @@ void WriteNGBuffer(NGBuffer *ngb, char *source)
    for (i=0,p = ngb->pool; i<ngb->used; i++, p += N + 1)
       WriteNGram(f, N, p);
    ngb->used = 0; ngb->next = ngb->pool; ++ngb->fndx;
+   ngb->hvalid = FALSE;
    FClose(f,isPipe);
 }
 
@@ -657,47 +739,59 @@ void AddInputGFile(NGInputSet *inset, char *fn, float weight)
 /* ShowInputState: show current open input streams */
 static void ShowInputState(char *mess, NGInputSet *inset)
 {
-   int i,j;
+   int i;
 
-   printf("%s: %d files open\n",mess,inset->nOpen);
+   printf("%s: %d files open, next from %d\n",mess,inset->nOpen,inset->gfsort[0]);
    for (i=0; i<inset->nOpen; i++) {
-      j = inset->gfsort[i];
-      printf("  %2d[%2d] %-10s",i,j,inset->gf[j]->fn);
-      ShowAbbrRawGram(inset->N,inset->ngs[j].nxt,inset->wm);
+      printf("  %2d %-10s",i,inset->gf[i]->fn);
+      ShowAbbrRawGram(inset->N,inset->ngs[i].nxt,inset->wm);
       printf("\n");
    }
 }
 
-/* SortGFList: sort the list of open files into order of next
-   available N-Gram. Sort order is defined by gfsort array */
+/* GFBefore: true if next N-gram of open file i precedes that of file j */
+static Boolean GFBefore(NGInputSet *inset, int i, int j)
+{
+   int c;
+
+   c = CmpNGram(inset->wm,inset->N,inset->ngs[i].nxt,inset->ngs[j].nxt);
+   return (c < 0 || (c == 0 && i < j));
+}
+
+/* SortGFList: build a loser tree over the open files.  Leaves
+   nOpen..2*nOpen-1 are the files, gfsort[1..nOpen-1] hold the loser
+   of each match and gfsort[0] the file with the next N-gram */
 static void SortGFList(NGInputSet *inset)
 {
-   qs_inset = inset;
-   usort(inset->gfsort,inset->nOpen,sizeof(int),qs_CmpGFile);
+   int i,n,a,b,win[2*MAXINF];
+
+   n = inset->nOpen;
+   for (i=0; i<n; i++) win[n+i] = i;
+   for (i=n-1; i>0; i--) {
+      a = win[2*i]; b = win[2*i+1];
+      if (GFBefore(inset,a,b)) {
+         win[i] = a; inset->gfsort[i] = b;
+      } else {
+         win[i] = b; inset->gfsort[i] = a;
+      }
+   }
+   inset->gfsort[0] = (n > 1) ? win[1] : 0;
    if (trace&T_SRT) ShowInputState("Full sort",inset);
 }
 
-/* ReSortGFList: resort after reading topmost N-Gram */
+/* ReSortGFList: replay the matches of the winner after reading its
+   topmost N-Gram */
 static void ReSortGFList(NGInputSet *inset)
 {
-   int i,j,n,this;
-   NGram p,q;
-   Boolean found = FALSE;
-
-   n = inset->nOpen; this = inset->gfsort[0];
-   p = inset->ngs[this].nxt;
-   i = 1;
-   while ( i<n && !found){
-      q = inset->ngs[inset->gfsort[i]].nxt;
-      found = (CmpNGram(inset->wm,inset->N,p,q) <= 0 );
-      if (!found) ++i;
-   }
-   if (i==1) return;
-   --i;
-   /* i = index of new position for updated file */
-   for (j=0; j<i; j++)
-      inset->gfsort[j] = inset->gfsort[j+1];
-   inset->gfsort[i] = this;
+   int i,w,t;
+
+   w = inset->gfsort[0];
+   for (i=(w+inset->nOpen)/2; i>0; i/=2) {
+      if (GFBefore(inset,inset->gfsort[i],w)) {
+         t = inset->gfsort[i]; inset->gfsort[i] = w; w = t;
+      }
+   }
+   inset->gfsort[0] = w;
    if (trace&T_SRT) ShowInputState("Re-sorted",inset);
 }
 
@@ -754,6 +848,7 @@ static void GetInsetGram(NGInputSet *inset, NGram ng, float *wt)
          OpenNGramFile(ngs,next->fn,inset->wm);
          if (trace&T_IST)
             printf(" replaced by file %s\n", next->fn);
+         if (inset->nOpen > 1) ReSortGFList(inset);
       } else { /* zero or multiple successors */
          /* delete exhausted input stream */
          --inset->nOpen;
@@ -775,8 +870,8 @@ static void GetInsetGram(NGInputSet *inset, NGram ng, float *wt)
 	    if (inset->maxNOpen < inset->nOpen)
 	       inset->maxNOpen = inset->nOpen;
          }
+         if (inset->nOpen > 1) SortGFList(inset);
       }
-      if (inset->nOpen > 1) SortGFList(inset);
    } else         /* no change, just resort the parallel input streams */
       if (inset->nOpen > 1) ReSortGFList(inset);
    if (checkOrder && inset->nOpen > 0){ /* check ordering is consistent */
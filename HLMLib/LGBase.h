@@ -91,7 +91,7 @@ typedef struct {        /* input N-gram file set */
    GramFile head;          /* dummy head of tree */
    NGSource ngs[MAXINF];   /* currently open sources */
    GFLink gf[MAXINF];      /* list of ptrs to gram files */
-   int gfsort[MAXINF];     /* idx's of sorted gram files */
+   int gfsort[MAXINF];     /* loser tree of open files, [0] is winner */
    UInt nextGram[MAXNG];   /* next gram to read from inset */  
    float nextWt;           /* weight of next gram */
    Boolean nextValid;      /* true if nextGram is valid */
@@ -106,6 +106,9 @@ typedef struct {        /* N-gram buffer */
    UInt *pool;             /* array[0..used-1] of ngrams */
    UInt *next;             /* next free slot in pool */
    WordMap *wm;            /* word map for ngrams */
+   int hsize;              /* size of hash table (power of 2) */
+   int *htab;              /* array[0..hsize-1] of pool slot or -1 */
+   Boolean hvalid;         /* TRUE if htab indexes the pool */
 } NGBuffer;
 
 typedef struct {        /* N-gram frequency of frequency table */
@@ -182,7 +185,8 @@ void ResetNGBuffer(NGBuffer *ngb);
 
 Boolean StoreNGram(NGBuffer *ngb, NGram ng);
 /*
-   Store expanded (N+1 length) N-gram in buf into ngb.
+   Store expanded (N+1 length) N-gram in buf into ngb.  If the
+   N-gram is already in ngb its count is added to the stored one.
    Return TRUE if ngb is full
 */   
 
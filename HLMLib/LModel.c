@@ -47,6 +47,11 @@ char *lmodel_vc_id = "$Id: LModel.c,v 1.1.1.1 2006/10/11 09:54:43 jal58 Exp $";
 #include "LModel.h"
 #include "HLM.h"
 
+#ifdef UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #define T_TOP    0001       /* top level tracing */
 #define T_LOAD   0002       /* loading of LMs */
 #define T_SAVE   0004       /* saving of LMs */
@@ -55,6 +60,18 @@ char *lmodel_vc_id = "$Id: LModel.c,v 1.1.1.1 2006/10/11 09:54:43 jal58 Exp $";
 
 static int trace = 0;
 
+typedef struct {
+   FLEntry *ctx;        /* context node, NULL if slot empty */
+   LM_Id ndx;           /* word index */
+   int fi;              /* offset in ctx->fea or -1 */
+   int si;              /* offset in ctx->sea or -1 */
+} LMISlot;
+
+struct _LMIndex {       /* open addressed hash of (context,word) pairs */
+   UInt mask;           /* number of slots - 1 (power of 2) */
+   LMISlot *slot;       /* [0..mask] */
+};
+
 typedef struct _AccessInfo{
    int count;           /* count for access */
    int nboff;           /* times computed using the back-off weight */
@@ -87,6 +104,11 @@ static Boolean defIntID = FALSE;        /* Don't use 4-byte IDs */
 static Boolean htkEsc = FALSE;          /* Don't use HTK quoting and escapes */
 static Boolean natReadOrder = FALSE;    /* Preserve natural read byte order */
 static Boolean natWriteOrder = FALSE;   /* Preserve natural write byte order */
+static Boolean hashIndex = FALSE;       /* build hashed n-gram index on load */
+static Boolean mapImage = TRUE;         /* map n-grams of image LMs from file */
+static NGramFilter ngFilter = NULL;     /* n-gram load filter or NULL */
+static void *ngFilterArg = NULL;        /* argument passed to ngFilter */
+static int ngFiltered = 0;              /* n-grams dropped by ngFilter in LoadNGram */
 extern Boolean vaxOrder;                /* True if byteswapping needed to preserve SUNSO */
 #ifdef ULTRA_LM
 static short   ultraKey[KEY_LENGTH];    /* Key used to identify ultra LMs */
@@ -109,6 +131,8 @@ void InitLModel(void)
       if (GetConfBool(cParm,nParm,"USEINTID",&b)) defIntID = b;
       if (GetConfBool(cParm,nParm,"NATURALREADORDER",&b)) natReadOrder = b;
       if (GetConfBool(cParm,nParm,"NATURALWRITEORDER",&b)) natWriteOrder = b;
+      if (GetConfBool(cParm,nParm,"HASHINDEX",&b)) hashIndex = b;
+      if (GetConfBool(cParm,nParm,"MAPIMAGE",&b)) mapImage = b;
    }
 #ifdef ULTRA_LM
    COMPOSE_KEY(ultraKey);
@@ -146,6 +170,106 @@ void SyncStr(Source *src, char *str)
    } while (strcmp(buf,str)!=0);
 }
 
+/* GetLMLine: read the next non-blank line of src into buf */
+static char *GetLMLine(Source *src, char *buf)
+{
+   char *s;
+   int n;
+
+   for (;;) {
+      n = 0;
+      if (src->pbValid) {       /* honour any character put back */
+	 src->pbValid = FALSE;
+	 if (src->putback == EOF)
+	    return NULL;
+	 if (src->putback != '\n')
+	    buf[n++] = src->putback;
+      }
+      if (fgets(buf+n,MAXSYMLEN-n,src->f)==NULL) {
+	 if (n==0) return NULL;
+	 buf[n] = '\0';
+      }
+      n = strlen(buf); src->chcount += n;
+      if (n == MAXSYMLEN-1 && buf[n-1] != '\n')
+	 HError(15450,"GetLMLine: Line too long in %s",src->name);
+      for (s=buf; isspace((int) *s); s++);
+      if (*s != '\0') return buf;
+   }
+}
+
+/* NextLMToken: return next white space delimited token from *lp,
+   terminating it in place and undoing any HTK quotes and escapes */
+static char *NextLMToken(char **lp, Boolean esc)
+{
+   char *r,*w,*tok;
+   int q,n;
+
+   for (r = *lp; isspace((int) *r); r++);
+   if (*r == '\0') {
+      *lp = r; return NULL;
+   }
+   tok = w = r; q = 0;
+   if (esc && (*r == DBL_QUOTE || *r == SING_QUOTE))
+      q = *r++;
+   while (*r != '\0' && (q ? *r != q : !isspace((int) *r))) {
+      if (esc && *r == ESCAPE_CHAR && r[1] != '\0') {
+	 r++;
+	 if (*r>='0' && *r<='7' && r[1]>='0' && r[1]<='7' && r[2]>='0' && r[2]<='7') {
+	    n = (r[0]-'0')*64 + (r[1]-'0')*8 + (r[2]-'0');
+	    *w++ = n; r += 3;
+	    continue;
+	 }
+      }
+      *w++ = *r++;
+   }
+   if (q && *r != q)
+      HError(15450,"NextLMToken: Line end within quoted string");
+   if (*r != '\0') r++;
+   *w = '\0'; *lp = r;
+   return tok;
+}
+
+/* ParseLMFloat: convert token s to a float, TRUE if all of s used.
+   Plain decimals of up to 15 digits are converted exactly using one
+   double division, anything else is passed to strtod. */
+static Boolean ParseLMFloat(char *s, float *x)
+{
+   static double pow10[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+   };
+   double m,d;
+   char *p,*e;
+   int nd,nf;
+   Boolean neg,frac;
+
+   p = s; neg = FALSE;
+   if (*p == '-' || *p == '+') neg = (*p++ == '-');
+   for (m=0.0,nd=nf=0,frac=FALSE; ; p++) {
+      if (*p >= '0' && *p <= '9') {
+	 m = m*10.0 + (*p-'0'); nd++;
+	 if (frac) nf++;
+      } else if (*p == '.' && !frac)
+	 frac = TRUE;
+      else
+	 break;
+   }
+   if (*p == '\0' && nd > 0 && nd <= 15) {
+      d = (nf > 0) ? m/pow10[nf] : m;
+      *x = (float) (neg ? -d : d);
+      return TRUE;
+   }
+   d = strtod(s,&e);
+   *x = (float) d;
+   return (e != s && *e == '\0');
+}
+
+/* EXPORT->SetNGramFilter: install filter for n-grams being loaded */
+void SetNGramFilter(NGramFilter filter, void *arg)
+{
+   ngFilter = filter; ngFilterArg = arg;
+}
+
 /*----------------------- Access statistics ------------------------*/
 
 void ResetAccessInfo(BackOffLM *lm)
@@ -329,6 +453,108 @@ static SMEntry *FindSE1(SMEntry *sptr, int lo, int hi, LM_Id key, int *fcen)
    return NULL;
 }
 
+/* --------------------- Hashed n-gram index -------------------- */
+
+/* IndexHash: hash value of (context,word) pair */
+static UInt IndexHash(FLEntry *ctx, LM_Id ndx)
+{
+   unsigned long h;
+
+   h = ((unsigned long) ctx) >> 3;
+   h = h*2654435761UL + ndx*40503UL;
+   return (UInt) (h ^ (h >> 15));
+}
+
+/* IndexSlot: return slot for (ctx,ndx), either matching or empty */
+static LMISlot *IndexSlot(LMIndex *idx, FLEntry *ctx, LM_Id ndx)
+{
+   UInt h;
+   LMISlot *sl;
+
+   h = IndexHash(ctx,ndx) & idx->mask;
+   for (;;) {
+      sl = idx->slot + h;
+      if (sl->ctx == NULL || (sl->ctx == ctx && sl->ndx == ndx))
+         return sl;
+      h = (h+1) & idx->mask;
+   }
+}
+
+/* CountIndexKeys: count entries below fe */
+static int CountIndexKeys(FLEntry *fe)
+{
+   int i,n;
+
+   n = fe->nse + fe->nfe;
+   for (i=0; i<fe->nfe; i++)
+      n += CountIndexKeys(fe->fea+i);
+   return n;
+}
+
+/* AddIndexKeys: enter successors of fe and all its descendants */
+static void AddIndexKeys(LMIndex *idx, FLEntry *fe)
+{
+   int i;
+   LMISlot *sl;
+
+   for (i=0; i<fe->nse; i++) {
+      sl = IndexSlot(idx,fe,fe->sea[i].ndx);
+      if (sl->ctx == NULL) {
+         sl->ctx = fe; sl->ndx = fe->sea[i].ndx; sl->fi = -1;
+      }
+      sl->si = i;
+   }
+   for (i=0; i<fe->nfe; i++) {
+      sl = IndexSlot(idx,fe,fe->fea[i].ndx);
+      if (sl->ctx == NULL) {
+         sl->ctx = fe; sl->ndx = fe->fea[i].ndx; sl->si = -1;
+      }
+      sl->fi = i;
+      AddIndexKeys(idx,fe->fea+i);
+   }
+}
+
+/* EXPORT-> BuildLMIndex: build hashed n-gram index for lm */
+void BuildLMIndex(BackOffLM *lm)
+{
+   LMIndex *idx;
+   int n;
+   UInt size;
+
+   n = CountIndexKeys(&(lm->root));
+   for (size=1024; size < (UInt) n + n/2; size <<= 1);
+   idx = (LMIndex *) New(lm->heap,sizeof(LMIndex));
+   idx->mask = size-1;
+   idx->slot = (LMISlot *) New(lm->heap,size*sizeof(LMISlot));
+   memset(idx->slot,0,size*sizeof(LMISlot));
+   AddIndexKeys(idx,&(lm->root));
+   lm->index = idx;
+   if (trace&T_LOAD)
+      printf("Built n-gram index: %d keys in %u slots\n",n,size);
+}
+
+/* LookupFE: find child of context fe with word key */
+static FLEntry *LookupFE(BackOffLM *lm, FLEntry *fe, LM_Id key)
+{
+   LMISlot *sl;
+
+   if (lm->index == NULL)
+      return FindFE(fe->fea,0,fe->nfe,key);
+   sl = IndexSlot(lm->index,fe,key);
+   return (sl->ctx == NULL || sl->fi < 0) ? NULL : fe->fea + sl->fi;
+}
+
+/* LookupSE: find successor entry of context fe with word key */
+static SMEntry *LookupSE(BackOffLM *lm, FLEntry *fe, LM_Id key)
+{
+   LMISlot *sl;
+
+   if (lm->index == NULL)
+      return FindSE(fe->sea,0,fe->nse,key);
+   sl = IndexSlot(lm->index,fe,key);
+   return (sl->ctx == NULL || sl->si < 0) ? NULL : fe->sea + sl->si;
+}
+
 /* -------------------- Ultra format I/O ---------------------- */
 
 #ifdef ULTRA_LM
@@ -656,6 +882,323 @@ static void SaveUltraNGrams(FILE *f, BackOffLM *lm)
 }
 
 
+/* -------------------- Image format I/O ---------------------- */
+
+#define IMAGE_CHUNK 4096
+
+/* ImageToBowt: convert image back-off weight to the LM prob type */
+static float ImageToBowt(BackOffLM *lm, float x)
+{
+   switch(lm->probType) {
+      case LMP_FLOAT :
+	 return LOG10_TO_FLT(x/LN10);
+      case LMP_LOG :
+	 return x*lm->gScale;
+      default:
+	 return x;
+   }
+}
+
+/* ImageToProb: convert image probability to the LM prob type */
+static LM_Prob ImageToProb(BackOffLM *lm, float x)
+{
+   switch(lm->probType) {
+      case LMP_FLOAT :
+	 return LOG10_TO_FLT(x/LN10);
+      case LMP_LOG :
+#ifdef LM_COMPACT
+	 return Prob2Shrt(x/LN10);
+#else
+	 return x*lm->gScale;
+#endif
+      default:
+	 return x;
+   }
+}
+
+/* BowtToImage: convert back-off weight to image natural log */
+static float BowtToImage(BackOffLM *lm, float x)
+{
+   return (lm->probType==LMP_FLOAT) ? FLT_TO_LOG10(x)*LN10 : x/lm->gScale;
+}
+
+/* ProbToImage: convert probability to image natural log */
+static float ProbToImage(BackOffLM *lm, LM_Prob x)
+{
+   if (lm->probType==LMP_FLOAT)
+      return FLT_TO_LOG10(x)*LN10;
+#ifdef LM_COMPACT
+   return Shrt2Prob(x)*LN10;
+#else
+   return x/lm->gScale;
+#endif
+}
+
+/* ReadImage: read n items of given size from image source */
+static void ReadImage(Source *src, void *buf, size_t size, size_t n)
+{
+   if (n>0 && fread(buf,size,n,src->f)!=n)
+      HError(15450,"ReadImage: Unexpected EOF in LM image %s",src->name);
+   src->chcount += size*n;
+}
+
+#ifdef UNIX
+/* MapImage: map len bytes of src from offset off into lm, NULL if
+             not possible */
+static void *MapImage(Source *src, BackOffLM *lm, long off, size_t len)
+{
+   long delta;
+   char *p;
+
+   if (src->isPipe || src->pbValid || off<0 || off%sizeof(SMEntry)!=0)
+      return NULL;
+   delta = off%sysconf(_SC_PAGESIZE);
+   p = (char *) mmap(NULL,len+delta,PROT_READ|PROT_WRITE,MAP_PRIVATE,
+		     fileno(src->f),off-delta);
+   if (p==(char *) MAP_FAILED)
+      return NULL;
+   lm->mapAddr = p; lm->mapLen = len+delta;
+   return p+delta;
+}
+#endif
+
+/* LoadImage: read the n-grams of an image format LM */
+static void LoadImage(Source *src, BackOffLM *lm)
+{
+   LMImageHdr hdr;
+   LMImageCtx *ctx;
+   LMImageProb *prob;
+   FLEntry *fea[LM_NSIZE],*fe;
+   SMEntry *sea[LM_NSIZE+1],*se;
+   NameId wdid;
+   MemHeap tmpHeap;
+   char *voc,*wd;
+   size_t nbytes;
+   long off;
+   int i,j,k,l,n,np,cnt,nSize;
+   Boolean mapped;
+
+   nSize = lm->nSize;
+   SyncStr(src,"\\image\\");
+   ReadImage(src,&hdr,sizeof(LMImageHdr),1);
+   if (hdr.magic!=LMIMAGE_MAGIC || hdr.version!=LMIMAGE_VERSION)
+      HError(15450,"LoadImage: LM image %s has wrong byte order or version",
+	     src->name);
+   if (hdr.nSize!=nSize || hdr.vocSize!=lm->vocSize)
+      HError(15450,"LoadImage: LM image header disagrees with n-gram counts");
+   for (l=1; l<=nSize; l++)
+      if (hdr.ngram[l]!=lm->gInfo[l].nEntry)
+	 HError(15450,"LoadImage: %d-gram count disagrees with image",l);
+
+   /* vocabulary in word index order */
+   CreateHeap(&tmpHeap,"LM image",MSTAK,1,0.0,8192,65536);
+   voc = (char *) New(&tmpHeap,hdr.vocBytes);
+   ReadImage(src,voc,1,hdr.vocBytes);
+   for (wd=voc,i=1; i<=lm->vocSize; i++,wd+=strlen(wd)+1) {
+      if (wd>=voc+hdr.vocBytes)
+	 HError(15450,"LoadImage: Vocabulary truncated at word %d",i);
+      wdid = GetNameId(lm->htab,wd,TRUE);
+      if (LM_INDEX(wdid)!=0)
+	 HError(15450,"LoadImage: Duplicate unigram %s",wd);
+      lm->binMap[i] = wdid; LM_INDEX(wdid) = i;
+   }
+
+   /* contexts, each level in the order of its parents */
+   lm->root.bowt = 0.0; lm->root.parent = NULL;
+   lm->root.nse = hdr.ngram[1];
+   lm->root.nfe = (nSize>1) ? hdr.nctx[1] : 0;
+   fea[0] = &(lm->root);
+   ctx = (LMImageCtx *) New(&tmpHeap,IMAGE_CHUNK*sizeof(LMImageCtx));
+   for (l=1; l<nSize; l++) {
+      fea[l] = fe = (FLEntry *) New(lm->heap,(hdr.nctx[l]+1)*sizeof(FLEntry));
+      for (j=0; j<hdr.nctx[l]; j+=n) {
+	 n = hdr.nctx[l]-j; if (n>IMAGE_CHUNK) n = IMAGE_CHUNK;
+	 ReadImage(src,ctx,sizeof(LMImageCtx),n);
+	 for (k=0; k<n; k++,fe++) {
+	    if (ctx[k].ndx<1 || ctx[k].ndx>lm->vocSize)
+	       HError(15450,"LoadImage: LM index out of bounds (%d)",ctx[k].ndx);
+	    fe->ndx = ctx[k].ndx;
+	    fe->nse = ctx[k].nse; fe->sea = NULL;
+	    fe->nfe = (l<nSize-1) ? ctx[k].nfe : 0; fe->fea = NULL;
+	    fe->bowt = ImageToBowt(lm,ctx[k].bowt);
+	    fe->parent = NULL;
+	 }
+      }
+      lm->gInfo[0].nEntry += hdr.nctx[l];
+   }
+   for (l=1; l<nSize; l++) {
+      np = (l>1) ? hdr.nctx[l-1] : 1;
+      for (fe=fea[l-1],cnt=0,i=0; i<np; i++,fe++) {
+	 if (cnt+fe->nfe > hdr.nctx[l])
+	    HError(15450,"LoadImage: Too few %d-gram contexts",l);
+	 if (fe->nfe>0) fe->fea = fea[l]+cnt;
+	 cnt += fe->nfe;
+      }
+      if (cnt!=hdr.nctx[l])
+	 HError(15450,"LoadImage: Too many %d-gram contexts",l);
+   }
+
+   /* n-grams, mapped straight from the file where the layout allows */
+   for (nbytes=0,l=1; l<=nSize; l++)
+      nbytes += hdr.ngram[l]*sizeof(LMImageProb);
+   off = src->isPipe ? -1 : ftell(src->f);
+   se = NULL;
+#ifdef UNIX
+   if (mapImage && lm->probType==LMP_LOG && lm->gScale==1.0 &&
+       sizeof(LM_Id)==sizeof(UInt) && sizeof(LM_Prob)==sizeof(float) &&
+       sizeof(SMEntry)==sizeof(LMImageProb))
+      se = (SMEntry *) MapImage(src,lm,off,nbytes);
+#endif
+   if ((mapped = (se!=NULL))) {
+      for (l=1; l<=nSize; l++) {
+	 sea[l] = se; se += hdr.ngram[l];
+      }
+      if (fseek(src->f,off+nbytes,SEEK_SET)!=0)
+	 HError(15450,"LoadImage: Unable to skip n-grams in %s",src->name);
+      src->chcount += nbytes;
+   } else {
+      prob = (LMImageProb *) New(&tmpHeap,IMAGE_CHUNK*sizeof(LMImageProb));
+      for (l=1; l<=nSize; l++) {
+	 sea[l] = se = (SMEntry *) New(lm->heap,(hdr.ngram[l]+1)*sizeof(SMEntry));
+	 for (j=0; j<hdr.ngram[l]; j+=n) {
+	    n = hdr.ngram[l]-j; if (n>IMAGE_CHUNK) n = IMAGE_CHUNK;
+	    ReadImage(src,prob,sizeof(LMImageProb),n);
+	    for (k=0; k<n; k++,se++) {
+	       if (prob[k].ndx<1 || prob[k].ndx>lm->vocSize)
+		  HError(15450,"LoadImage: LM index out of bounds (%d)",prob[k].ndx);
+	       se->ndx = prob[k].ndx;
+	       se->prob = ImageToProb(lm,prob[k].prob);
+	    }
+	 }
+      }
+   }
+   if (trace&T_LOAD) {
+      printf("  %s %d n-grams from image\n",
+	     mapped ? "Mapped" : "Read",
+	     (int) (nbytes/sizeof(LMImageProb)));
+      fflush(stdout);
+   }
+   for (l=1; l<=nSize; l++) {
+      np = (l>1) ? hdr.nctx[l-1] : 1;
+      for (fe=fea[l-1],cnt=0,i=0; i<np; i++,fe++) {
+	 if (cnt+fe->nse > hdr.ngram[l])
+	    HError(15450,"LoadImage: Too few %d-grams",l);
+	 if (fe->nse>0) fe->sea = sea[l]+cnt;
+	 cnt += fe->nse;
+      }
+      if (cnt!=hdr.ngram[l])
+	 HError(15450,"LoadImage: Too many %d-grams",l);
+   }
+
+   DeleteHeap(&tmpHeap);
+
+   /* check unigram consistency */
+   for (se=lm->root.sea, i=0; i<lm->root.nse; i++, se++) {
+      if (se->ndx!=i+1)
+	 HError(15450, "LoadImage: Mismatched unigram index %d should be %d", se->ndx, i+1);
+   }
+}
+
+/* CountImage: count contexts and n-grams below fe at level l */
+static void CountImage(FLEntry *fe, int l, int nSize, LMImageHdr *hdr)
+{
+   int i;
+
+   hdr->ngram[l+1] += fe->nse;
+   if (l+1<nSize) {
+      hdr->nctx[l+1] += fe->nfe;
+      for (i=0; i<fe->nfe; i++)
+	 CountImage(fe->fea+i,l+1,nSize,hdr);
+   }
+}
+
+/* WriteImageCtx: write contexts of level tgt below fe at level l */
+static void WriteImageCtx(FILE *f, BackOffLM *lm, FLEntry *fe, int l, int tgt)
+{
+   LMImageCtx ctx;
+   FLEntry *cfe;
+   int i;
+
+   for (cfe=fe->fea, i=0; i<fe->nfe; i++, cfe++) {
+      if (l+1<tgt) {
+	 WriteImageCtx(f,lm,cfe,l+1,tgt);
+      } else {
+	 ctx.ndx = cfe->ndx; ctx.nse = cfe->nse;
+	 ctx.nfe = (tgt<lm->nSize-1) ? cfe->nfe : 0;
+	 ctx.bowt = BowtToImage(lm,cfe->bowt);
+	 fwrite(&ctx,sizeof(LMImageCtx),1,f);
+      }
+   }
+}
+
+/* WriteImageProbs: write n-grams of level tgt below fe at level l */
+static void WriteImageProbs(FILE *f, BackOffLM *lm, FLEntry *fe, int l, int tgt)
+{
+   LMImageProb prob;
+   SMEntry *se;
+   int i;
+
+   if (l+1<tgt) {
+      for (i=0; i<fe->nfe; i++)
+	 WriteImageProbs(f,lm,fe->fea+i,l+1,tgt);
+   } else {
+      for (se=fe->sea, i=0; i<fe->nse; i++, se++) {
+	 prob.ndx = se->ndx;
+	 prob.prob = ProbToImage(lm,se->prob);
+	 fwrite(&prob,sizeof(LMImageProb),1,f);
+      }
+   }
+}
+
+/* InitImage: fill in image header and n-gram counts of lm */
+static void InitImage(BackOffLM *lm, LMImageHdr *hdr)
+{
+   int i;
+
+   if (lm->nSize>=LMIMAGE_MAXN)
+      HError(15490,"InitImage: Image format limited to %d-grams",LMIMAGE_MAXN-1);
+   if (lm->probType!=LMP_LOG && lm->probType!=LMP_FLOAT)
+      HError(15490,"InitImage: Image format requires probabilities");
+   hdr->magic = LMIMAGE_MAGIC; hdr->version = LMIMAGE_VERSION;
+   hdr->nSize = lm->nSize; hdr->vocSize = lm->vocSize;
+   hdr->vocBytes = 0; hdr->spare = 0;
+   for (i=1; i<=lm->vocSize; i++)
+      hdr->vocBytes += strlen(lm->binMap[i]->name)+1;
+   hdr->vocBytes = (hdr->vocBytes+7)&~7;
+   for (i=0; i<LMIMAGE_MAXN; i++)
+      hdr->nctx[i] = hdr->ngram[i] = 0;
+   CountImage(&(lm->root),0,lm->nSize,hdr);
+   for (i=1; i<=lm->nSize; i++)
+      lm->gInfo[i].nEntry = hdr->ngram[i];
+}
+
+/* SaveImage: write image following the n-gram counts */
+static void SaveImage(FILE *f, BackOffLM *lm, LMImageHdr *hdr)
+{
+   char *name;
+   long pos;
+   int i,l,n;
+
+   /* pad so that the n-gram arrays are aligned within the file */
+   if ((pos = ftell(f)) >= 0)
+      for (pos += strlen("\n\\image\\\n"); pos%8!=0; pos++)
+	 fputc('\n',f);
+   fprintf(f, "\n\\image\\\n");
+   fwrite(hdr,sizeof(LMImageHdr),1,f);
+   for (n=0,i=1; i<=lm->vocSize; i++) {
+      name = lm->binMap[i]->name;
+      fwrite(name,1,strlen(name)+1,f); n += strlen(name)+1;
+   }
+   for (; n<hdr->vocBytes; n++)
+      fputc('\0',f);
+   for (l=1; l<lm->nSize; l++)
+      WriteImageCtx(f,lm,&(lm->root),0,l);
+   for (l=1; l<=lm->nSize; l++)
+      WriteImageProbs(f,lm,&(lm->root),0,l);
+   if (trace&T_SAVE)
+      printf("Wrote %d-gram image\n", lm->nSize);
+}
+
 /* EXPORT-> StoreFEA: move fea array into permanent location */
 void StoreFEA(FLEntry *fe, MemHeap *heap)
 {
@@ -691,7 +1234,7 @@ void StoreSEA(FLEntry *fe, MemHeap *heap)
 /* LoadUnigram: read the unigram part of a file */
 static int LoadUnigram(Source *src, BackOffLM *lm, int *itran)
 {
-   char word[256];
+   char *word,*tok,*lp,lnBuf[MAXSYMLEN];
    int i,tndx,nItem;
    float bowt,prob,scale;
    LM_Id ndx;
@@ -711,12 +1254,15 @@ static int LoadUnigram(Source *src, BackOffLM *lm, int *itran)
 
    SyncStr(src,"\\1-grams:");
    for (i=1; i<=lm->gInfo[1].nEntry; i++){
-      READ_FLOAT(src,&prob,FALSE);
-      if (!GetSrcString(src,word,htkEsc))
+      if ((lp = GetLMLine(src,lnBuf))==NULL)
 	 HError(15413,"LoadUnigram: Unable to read unigram %d",i);
-      SkipWhiteSpace(src);
-      if (!src->wasNewline) {            /* process backoff weight */
-	 READ_FLOAT(src,&bowt,FALSE);
+      if ((tok = NextLMToken(&lp,FALSE))==NULL || !ParseLMFloat(tok,&prob))
+	 HError(15490,"LoadUnigram: Float expected for unigram %d in %s",i,src->name);
+      if ((word = NextLMToken(&lp,htkEsc))==NULL)
+	 HError(15413,"LoadUnigram: Unable to read unigram %d",i);
+      if ((tok = NextLMToken(&lp,FALSE))!=NULL) {  /* process backoff weight */
+	 if (!ParseLMFloat(tok,&bowt))
+	    HError(15490,"LoadUnigram: Float expected for back-off of unigram %s in %s",word,src->name);
 	 has_bowt = TRUE;
       } else {
 	 has_bowt = FALSE;
@@ -798,13 +1344,14 @@ static int LoadNGram(Source *src, int nSize, BackOffLM *lm, int *itran)
    LMProbType ptype;
    Byte fsize, flags;
    SMEntry *se=NULL;
-   FLEntry *feptr=NULL, *fe=NULL;
+   FLEntry *feptr=NULL, *fe=NULL, *cfe;
    float prob,bowt,scale;
    int i,j,k,num_fe,num_se; /*,n*/
-   char *s,lnBuf[256],word[256];
+   char *s,*lp,*tok,*word,lnBuf[256],line[MAXSYMLEN];
    Boolean has_bowt, hasOOV, newCTX, isBin=FALSE;
    NameId wdid[LM_NSIZE], keyid[LM_NSIZE];
 
+   ngFiltered = 0;
    if (nSize==1) {
       return LoadUnigram(src,lm,itran);
    }
@@ -856,9 +1403,12 @@ static int LoadNGram(Source *src, int nSize, BackOffLM *lm, int *itran)
 	    has_bowt = TRUE;
 	 }
       } else { 	/* text model */
-	 READ_FLOAT(src,&prob,FALSE);
+	 if ((lp = GetLMLine(src,line))==NULL)
+	    HError(15450,"LoadNGram: EOF whilst reading %d-gram %d in %s",nSize,i,src->name);
+	 if ((tok = NextLMToken(&lp,FALSE))==NULL || !ParseLMFloat(tok,&prob))
+	    HError(15490,"LoadNGram: Float expected for %d-gram %d in %s",nSize,i,src->name);
 	 for (j=0; j<nSize; j++) {     /* read n-gram words */
-	    if (!GetSrcString(src,word,htkEsc))
+	    if ((word = NextLMToken(&lp,htkEsc))==NULL)
 	       HError(15450,"LoadNGram: Unable to read word %d of %d-gram",j,nSize);
 	    if ((wdid[j] = GetNameId(lm->htab,word,FALSE))==NULL) {
 	       if (itran==NULL)
@@ -868,13 +1418,17 @@ static int LoadNGram(Source *src, int nSize, BackOffLM *lm, int *itran)
 	       ndx = LM_INDEX(wdid[j]);
 	    }
 	 }
- 	 SkipWhiteSpace(src);
-	 if (!src->wasNewline) {
-	    READ_FLOAT(src,&bowt,FALSE);
+	 if ((tok = NextLMToken(&lp,FALSE))!=NULL) {
+	    if (!ParseLMFloat(tok,&bowt))
+	       HError(15490,"LoadNGram: Float expected for back-off of %d-gram %d in %s",
+		      nSize,i,src->name);
 	    has_bowt = TRUE;
 	 }
       }
       if (hasOOV) continue;
+      if (ngFilter != NULL && !(*ngFilter)(nSize,wdid,prob,ngFilterArg)) {
+	 ngFiltered++; continue;
+      }
 
       /* See if the context has changed */
       for (newCTX=FALSE, j=0; j<nSize-1; j++) {
@@ -885,20 +1439,26 @@ static int LoadNGram(Source *src, int nSize, BackOffLM *lm, int *itran)
       /* Guaranteed to execute the first time through the loop because the context
 	 has not been seen before (thus defining fe, se etc) */
       if (newCTX) {             /* new n-gram context */
-	 if (keyid[0]!=NULL) {  /* copy to permanent storage */
-	    StoreFEA(feptr,lm->heap); num_fe += feptr->nfe;
-	    StoreSEA(feptr,lm->heap); num_se += feptr->nse;
-	 }
-	 for (feptr = &(lm->root), j=0; j<nSize-1; j++) {
-	    if ((feptr = FindFE(feptr->fea, 0, feptr->nfe, LM_INDEX(wdid[j])))==NULL) {
+	 for (cfe = &(lm->root), j=0; j<nSize-1; j++) {
+	    if ((cfe = FindFE(cfe->fea, 0, cfe->nfe, LM_INDEX(wdid[j])))==NULL) {
+	       if (j>0 && ngFilter != NULL &&   /* context was filtered out */
+		   !(*ngFilter)(j+1,wdid,0.0,ngFilterArg)) {
+		  ngFiltered++; break;
+	       }
 	       for (s=lnBuf,k=0; k<nSize; k++) {
 		  sprintf(s,"%s[%d] ",wdid[k]->name,LM_INDEX(wdid[k])); s+=strlen(s);
 	       }
 	       HError(15420, "LoadNGram: Cannot find component %d of (%d) %d-gram %s",
 		      j,i,nSize,lnBuf);
 	    }
-	    keyid[j] = wdid[j];
 	 }
+	 if (cfe==NULL) continue;
+	 if (keyid[0]!=NULL) {  /* copy to permanent storage */
+	    StoreFEA(feptr,lm->heap); num_fe += feptr->nfe;
+	    StoreSEA(feptr,lm->heap); num_se += feptr->nse;
+	 }
+	 for (feptr = cfe, j=0; j<nSize-1; j++)
+	    keyid[j] = wdid[j];
 	 feptr->fea = fe = lm->fe_buff; feptr->nfe = 0;
 	 feptr->sea = se = lm->se_buff; feptr->nse = 0;
       }
@@ -1341,7 +1901,8 @@ BackOffLM *LoadLangModel(char *fn, WordMap *wl, float gramScale,
    int *itran,nSize,i,n;
    char c,sfmt[256];
    char lnBuf[MAXSYMLEN];
-   Boolean isUltra;
+   Boolean isUltra,isImage;
+   Boolean filtered[LM_NSIZE+1]; /* orders with n-grams dropped by ngFilter */
    char *first_line;         /* First line of input file */
    char wc_fname[MAXSYMLEN]; /* Filename of word|class probs */
    Source wcSrc;             /* word|class probs/counts file */
@@ -1350,6 +1911,7 @@ BackOffLM *LoadLangModel(char *fn, WordMap *wl, float gramScale,
 
    if ((tgtPType&LMP_FLOAT) && (tgtPType&LMP_LOG))
       HError(15430,"LoadLangModel: Incompatible probability kind requested: %d",tgtPType);
+   for (i=0; i<=LM_NSIZE; i++) filtered[i] = FALSE;
    if (InitSource(fn,&src,LangModFilter)!=SUCCESS)   /* Open LM file */
       HError(15410,"Unable to open language model file");
    if (trace&T_LOAD) {
@@ -1363,6 +1925,8 @@ BackOffLM *LoadLangModel(char *fn, WordMap *wl, float gramScale,
    lm->fe_buff = NULL;
    lm->se_buff = NULL;
    lm->binMap  = NULL;
+   lm->index   = NULL;
+   lm->mapAddr = NULL; lm->mapLen = 0;
    lm->classH = NULL;
    lm->classLM = FALSE; /* default to not a class-based LM */
    lm->classBM = NULL;
@@ -1499,7 +2063,7 @@ BackOffLM *LoadLangModel(char *fn, WordMap *wl, float gramScale,
 	     lm->probType,tgtPType);
    lm->probType &= tgtPType;
 
-   isUltra = FALSE;
+   isUltra = isImage = FALSE;
    for (gi=lm->gInfo+1, nSize=1; nSize<LM_NSIZE; nSize++,gi++) {
       sprintf(sfmt, "ngram %d%%c%%d", nSize);
       if (GetInLine(&src,lnBuf)==NULL)
@@ -1512,6 +2076,7 @@ BackOffLM *LoadLangModel(char *fn, WordMap *wl, float gramScale,
 	    case '=': gi->fmt = LMF_TEXT;   break;
 	    case '~': gi->fmt = LMF_BINARY; break;
 	    case '#': gi->fmt = LMF_ULTRA;  isUltra = TRUE; break;
+	    case '@': gi->fmt = LMF_IMAGE;  isImage = TRUE; break;
             default :
 	       HError(15450,"LoadLangModel: Unknown LM file format (%s)",lnBuf);
 	 }
@@ -1530,6 +2095,8 @@ BackOffLM *LoadLangModel(char *fn, WordMap *wl, float gramScale,
       NameId wdid;
       if (isUltra)
 	 HError(15440,"LoadLangModel: Cannot prune models in ultra format");
+      if (isImage)
+	 HError(15440,"LoadLangModel: Cannot prune models in image format");
       itran = (int *) New(&gstack,(lm->gInfo[1].nEntry+1)*sizeof(int));
       for (i=1; i<=lm->vocSize; i++) {
 	 wdid = GetNameId(lm->htab,wl->id[i-1]->name,TRUE);
@@ -1569,24 +2136,30 @@ BackOffLM *LoadLangModel(char *fn, WordMap *wl, float gramScale,
 #else
       HError(15490,"LoadLangModel: Ultra format LMs not supported");
 #endif
+   } else if (isImage) {                 /* memory image file format */
+      LoadImage(&src,lm);
    } else {                              /* text or binary file format */
-      for (i=1; i<=nSize; i++)
+      for (i=1; i<=nSize; i++) {
 	 lm->gInfo[i].nEntry = LoadNGram(&src,i,lm,itran);
+	 filtered[i] = (ngFiltered>0);
+      }
    }
    if (itran!=NULL) Dispose(&gstack,itran);
    SyncStr(&src,"\\end\\");
    if (wcSrc.f != src.f) CloseSource(&src);
 
-   for (i=1; i<lm->nSize; i++) {
-      if (lm->gInfo[i].nEntry==0) {
-	 HError(-15460,"LoadLangModel: Model order changed from %d-gram to %d-gram",
-		lm->nSize,i-1);
+   for (i=1; i<=lm->nSize; i++) {
+      if (lm->gInfo[i].nEntry==0 && (i<lm->nSize || filtered[i])) {
+	 if (!filtered[i])       /* filtered models shrink silently */
+	    HError(-15460,"LoadLangModel: Model order changed from %d-gram to %d-gram",
+		   lm->nSize,i-1);
 	 lm->nSize=i-1; break;
       }
    }
 
    /* Build reverse look-up for use when recreating context from an FLEntry pointer */
    CreateReverseLookup(&(lm->root));
+   if (hashIndex) BuildLMIndex(lm);
 
    if (lm->classLM) {
       if (lm->classCounts) {
@@ -1613,6 +2186,16 @@ BackOffLM *LoadLangModel(char *fn, WordMap *wl, float gramScale,
    return lm;
 }
 
+/* EXPORT-> FreeLangModel: release the mapped n-grams of lm */
+void FreeLangModel(BackOffLM *lm)
+{
+#ifdef UNIX
+   if (lm->mapAddr!=NULL)
+      munmap(lm->mapAddr,lm->mapLen);
+#endif
+   lm->mapAddr = NULL; lm->mapLen = 0;
+}
+
 
 /*------------------------- LM saving -------------------------*/
 
@@ -1776,7 +2359,8 @@ void SaveLangModel(char *lmFn, BackOffLM *lm)
    int i,n;
    FILE *f;
    NGramInfo *gi;
-   Boolean isPipe,isUltra;
+   LMImageHdr hdr;
+   Boolean isPipe,isUltra,isImage;
 
 #ifdef HTK_CRYPT
    if (lm->encrypt) {
@@ -1788,12 +2372,17 @@ void SaveLangModel(char *lmFn, BackOffLM *lm)
       HError(15411,"SaveLangModel: Unable to open output file %s",lmFn);
    WriteHeaderInfo(f,lm);
    fprintf(f, "\\data\\\n");
-   isUltra = FALSE;
+   isUltra = isImage = FALSE;
+   for (gi=lm->gInfo+1,i=1; i<=lm->nSize; i++,gi++)
+      if (gi->fmt==LMF_IMAGE) isImage = TRUE;
+   if (isImage) InitImage(lm,&hdr);
    for (gi=lm->gInfo+1,i=1; i<=lm->nSize; i++,gi++) {
+      if (isImage) gi->fmt = LMF_IMAGE;
       switch (gi->fmt) {
 	 case LMF_TEXT:   c = '='; break;
 	 case LMF_BINARY: c = '~'; break;
 	 case LMF_ULTRA:  c = '#'; isUltra = TRUE; break;
+	 case LMF_IMAGE:  c = '@'; break;
 	 default:
 	    HError(15490,"SaveLangModel: Unknown LM file format (%d) for %d-gram",gi->fmt,i);
       }
@@ -1810,6 +2399,8 @@ void SaveLangModel(char *lmFn, BackOffLM *lm)
 #else
       HError(15490,"SaveLangModel: Ultra format LMs not supported");
 #endif
+   } else if (isImage) {
+      SaveImage(f,lm,&hdr);
    } else {
       for (i=1; i<=lm->nSize; i++) {
 	 if ((n=SaveNGram(f,i,lm))!=lm->gInfo[i].nEntry) {
@@ -1904,7 +2495,7 @@ float GetNGramProb(BackOffLM *lm, NameId *words, int nSize)
       printf(") ");
    }
    if (nSize==1) {  /* lookup unigram separately */
-      if ((se = FindSE(lm->root.sea,0,lm->root.nse,LM_INDEX(words[0])))==NULL)
+      if ((se = LookupSE(lm,&(lm->root),LM_INDEX(words[0])))==NULL)
 	 HError(15490,"GetNGramProb: Unable to find %s in unigrams",words[0]->name);
 #ifdef LM_COMPACT
       prob = Shrt2Prob(se->prob) * lm->gScale;
@@ -1915,7 +2506,7 @@ float GetNGramProb(BackOffLM *lm, NameId *words, int nSize)
 	 printf("exact, ");
    } else {         /* generic n-gram lookup, n>1 */
       for (fe=&(lm->root), i=0; i<nSize-1; i++) {
-	 if ((fe=FindFE(fe->fea, 0, fe->nfe, LM_INDEX(words[i])))==NULL)
+	 if ((fe=LookupFE(lm, fe, LM_INDEX(words[i])))==NULL)
 	    break;
       }
       if ((fe == NULL) || (fe->nse == 0)) {
@@ -1936,7 +2527,7 @@ float GetNGramProb(BackOffLM *lm, NameId *words, int nSize)
 	    HError(-15492, "GetNGramProb: FLEntry.nse==0; original ARPA LM?\n%s",sbuf);
 	 }
       } else {
-	 if ((se = FindSE(fe->sea, 0, fe->nse, LM_INDEX(words[nSize-1])))!=NULL) {
+	 if ((se = LookupSE(lm, fe, LM_INDEX(words[nSize-1])))!=NULL) {
 #ifdef LM_COMPACT
 	    prob = Shrt2Prob(se->prob) * lm->gScale;
 #else
@@ -1983,6 +2574,120 @@ float GetNGramProb(BackOffLM *lm, NameId *words, int nSize)
 }
 
 
+/* EXPORT-> ResetNGramCursor: clear history of cursor nc */
+void ResetNGramCursor(BackOffLM *lm, NGramCursor *nc, int nSize)
+{
+   int i;
+
+   if (nSize > lm->nSize) nSize = lm->nSize;
+   nc->nCtx = nSize-1; nc->nHist = 0;
+   nc->fe[0] = &(lm->root);
+   for (i=1; i<LM_NSIZE; i++) nc->fe[i] = NULL;
+}
+
+/* EXPORT-> AdvanceNGramCursor: append word to history of nc */
+void AdvanceNGramCursor(BackOffLM *lm, NGramCursor *nc, NameId word)
+{
+   int i;
+   NameId ctx;
+
+   if (nc->nCtx == 0)
+      return;
+   ctx = (lm->classLM) ? ((WordProb*)(word->ptr))->class : word;
+   /* context of last i words is child of context of previous i-1 words */
+   for (i=nc->nCtx; i>0; i--)
+      nc->fe[i] = (nc->fe[i-1]==NULL) ? NULL : LookupFE(lm,nc->fe[i-1],LM_INDEX(ctx));
+   if (nc->nHist == nc->nCtx) {
+      for (i=1; i<nc->nHist; i++) nc->hist[i-1] = nc->hist[i];
+   } else
+      nc->nHist++;
+   nc->hist[nc->nHist-1] = word;
+}
+
+/* EXPORT-> GetCursorProb: probability of word given history in nc */
+float GetCursorProb(BackOffLM *lm, NGramCursor *nc, int nCtx, NameId word)
+{
+   int i,k;
+   float prob;
+   float prob_mult = 0.0;
+   SMEntry *se;
+   FLEntry *fe;
+   AccessInfo *acs;
+   NameId words[LM_NSIZE];
+   Boolean boff[LM_NSIZE];
+
+   if (nCtx < 0 || nCtx > nc->nHist)
+      nCtx = nc->nHist;
+   if (trace&(T_PROB|T_TOP)) {   /* let GetNGramProb do the reporting */
+      for (i=0; i<nCtx; i++) words[i] = nc->hist[nc->nHist-nCtx+i];
+      words[nCtx] = word;
+      return GetNGramProb(lm,words,nCtx+1);
+   }
+   if (lm->classLM) {
+      prob_mult = ((WordProb*)(word->ptr))->prob;
+      word = ((WordProb*)(word->ptr))->class;
+   }
+   /* find longest context holding word, noting those backed off from */
+   for (se=NULL,k=nCtx; k>0; k--) {
+      fe = nc->fe[k]; boff[k] = FALSE;
+      if (fe == NULL || fe->nse == 0)
+         continue;
+      if ((se = LookupSE(lm,fe,LM_INDEX(word)))!=NULL)
+         break;
+      boff[k] = TRUE;
+   }
+   if (k == 0 && (se = LookupSE(lm,&(lm->root),LM_INDEX(word)))==NULL)
+      HError(15490,"GetCursorProb: Unable to find %s in unigrams",word->name);
+#ifdef LM_COMPACT
+   prob = Shrt2Prob(se->prob) * lm->gScale;
+#else
+   prob = se->prob;
+#endif
+   /* then apply back-off weights in the same order as GetNGramProb */
+   for (i=k; i<=nCtx; i++) {
+      if (i > k) {
+         if (boff[i]) {
+            if (lm->probType==LMP_FLOAT)
+               prob *= nc->fe[i]->bowt;
+            else
+               prob += nc->fe[i]->bowt;
+         }
+      }
+      if (i == nCtx && lm->classLM) {
+         if (lm->probType & LMP_FLOAT)
+            prob *= UNLOG_NATURAL(prob_mult);
+         else
+            prob += prob_mult;
+      }
+      if ((acs = lm->gInfo[i+1].aInfo) != NULL) {
+         acs->count++;
+         if (i == k) {
+            if (k > 0) acs->nhits++;
+         } else if (boff[i])
+            acs->nboff++;
+         else
+            acs->nmiss++;
+         acs->prob += prob; acs->prob2 += prob*prob;
+      }
+   }
+   return prob;
+}
+
+/* EXPORT-> GetNGramSeqProbs: probabilities of a sequence of words */
+void GetNGramSeqProbs(BackOffLM *lm, NameId *words, int nWords, int nSize, float *prob)
+{
+   int i;
+   NGramCursor nc;
+
+   ResetNGramCursor(lm,&nc,nSize);
+   for (i=0; i<nWords; i++) {
+      if (i >= nSize-1)
+         prob[i] = GetCursorProb(lm,&nc,-1,words[i]);
+      AdvanceNGramCursor(lm,&nc,words[i]);
+   }
+}
+
+
 /* EXPORT-> LMTrans: calls GetNGramProb, but instead of taking a full
    n-gram of context we take a pointer to a context and a single word;
    we also return a langage model context state */
@@ -2058,7 +2763,7 @@ LogFloat LMTrans2(LModel *LM, LMState src, LabId word, LMState *dest)
       bo_weight = 1;
    else
       bo_weight = 0;
-   se = FindSE(context->sea, 0, context->nse, LM_INDEX(nid));
+   se = LookupSE(lm, context, LM_INDEX(nid));
    nShorten = 0;
    fe = context;
    while (!se) {
@@ -2069,17 +2774,17 @@ LogFloat LMTrans2(LModel *LM, LMState src, LabId word, LMState *dest)
          bo_weight += fe->bowt;
       nShorten++;
       if (nShorten==nSize) { /* Unigram probability */
-         se = FindSE(lm->root.sea, 0, lm->root.nse, LM_INDEX(nid));
+         se = LookupSE(lm, &(lm->root), LM_INDEX(nid));
          if (!se)
             HError(15490, "LMTrans: Unable to find %s in unigrams", nid->name);
       }
       else { /* n>1 */
          fe = &(lm->root);
          for (i=nShorten; i<nSize-1; i++) {
-            fe = FindFE(fe->fea, 0, fe->nfe, LM_INDEX(ngram[i]));
+            fe = LookupFE(lm, fe, LM_INDEX(ngram[i]));
             if (!fe) HError(15491, "LMTrans: Unable to find shortened context in LM");
          }
-         se = FindSE(fe->sea, 0, fe->nse, LM_INDEX(ngram[i]));
+         se = LookupSE(lm, fe, LM_INDEX(ngram[i]));
       }
    }
 #ifdef LM_COMPACT
@@ -2104,7 +2809,7 @@ LogFloat LMTrans2(LModel *LM, LMState src, LabId word, LMState *dest)
    do {
       fe = &(lm->root);
       for (i=index; i<nSize; i++) {
-         fe = FindFE(fe->fea, 0, fe->nfe, LM_INDEX(ngram[i]));
+         fe = LookupFE(lm, fe, LM_INDEX(ngram[i]));
          if (!fe) {
             /* Context not found, so shorten and retry */
             index++;
@@ -2165,7 +2870,7 @@ void *GetNGramAddress(BackOffLM *lm, NameId *words, int nSize)
       address = (void*) &(lm->root);
    } else {         /* generic n-gram lookup, n>1 */
       for (fe=&(lm->root), i=0; i<nSize-1; i++) {
-	 if ((fe=FindFE(fe->fea, 0, fe->nfe, LM_INDEX(words[i])))==NULL)
+	 if ((fe=LookupFE(lm, fe, LM_INDEX(words[i])))==NULL)
             {address = fe; break;}
       }
       if ((fe == NULL) || (fe->nse == 0)) {
@@ -2195,10 +2900,12 @@ void *GetNGramAddress(BackOffLM *lm, NameId *words, int nSize)
 /* EXPORT-> GetNGramProbs: get probabilities for selected SEs */
 void GetNGramProbs(BackOffLM *lm, UInt *nId, int nSize, SMEntry *seBuf, int seBufSize)
 {
-   int i;
-   FLEntry *fe;
+   int i,k,n;
+   float prob;
+   FLEntry *fe,*ctx[LM_NSIZE];
    SMEntry *se,*tse;
    LMProbType ptype;
+   Boolean boff[LM_NSIZE];
 
    /* This fn only called from LPMerge and LPCalc when creating LMs, so this does
       not need to cater for class model w|c component */
@@ -2209,29 +2916,45 @@ void GetNGramProbs(BackOffLM *lm, UInt *nId, int nSize, SMEntry *seBuf, int seBu
    ptype = lm->probType;
    if (ptype!=LMP_FLOAT && ptype!=LMP_LOG)
       HError(15430,"GetNGramProbs: Wrong probability kind (%d)",ptype);
-   if (nSize>1)
-      GetNGramProbs(lm,nId+1,nSize-1,seBuf,seBufSize);
-   for (fe=&(lm->root), i=0; i<nSize-1; i++) {
-      if ((fe=FindFE(fe->fea,0,fe->nfe,nId[i]))==NULL)
-	 break;
+   /* ctx[k] is the context of the last k words, if it holds any SEs */
+   for (k=0; k<nSize; k++) {
+      for (fe=&(lm->root), i=nSize-1-k; i<nSize-1; i++) {
+	 if ((fe=LookupFE(lm,fe,nId[i]))==NULL)
+	    break;
+      }
+      ctx[k] = (fe!=NULL && fe->nse>0) ? fe : NULL;
    }
-   if (fe!=NULL && fe->nse>0) {
-      for (tse=seBuf,i=0; i<seBufSize; i++, tse++) {
-	 if (tse->ndx < 1 || tse->ndx > lm->vocSize)
+   /* each entry takes the prob from the longest context holding it,
+      then the back-off weights of the longer contexts are applied
+      from the shortest upwards */
+   for (tse=seBuf,n=0; n<seBufSize; n++, tse++) {
+      if (tse->ndx < 1 || tse->ndx > lm->vocSize)
+	 continue;
+      for (se=NULL,k=nSize-1; k>=0; k--) {
+	 boff[k] = FALSE;
+	 if (ctx[k]==NULL)
 	    continue;
-	 if ((se = FindSE(fe->sea,0,fe->nse,tse->ndx))!=NULL) {
+	 if ((se = LookupSE(lm,ctx[k],tse->ndx))!=NULL)
+	    break;
+	 boff[k] = TRUE;
+      }
+      if (se!=NULL) {
 #ifdef LM_COMPACT
-	    tse->prob = Shrt2Prob(se->prob);
+	 prob = Shrt2Prob(se->prob);
 #else
-	    tse->prob = se->prob;
+	 prob = se->prob;
 #endif
-	 } else {
-	    if (ptype==LMP_FLOAT)
-	       tse->prob *= fe->bowt;
-	    else
-	       tse->prob += fe->bowt;
-	 }
+      } else
+	 prob = tse->prob;
+      for (k++; k<nSize; k++) {
+	 if (!boff[k])
+	    continue;
+	 if (ptype==LMP_FLOAT)
+	    prob *= ctx[k]->bowt;
+	 else
+	    prob += ctx[k]->bowt;
       }
+      tse->prob = prob;
    }
 }
 
@@ -2242,10 +2965,11 @@ float *GetNGramProbVecSE(BackOffLM *lm, int *nId, int nSize, FLEntry *parent)
       this function assumes that all requested ngrams can be found
       as explicit SEntries - ie. no backing-off is required.
    */
-   FLEntry *fe;
-   float *lmvec;
-   int i,lo,ndx,cen;
+   FLEntry *fe,*ctx[LM_NSIZE];
+   float *lmvec,prob;
+   int i,k,ndx,cen,lo[LM_NSIZE];
    SMEntry *se,*sse,*unigram;
+   Boolean boff[LM_NSIZE];
 
    if (lm->classLM) {
       /* Reach here via LPMerge.c - that means via LAdapt and LMerge in practice */
@@ -2253,41 +2977,52 @@ float *GetNGramProbVecSE(BackOffLM *lm, int *nId, int nSize, FLEntry *parent)
    }
 
    lmvec = lm->lmvec;
-   if (nSize==1) {    /* treat unigrams specially - lookup entries directly */
-      unigram = lm->root.sea;
-      for (sse=parent->sea, i=0; i<parent->nse; i++, sse++) {
-	 if ((ndx = sse->ndx)==0)
+   unigram = lm->root.sea;
+   /* ctx[k] is the context of the last k words (k>0), if it holds any SEs */
+   for (k=1; k<nSize; k++) {
+      for (fe=&(lm->root), i=nSize-1-k; i<nSize-1; i++) {
+	 if ((fe=FindFE(fe->fea,0,fe->nfe,nId[i]))==NULL)
+	    break;
+      }
+      ctx[k] = (fe!=NULL && fe->nse>0) ? fe : NULL;
+      lo[k] = 0;
+   }
+   for (sse=parent->sea, i=0; i<parent->nse; i++, sse++) {
+      if ((ndx = sse->ndx)==0)
+	 continue;
+      /* longest context holding the entry, unigrams are looked up directly */
+      for (se=NULL,k=nSize-1; k>0; k--) {
+	 boff[k] = FALSE;
+	 if (ctx[k]==NULL)
 	    continue;
+	 if ((se = FindSE1(ctx[k]->sea,lo[k],ctx[k]->nse,ndx,&cen))!=NULL) {
+	    lo[k] = cen+1;
+	    break;
+	 }
+	 boff[k] = TRUE;
+      }
+      if (se!=NULL) {
 #ifdef LM_COMPACT
-	 lmvec[ndx] = Shrt2Prob(unigram[ndx-1].prob) * lm->gScale;
+	 prob = Shrt2Prob(se->prob);
 #else
-	 lmvec[ndx] = unigram[ndx-1].prob;
+	 prob = se->prob;
 #endif
-      }
-   } else {
-      GetNGramProbVecSE(lm,nId+1,nSize-1,parent);  /* not needed */
-      for (fe=&(lm->root), i=0; i<nSize-1; i++) {
-	 if ((fe=FindFE(fe->fea,0,fe->nfe,nId[i]))==NULL)
-	    break;
-      }
-      if (fe!=NULL && fe->nse>0) {
-	 for (lo=0, sse=parent->sea, i=0; i<parent->nse; i++, sse++) {
-	    ndx = sse->ndx;
-	    if ((se = FindSE1(fe->sea,lo,fe->nse,ndx,&cen))!=NULL) {
+      } else {
 #ifdef LM_COMPACT
-	       lmvec[ndx] = Shrt2Prob(se->prob);
+	 prob = Shrt2Prob(unigram[ndx-1].prob) * lm->gScale;
 #else
-	       lmvec[ndx] = se->prob;
+	 prob = unigram[ndx-1].prob;
 #endif
-	       lo = cen+1;
-	    } else {
-	       if (lm->probType==LMP_FLOAT)
-		  lmvec[ndx] *= fe->bowt; /* not needed */
-	       else
-		  lmvec[ndx] += fe->bowt; /* not needed */
-	    }
-	 }
       }
+      for (k++; k<nSize; k++) {
+	 if (!boff[k])
+	    continue;
+	 if (lm->probType==LMP_FLOAT)
+	    prob *= ctx[k]->bowt; /* not needed */
+	 else
+	    prob += ctx[k]->bowt; /* not needed */
+      }
+      lmvec[ndx] = prob;
    }
    return lmvec;
 }
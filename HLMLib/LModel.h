@@ -73,14 +73,16 @@ extern "C" {
 #define DEF_ENDWORD     "</s>"
 
 typedef struct _AccessInfo  AccessInfo; /* abstract type for access stats structure */
+typedef struct _LMIndex     LMIndex;    /* abstract type for hashed n-gram index */
 
 typedef enum {       /* external file format definitions */
-  LMF_TEXT, LMF_BINARY, LMF_ULTRA, LMF_OTHER
+  LMF_TEXT, LMF_BINARY, LMF_ULTRA, LMF_IMAGE, LMF_OTHER
 } LMFileFmt;
 /* What text is used by the relevant tools to select these models? */
 #define LM_TXT_TEXT "TEXT"
 #define LM_TXT_BINARY "BIN"
 #define LM_TXT_ULTRA "ULTRA"
+#define LM_TXT_IMAGE "IMAGE"
 #define LM_TXT_OTHER "OTHER"
 
 typedef enum {       /* probability type */
@@ -184,6 +186,9 @@ typedef struct {
    float *lmvec;             /* vector for storing vector n-grams */
    FLEntry *fe_buff;         /* temp buffer */
    SMEntry *se_buff;         /* temp buffer */ /* NB variable size! */
+   LMIndex *index;           /* hashed (context,word) index or NULL */
+   void *mapAddr;            /* n-grams mapped from an image file or NULL */
+   size_t mapLen;            /* length of mapping at mapAddr */
 } BackOffLM;
 
 void InitLModel(void);
@@ -198,6 +203,27 @@ BackOffLM *LoadLangModel(char *fn, WordMap *wl, float gramScale,
    specified in file mapfn, scale probabilities by gramScale
 */
 
+typedef Boolean (*NGramFilter)(int n, NameId *words, float prob, void *arg);
+
+void FreeLangModel(BackOffLM *lm);
+/*
+   Release the n-grams of lm mapped from an image file.  All other
+   storage of lm is on the heap passed to LoadLangModel and is freed
+   when that heap is reset.  lm must not be used afterwards.
+*/
+
+void SetNGramFilter(NGramFilter filter, void *arg);
+/*
+   Install filter to be called by LoadLangModel for each n-gram with
+   n>1 as it is read from a text or binary file, where prob is the
+   probability as stored in the file.  N-grams for which the filter
+   returns FALSE are not stored, nor are any n-grams extending them.
+   When the context of an n-gram is missing, the filter is asked about
+   that context with prob 0.0; unless it rejects the context the file
+   is reported as corrupt.  The filter stays installed until it is
+   removed by passing a NULL filter.
+*/
+
 void SaveLangModel(char *lmFn, BackOffLM *lm);
 /*
    Write language model lmodel to file lmFn
@@ -208,6 +234,13 @@ void StoreFEA(FLEntry *fe, MemHeap *heap);
    Move FEA array into permanent location
 */
 
+void BuildLMIndex(BackOffLM *lm);
+/*
+   Build a hashed (context,word) index so that successor lookups
+   in the n-gram access routines take constant time.  The LM tree
+   must not be altered once the index has been built.
+*/
+
 void AttachAccessInfo(BackOffLM *lm);
 /*
    Create and initialise access stats info
@@ -252,6 +285,36 @@ float GetNGramProb(BackOffLM *lm, NameId *words, int G);
    Obtain the probability P(words[G-1]|words[0],...,words[G-2])
 */
 
+typedef struct {            /* n-gram history cursor */
+   int nCtx;                /* max number of history words held */
+   int nHist;               /* number of history words held */
+   NameId hist[LM_NSIZE];   /* history words, most recent last */
+   FLEntry *fe[LM_NSIZE];   /* fe[k] is context of last k words or NULL */
+} NGramCursor;
+
+void ResetNGramCursor(BackOffLM *lm, NGramCursor *nc, int G);
+/*
+   Clear the history held in nc for subsequent G-gram lookups
+*/
+
+void AdvanceNGramCursor(BackOffLM *lm, NGramCursor *nc, NameId word);
+/*
+   Append word to the history held in nc
+*/
+
+float GetCursorProb(BackOffLM *lm, NGramCursor *nc, int nCtx, NameId word);
+/*
+   Obtain the probability of word following the last nCtx history
+   words held in nc (all of them if nCtx<0).  The result is the same
+   as that of GetNGramProb for the equivalent n-gram.
+*/
+
+void GetNGramSeqProbs(BackOffLM *lm, NameId *words, int nWords, int G, float *prob);
+/*
+   Set prob[i] = P(words[i]|words[i-G+1],...,words[i-1]) for each
+   i=G-1..nWords-1, carrying the history forward with a cursor.
+*/
+
 void *GetNGramAddress(BackOffLM *lm, NameId *words, int G);
 /*
    Obtain a unique pointer id for the context (words[0],...,words[G-2])
@@ -657,6 +657,8 @@ static BackOffLM *InitTargetModel(MemHeap *heap, BuildInfo *bi)
 
    lm = (BackOffLM *) New(heap,sizeof(BackOffLM));
    lm->heap = heap;
+   lm->index = NULL;
+   lm->mapAddr = NULL; lm->mapLen = 0;
    lm->gScale = 1.0;
    lm->nSize = bi->nSize;
    lm->probType = bi->ptype;
@@ -100,6 +100,9 @@ static BackOffLM *InitTargetModel(MemHeap *heap, int nSize, WordMap *wList)
    N = wList->used;
    lm = (BackOffLM *) New(heap,sizeof(BackOffLM));
    lm->heap = heap;
+   lm->index = NULL;
+   lm->mapAddr = NULL; lm->mapLen = 0;
+   lm->classLM = FALSE;
    lm->htab = CreateHashTable(11731,"Back-off LM hash table");
    lm->gScale = 1.0;
    lm->nSize = nSize;
@@ -74,6 +74,9 @@ char *Cluster_vc_id = "$Id: Cluster.c,v 1.1.1.1 2006/10/11 09:54:43 jal58 Exp $"
 /* Granularity of growth of above buffer, if required */
 #define bigram_buffer_grow     1000
 
+/* Number of small counts whose x*log(x) values are tabulated */
+#define xlogx_cache_size       65536
+
 /* Identifiers for word clustering sort orders */
 #define SORT_WMAP 1
 #define SORT_FREQ 2
@@ -119,6 +122,10 @@ static int        *tmp_c3=NULL;             /* Temporary set of bigrams (3) */
 static int        *tmp_c4=NULL;             /* Temporary set of bigrams (4) */
 static int        *tmp_sum1=NULL;           /* Temporary word-class counts (1) */
 static int        *tmp_sum2=NULL;           /* Temporary word-class counts (2) */
+static int        *tmp_set1=NULL;           /* Classes with non-zero tmp_sum1[] */
+static int        *tmp_set2=NULL;           /* Classes with non-zero tmp_sum2[] */
+static int         tmp_size1=0, tmp_size2=0;/* Sizes of tmp_set1[] and tmp_set2[] */
+static double     *xlogx_cache=NULL;        /* x*log(x) for x<xlogx_cache_size */
 static int        *clSum=NULL;              /* Class unigram [classes]
                                                returns word unigram sum */
 static int	  *clMemb=NULL;             /* Class membership [words]
@@ -449,6 +456,14 @@ void classes_init(int numb_words)
    tmp_c4 = CNew(&global_stack, N * sizeof(int));
    tmp_sum1 = CNew(&global_stack, N * sizeof(int));
    tmp_sum2 = CNew(&global_stack, N * sizeof(int));
+   tmp_set1 = CNew(&global_stack, N * sizeof(int));
+   tmp_set2 = CNew(&global_stack, N * sizeof(int));
+   tmp_size1 = tmp_size2 = 0;
+   xlogx_cache = New(&global_stack, xlogx_cache_size * sizeof(double));
+   xlogx_cache[0] = 0;
+   for (i=1; i<xlogx_cache_size; i++) {
+      xlogx_cache[i] = ((double)i) * log(i);
+   }
    mlv = CNew(&global_stack, N * sizeof(double));
    sort_uni = CNew(&global_stack, W * sizeof(int));
    if (!clMemb)
@@ -529,97 +544,138 @@ static void classes_change(UInt w, int g)
 }
 
 
-/* Decide on a class to move word 'w' to. Returns class index. */
+/* Return x*log(x), or 0 when x is 0 */
+static double xlogx(int x)
+{
+   if (x < xlogx_cache_size)
+      return xlogx_cache[x];
+   return ((double)x) * log(x);
+}
+
+
+/* Decide on a class to move word 'w' to. Returns class index.
+
+   Only the class counts C(G(w),*), C(*,G(w)), C(g,*) and C(*,g) change
+   when w moves from G(w) to g, and of those only the entries for classes
+   in which w has left or right neighbours change by more than a constant
+   amount. The change in the optimisation value is therefore accumulated
+   over the (sparse) sets of classes in tmp_set1[] and tmp_set2[] rather
+   than over all classes, making each candidate class cost time
+   proportional to the number of neighbouring classes of w. */
 static int choose_class(UInt w)
 {
    register int i;
    register int j;
+   register int k;
    double d;             /* Change in optimisation value */
-   int uniGx, unig;
+   double from_change;   /* Change from leaving G(w), for all j!=G(w) */
+   int c, uniGx, unig;
    int best_class;
    double best_change;
-   double start_value;
+   int *row, *cnt;
    
    best_class = curr_class;
    best_change = 0;
 
    /* Create set of forward bigram class counts, C(w,*) and C(*,w)
-      (for * = any class) */
-   for (i=0; i<N; i++) {
-      tmp_sum1[i] = 0;
-      tmp_sum2[i] = 0;
+      (for * = any class), clearing only those left by the last word */
+   for (k=0; k<tmp_size1; k++) {
+      tmp_sum1[tmp_set1[k]] = 0;
    }
+   for (k=0; k<tmp_size2; k++) {
+      tmp_sum2[tmp_set2[k]] = 0;
+   }
+   tmp_size1 = tmp_size2 = 0;
    for (i=0; i<forward[w].size; i++) {
-      tmp_sum1[clMemb[forward[w].bi[i].id]] += forward[w].bi[i].count;
+      j = clMemb[forward[w].bi[i].id];
+      if (tmp_sum1[j]==0) {
+         tmp_set1[tmp_size1++] = j;
+      }
+      tmp_sum1[j] += forward[w].bi[i].count;
    }
    for (i=0; i<backward[w].size; i++) {
-      tmp_sum2[clMemb[backward[w].bi[i].id]] += backward[w].bi[i].count;
+      j = clMemb[backward[w].bi[i].id];
+      if (tmp_sum2[j]==0) {
+         tmp_set2[tmp_size2++] = j;
+      }
+      tmp_sum2[j] += backward[w].bi[i].count;
+   }
+   if (uni[w]==0) {
+      /* If we have no information about this word don't bother */
+      return best_class;
    }
 
+   /* Change in C(G(w),j) and C(j,G(w)) terms from removing w, summed
+      over all j!=G(w) - j==g is taken back out for each g below */
+   from_change = 0;
+   row = clCnt[curr_class];
+   for (k=0; k<tmp_size1; k++) {
+      j = tmp_set1[k];
+      if (j!=curr_class) {
+         from_change += xlogx(row[j]-tmp_sum1[j]) - xlogx(row[j]);
+      }
+   }
+   for (k=0; k<tmp_size2; k++) {
+      j = tmp_set2[k];
+      if (j!=curr_class) {
+         c = clCnt[j][curr_class];
+         from_change += xlogx(c-tmp_sum2[j]) - xlogx(c);
+      }
+   }
+   uniGx = clSum[curr_class] - uni[w];
+
+   /* (G(w),G(w)) is the same for all moves */
+   GwGw =   clCnt[curr_class][curr_class]
+          - tmp_sum1[curr_class] - tmp_sum2[curr_class] + bipair[w];
+
   /* Try all classes */
    for (i=start_class; i<N; i++) {
-      if (i==curr_class || uni[w]==0) {
-         /* If we have no information about this word, or its a self-move, don't
-            bother (self-move gives zero change) */
+      if (i==curr_class) {
+         /* Self-move gives zero change */
          continue;
       }
 
-      d = 0;
-      classes_change(w, i);
-
       /* Word has moved to class i, so see how this would change our
          optimisation equation */
-      uniGx = clSum[curr_class] - uni[w];
       unig  = clSum[i] + uni[w];
+      Gwg  =   clCnt[curr_class][i]
+             - tmp_sum1[i] + tmp_sum2[curr_class] - bipair[w];
+      gGw  =   clCnt[i][curr_class]
+             - tmp_sum2[i] + tmp_sum1[curr_class] - bipair[w];
+      gg   =   clCnt[i][i]
+             + tmp_sum1[i] + tmp_sum2[i] + bipair[w];
 
       /* Counts involving original class and a new class */
-      for (j=0; j<N; j++) {
+      d = from_change;
+      if (tmp_sum1[i]) {
+         d -= xlogx(clCnt[curr_class][i]-tmp_sum1[i]) - xlogx(clCnt[curr_class][i]);
+      }
+      if (tmp_sum2[i]) {
+         d -= xlogx(clCnt[i][curr_class]-tmp_sum2[i]) - xlogx(clCnt[i][curr_class]);
+      }
+      row = clCnt[i];
+      for (k=0; k<tmp_size1; k++) {
+         j = tmp_set1[k];
          if ((j!=curr_class) && (j!=i)) {
-            if (tmp_c1[j]) {
-               d += ((double)tmp_c1[j]) * log(tmp_c1[j]);
-            }
-            if (tmp_c2[j]) {
-               d += ((double)tmp_c2[j]) * log(tmp_c2[j]);
-            }
-            if (tmp_c3[j]) {
-               d += ((double)tmp_c3[j]) * log(tmp_c3[j]);
-            }
-            if (tmp_c4[j]) {
-               d += ((double)tmp_c4[j]) * log(tmp_c4[j]);
-            }
+            d += xlogx(row[j]+tmp_sum1[j]) - xlogx(row[j]);
          }
       }
-      /* Unigram part of summation */
-      if (uniGx) {
-         d -= 2*(((double)uniGx)*log(uniGx));
-      }
-      if (unig) {
-         d -= 2*(((double)unig)*log(unig));
+      for (k=0; k<tmp_size2; k++) {
+         j = tmp_set2[k];
+         if ((j!=curr_class) && (j!=i)) {
+            cnt = clCnt[j];
+            d += xlogx(cnt[i]+tmp_sum2[j]) - xlogx(cnt[i]);
+         }
       }
 
-      /* Exceptions */
-      if (GwGw) {
-         d += ((double)GwGw) * log(GwGw);
-      }
-      if (Gwg) {
-         d += ((double)Gwg) * log(Gwg);
-      }
-      if (gGw) {
-         d += ((double)gGw) * log(gGw);
-      }
-      if (gg) {
-         d += ((double)gg) * log(gg);
-      }
+      /* Unigram part of summation */
+      d += 2*(xlogx(clSum[curr_class]) - xlogx(uniGx));
+      d += 2*(xlogx(clSum[i]) - xlogx(unig));
 
-      /* Now make 'd' into a difference: */
-      start_value = mlv[curr_class] + mlv[i];
-      /* Subtract off the two values we added twice by using mlv[] */
-      if (clCnt[curr_class][i])
-         start_value -= clCnt[curr_class][i]*log(clCnt[curr_class][i]);
-      if (clCnt[i][curr_class])
-         start_value -= clCnt[i][curr_class]*log(clCnt[i][curr_class]);
-      /* And calculate 'd': */
-      d = d - start_value;
+      /* Exceptions */
+      d += xlogx(GwGw) + xlogx(Gwg) + xlogx(gGw) + xlogx(gg);
+      d -= xlogx(clCnt[curr_class][curr_class]) + xlogx(clCnt[curr_class][i])
+         + xlogx(clCnt[i][curr_class]) + xlogx(clCnt[i][i]);
 
       if (verbose && logfile) {
          fprintf(logfile, "...moving word %d to class %d from class %d gives %f change\n",
@@ -659,7 +715,9 @@ static int freq_sort_order(int *in1, int *in2)
 }
 
 
-/* Perform one iteration of the clustering algorithm */
+/* Perform one iteration of the clustering algorithm.  Each move is
+   applied before the next word is scored, and recovery files record
+   progress as a position in sort_uni[], so words are taken in order */
 static void do_one_iteration(int w_period, int start_word)
 {
    UInt w, j, w_index;
@@ -1483,6 +1541,11 @@ void write_word_probs(char *filename)
          printf("prob is %f, discount is %f, uni is %d\n", LOG_NATURAL((double)uni[i]/((double)tmp_sum1[clMemb[i]])), mlv[clMemb[i]], uni[i]);
       }
    }
+   /* Leave tmp_sum1[] clear for choose_class() */
+   for (i=0; i<N; i++) {
+      tmp_sum1[i] = 0;
+   }
+   tmp_size1 = 0;
    FClose(out, pipe_status);
    if (trace & T_FILE) {
       printf("Wrote word|class probabilities to '%s'\n", filename);
@@ -1597,16 +1660,18 @@ static void *get_space(int size)
    if (size>block_cut_off)
       return New(&global_stack, size);
 
+   /* Word-align */
+   size = (size+3) & ~3;
+
    /* Use New() again if necessary to get a new block */
-   if (((int)block+(int)size) >= (int)block_end) {
+   if ((char *)block+size >= (char *)block_end) {
       block = New(&global_heap, block_grab_size);
-      block_end = (void *) ((int)block+(int)block_grab_size);
+      block_end = (void *) ((char *)block+block_grab_size);
    }
 
    /* Hand back the next free space */
    ptr = block;
-   block = (void*) ((int) block + (int) size);     /* Next free byte */
-   block = (void*) ((((int)block)+3) & (~(int)3)); /* Word-align */
+   block = (void *) ((char *)block + size);     /* Next free byte */
 
    return ptr;
 }
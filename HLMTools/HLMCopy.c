@@ -92,6 +92,7 @@ static int nParm = 0;                  /* total num params */
 
 void ReplaceUnigrams(char *fn, BackOffLM *lm);
 void MakeDictionary(char *fn, dictList *dicts, Vocab *wlist);
+Boolean KeepNGram(int n, NameId *words, float prob, void *arg);
 
 
 /* ---------------- Process Command Line ------------------------- */
@@ -116,6 +117,8 @@ char *ReturnLMName(int fmt)
 	 return LM_TXT_BINARY;
       case LMF_ULTRA:
 	 return LM_TXT_ULTRA;
+      case LMF_IMAGE:
+	 return LM_TXT_IMAGE;
       default:
 	 return LM_TXT_OTHER;
    }   
@@ -195,9 +198,11 @@ int main(int argc, char *argv[])
                saveFmt = LMF_BINARY;
 	    else if (strcmp(fmt, LM_TXT_ULTRA)==0)
                saveFmt = LMF_ULTRA;
+	    else if (strcmp(fmt, LM_TXT_IMAGE)==0)
+               saveFmt = LMF_IMAGE;
 	    else
-	       HError(16919,"Unrecognised LM format, should be one of [%s, %s, %s]",
-		      LM_TXT_TEXT, LM_TXT_BINARY, LM_TXT_ULTRA);
+	       HError(16919,"Unrecognised LM format, should be one of [%s, %s, %s, %s]",
+		      LM_TXT_TEXT, LM_TXT_BINARY, LM_TXT_ULTRA, LM_TXT_IMAGE);
 	   break;
 	 case 'm':
 	   remDup=FALSE;
@@ -236,6 +241,8 @@ int main(int argc, char *argv[])
       HError(16919, "Output language model filename expected");
    tgtFN= GetStrArg();
 
+   if (nSize>0)               /* don't store n-grams which won't be written */
+      SetNGramFilter(KeepNGram,&nSize);
    if (wlistFN!=NULL) {
       InitVocab(&vocab);   
       if(ReadDict(wlistFN,&vocab) < SUCCESS) 
@@ -251,6 +258,7 @@ int main(int argc, char *argv[])
       voc = NULL;
       lm = LoadLangModel(srcFN,NULL,1.0,LMP_FLOAT|LMP_COUNT,&langHeap);
    }
+   SetNGramFilter(NULL,NULL);
    if (trace&T_TOP) {
      printf("Loaded model from %s\n",srcFN); 
      fflush(stdout);
@@ -281,6 +289,12 @@ int main(int argc, char *argv[])
    return EXIT_SUCCESS; /* never reached -- make compiler happy */
 }   
 
+/* KeepNGram: n-gram load filter, keep n-grams of order up to *arg */
+Boolean KeepNGram(int n, NameId *words, float prob, void *arg)
+{
+   return (n <= *((int *) arg));
+}
+
 /* ReplaceUnigrams: replace unigrams in lm with ones from fn */
 void ReplaceUnigrams(char *fn, BackOffLM *lm)
 {
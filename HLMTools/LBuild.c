@@ -98,6 +98,8 @@ char *ReturnLMName(int fmt)
 	 return LM_TXT_BINARY;
       case LMF_ULTRA:
 	 return LM_TXT_ULTRA;
+      case LMF_IMAGE:
+	 return LM_TXT_IMAGE;
       default:
 	 return LM_TXT_OTHER;
    }   
@@ -166,9 +168,11 @@ int main(int argc, char *argv[])
 	       binfo.saveFmt = LMF_BINARY;
 	    else if (strcmp(fmt, LM_TXT_ULTRA)==0)
 	       binfo.saveFmt = LMF_ULTRA;
+	    else if (strcmp(fmt, LM_TXT_IMAGE)==0)
+	       binfo.saveFmt = LMF_IMAGE;
 	    else
-	       HError(16819,"Unrecognised LM format, should be one of [%s, %s, %s]",
-		      LM_TXT_TEXT, LM_TXT_BINARY, LM_TXT_ULTRA);
+	       HError(16819,"Unrecognised LM format, should be one of [%s, %s, %s, %s]",
+		      LM_TXT_TEXT, LM_TXT_BINARY, LM_TXT_ULTRA, LM_TXT_IMAGE);
 	    break;
          case 't' :
 	    if (NextArg() != STRINGARG)
@@ -113,6 +113,8 @@ static LabId  nulClass;             /* Id of NULCLASS phone label */
 static int    unkEquiv = 0;         /* number of equivalent words outside the word list */
 
 static NameId **l2nId;              /* array of LabId -> NameId lookup tables */
+static NGramCursor lmCur[MAX_LMODEL]; /* history cursor of each LM */
+static int    lmRun[MAX_LMODEL];    /* trailing history words found in each LM */
 static LabId  *eqId;                /* label equivalence lookup table */
 static int cutOff[LM_NSIZE+1];      /* new cutoffs for COUNT-models */
 static float wdThresh[LM_NSIZE+1];  /* new wdThresh for COUNT-models */
@@ -282,6 +284,8 @@ int main(int argc, char *argv[])
 
    Initialise();
    ProcessFiles();
+   for (i=0; i<nLModel; i++)
+      FreeLangModel(lmInfo[i].lm);
 
    Exit(EXIT_SUCCESS);
    return EXIT_SUCCESS; /* never reached -- make compiler happy */
@@ -621,47 +625,65 @@ static LabId GetEQLab(LabId id)
    return cl;
 }
 
-/* GetProb: return nSize-gram probability for ngram in wlab */
-static double GetProb(LabId *wlab, int nSize)
+/* ResetHistory: clear the history of each LM */
+static void ResetHistory(int nSize)
+{
+   int i;
+
+   for (i=0; i<nLModel; i++) {
+      ResetNGramCursor(lmInfo[i].lm, lmCur+i, nSize);
+      lmRun[i] = 0;
+   }
+}
+
+/* AddHistory: append wdid to the history of each LM */
+static void AddHistory(LabId wdid, int nSize)
+{
+   int i;
+   NameId nid;
+
+   for (i=0; i<nLModel; i++) {
+      if (wdid->aux==NULL || (nid = l2nId[i][(int) (wdid->aux)])==NULL) {
+         ResetNGramCursor(lmInfo[i].lm, lmCur+i, nSize);
+         lmRun[i] = 0;
+      } else {
+         AdvanceNGramCursor(lmInfo[i].lm, lmCur+i, nid);
+         if (lmRun[i] < nSize-1) lmRun[i]++;
+      }
+   }
+}
+
+/* GetProb: return nSize-gram probability for wdid following the history */
+static double GetProb(LabId wdid, int nSize)
 {
    /*
       this routine will return the interpolated nSize-gram probability for
-      the words in wlab. Note that the context maybe shortened in the
-      case of multiple LMs and words which do not occur in some of them.
+      wdid given the history held for each LM. Note that the context is
+      shortened to the longest one in which the history and wdid occur in
+      at least one of the LMs, and only those LMs are interpolated.
    */
 
-   int i,j;
+   int i,nCtx;
    LMInfo *li;
-   Boolean inThisLM,inAnyLM;
    double x,prob,psum;
-   NameId nGram[LM_NSIZE];
+   NameId nGram[MAX_LMODEL];
 
-   if (nLModel==1) {
-      inThisLM = TRUE;
-      for (j=0; j<nSize; j++) {
-	 if ((nGram[j] = l2nId[0][(int) (wlab[j]->aux)])==NULL)
-	    inThisLM = FALSE;
-      }
-      if (inThisLM) {
-         prob = GetNGramProb(lmInfo[0].lm, nGram, nSize);
-      }
-      else if (nSize > 1)
-         prob = GetProb(wlab+1,nSize-1);
-      else {
-         prob = LZERO;
-         HError(-16690,"GetProb: assigning zero probability");
-      }
+   for (nCtx=-1, i=0; i<nLModel; i++) {
+      nGram[i] = l2nId[i][(int) (wdid->aux)];
+      if (nGram[i]!=NULL && lmRun[i] > nCtx)
+         nCtx = lmRun[i];
+   }
+   if (nCtx < 0) {
+      prob = LZERO;
+      HError(-16690,"GetProb: assigning zero probability");
+   } else if (nLModel==1) {
+      prob = GetCursorProb(lmInfo[0].lm, lmCur, nCtx, nGram[0]);
    } else {
       psum = 0.0;
-      inAnyLM = FALSE;
       for (li=lmInfo, i=0; i<nLModel; i++, li++) {
-	 for (inThisLM=TRUE, j=0; j<nSize; j++) {
-	    if ((nGram[j] = l2nId[i][(int) (wlab[j]->aux)])==NULL)
-	       inThisLM = FALSE;
-	 }
-	 if (!inThisLM)
+	 if (nGram[i]==NULL || lmRun[i] < nCtx)
 	    continue;
-         x = GetNGramProb(li->lm, nGram, nSize);
+         x = GetCursorProb(li->lm, lmCur+i, nCtx, nGram[i]);
 
 #ifdef INTERPOLATE_MAX
 	 if ((x = exp(x)) > psum)
@@ -669,16 +691,8 @@ static double GetProb(LabId *wlab, int nSize)
 #else
 	 psum += li->weight*exp(x);
 #endif
-	 inAnyLM = TRUE;
-      }
-      if (inAnyLM)
-	 prob = log(psum);
-      else if (nSize > 1)
-	 prob = GetProb(wlab+1,nSize-1);
-      else {
-	 prob = LZERO;
-	 HError(-16690,"GetProb: assigning zero probability");
       }
+      prob = log(psum);
    }
    return prob;
 }
@@ -688,11 +702,13 @@ static double GetProb(LabId *wlab, int nSize)
 static void CalcPerplexity(PStats *sent, LabId *pLab, int numPLabs, int nSize)
 {
    int i,j;
-   LabId *p;
    float prob;
    Boolean hasOOV;
 
-   for (p=pLab, i=nSize-1; i<numPLabs; i++, p++)
+   ResetHistory(nSize);
+   for (i=0; i<nSize-1 && i<numPLabs; i++)
+      AddHistory(pLab[i], nSize);
+   for (i=nSize-1; i<numPLabs; AddHistory(pLab[i], nSize), i++)
    {
       if (pLab[i]==unkId)
 	 continue;	           /* cannot predict OOVs */
@@ -709,7 +725,7 @@ static void CalcPerplexity(PStats *sent, LabId *pLab, int numPLabs, int nSize)
 	 }
 	 if (hasOOV) continue; /* skip to next label since context contains OOV */
       }
-      prob = GetProb(p, nSize);
+      prob = GetProb(pLab[i], nSize);
       sent->nWrd++; sent->logpp += prob; sent->logpp2 += prob*prob;
 
       if (outStreamFN != NULL)
@@ -100,6 +100,13 @@ typedef struct _AccCache{
    struct _AccCache *next;
 } AccCache;                       /* acc cache to save accumulators related to parent XForm */  
 
+typedef struct {
+   int nFrames;                    /* number of frames buffered */
+   Vector *obs;                    /* [1..accBlock] observations */
+   DVector *occ;                   /* [1..accBlock] occ/variance weights */
+   DVector sum;                    /* row of the rank-k update */
+} AccBuf;                          /* frames waiting to be added to a baseclass bTriMat */
+
 typedef struct {
    float occ;
    Vector spSum;
@@ -108,6 +115,7 @@ typedef struct {
    TriMat *bDiagMat;
    DVector bVector;
    Vector  obsVec;
+   AccBuf *aBuf;
 } RegAcc;
 
 typedef struct {
@@ -118,6 +126,7 @@ typedef struct {
    ObsCache *oc;         /* observation cache for input transform */
    ObsCache *paoc;       /* observation cache for parent transform */
    AccCache *paac;       /* accummulator cache for parent transform */
+   int xfStamp;          /* applyStamp of the xform last applied to the parameters */
 } XFormInfo;
 
 /* General variables */
@@ -153,6 +162,8 @@ static Boolean keepXFormDistinct = TRUE;
 static Boolean swapXForms = FALSE;     /* swap the transforms around after generating transform */
 static Boolean mllrCov2CMLLR= FALSE;   /* apply mllrcov transforms as cmllr transform */ 
 static Boolean mllrDiagCov = FALSE;    /* perform diagonal covariance adaptation */
+static Boolean lazyXForm = FALSE;      /* apply model transforms on first use of a component */
+static int xformStamp = 0;             /* last applyStamp handed out */
 
 static IntVec enableBlockAdapt = NULL;
 
@@ -189,6 +200,7 @@ static IntVec cmllrBlockSize = NULL;
 /* current time when this changes accumulate complete stats */
 /* -1 indicates that this is the first frame of a new file */
 static int baseTriMatTime=-1;  
+static int accBlock = 16;        /* frames buffered per baseclass before updating bTriMat */
 static double maxXFormIter = 10; /* something big, for CMLLR */ 
 static ObsCache *headpoc = NULL; 
 static ObsCache *headboc = NULL; 
@@ -359,7 +371,9 @@ void InitAdapt (XFInfo *xfinfo)
       if (GetConfStr (cParm,nParm,"ADAPTKIND",buf)) 
          xformAdaptKind = Str2AdaptKind(buf);
       if (GetConfInt(cParm,nParm,"MAXXFORMITER",&i)) maxXFormIter = i;
+      if (GetConfInt(cParm,nParm,"ACCBLOCK",&i)) accBlock = (i<1) ? 1 : i;
       if (GetConfBool(cParm,nParm,"MLLRDIAGCOV",&b)) mllrDiagCov = b;      
+      if (GetConfBool(cParm,nParm,"LAZYXFORM",&b)) lazyXForm = b;      
       if (GetConfBool(cParm,nParm,"SWAPXFORMS",&b)) swapXForms = b;      
       if (GetConfBool(cParm,nParm,"MLLRCOV2CMLLR",&b)) mllrCov2CMLLR = b; 
 
@@ -802,6 +816,7 @@ static XFormInfo *CreateXFormInfo(MemHeap *x)
    info->paoc = NULL;
    info->oc = NULL;
    info->paac = NULL;
+   info->xfStamp = 0;
    return info;
 }
 
@@ -984,6 +999,7 @@ static void CreateBaseTriMat(MemHeap *x, MixPDF *mp, AdaptXForm *xform, int clas
   BaseClass *bclass;
   ILink i;
   int j, cntj, *vsp, b, bsize;
+  AccBuf *ab;
 
   regAcc = GetRegAcc(mp);
   if (xform->info->accBTriMat) { 
@@ -1003,6 +1019,16 @@ static void CreateBaseTriMat(MemHeap *x, MixPDF *mp, AdaptXForm *xform, int clas
       }
     }
     regAcc->bTriMat = tm;    
+    ab = (AccBuf *)New(x,sizeof(AccBuf));
+    ab->nFrames = 0;
+    ab->obs = (Vector *)New(x,sizeof(Vector)*accBlock); ab->obs--;
+    ab->occ = (DVector *)New(x,sizeof(DVector)*accBlock); ab->occ--;
+    for (j=1;j<=accBlock;j++) {
+      ab->obs[j] = CreateVector(x,vsize);
+      ab->occ[j] = CreateDVector(x,vsize);
+    }
+    ab->sum = CreateDVector(x,vsize);
+    regAcc->aBuf = ab;
   } else regAcc->bTriMat = NULL; 
 
   bclass = xform->bclass;
@@ -1015,6 +1041,7 @@ static void CreateBaseTriMat(MemHeap *x, MixPDF *mp, AdaptXForm *xform, int clas
         ra->bDiagMat = regAcc->bDiagMat;
         ra->bTriMat = regAcc->bTriMat;
         ra->obsVec = regAcc->obsVec;
+        ra->aBuf = regAcc->aBuf;
       }
     } else regAcc->bTriMat = NULL;
   }      
@@ -1059,14 +1086,45 @@ void UpdateAccCache(double Lr, Vector svec, MixPDF *mp)
    }
 }
 
+/* FlushBaseAccs: add the buffered frames of a baseclass to its bTriMat.
+   Each row of each row's triangular matrix gets a rank-k update summed
+   in double precision, so bTriMat is only touched once per block of frames */
+static void FlushBaseAccs(RegAcc *ra)
+{
+   AccBuf *ab = ra->aBuf;
+   int i,j,k,f, bsize, nblock, bl;
+   int cnt, cnti;
+   TriMat tm;
+   float *g, *o;
+   double *sum = ab->sum, s;
+
+   nblock = (int)(ra->bDiagMat[0]);
+   for (bl=1,cnt=1;bl<=nblock;bl++) {
+      bsize = TriMatSize(ra->bDiagMat[bl]);
+      for (i=1,cnti=cnt;i<=bsize;i++,cnti++) {
+         tm = ra->bTriMat[cnti];
+         for (j=1; j<=bsize; j++) {
+            for (k=1; k<=j; k++) sum[k] = 0.0;
+            for (f=1; f<=ab->nFrames; f++) {
+               o = ab->obs[f]+cnt-1;  /* o[1..bsize] is this block */
+               s = ab->occ[f][cnti] * o[j];
+               for (k=1; k<=j; k++)
+                  sum[k] += s * o[k];
+            }
+            g = tm[j];
+            for (k=1; k<=j; k++) g[k] += sum[k];
+         }
+      }
+      cnt += bsize;
+   }
+   ab->nFrames = 0;
+}
+
 void UpdateBaseAccs(Vector svec)
 {
-   int i,j,b,k, bsize, nblock, bl;
-   int cnt, cnti, cntj;
-   TriMat tm, m;
+   int i,b;
    RegAcc *ra;
-   DVector acc;
-   Vector ovec;
+   AccBuf *ab;
    BaseClass *bclass;
    MixPDF *mp;
    
@@ -1075,34 +1133,17 @@ void UpdateBaseAccs(Vector svec)
       mp = ((MixtureElem *)(bclass->ilist[b])->item)->mpdf;
       ra = GetRegAcc(mp);
       if ((ra->bTriMat != NULL) && (ra->bVector[1]>0)) {    
-         acc = ra->bVector;
-         nblock = (int)(ra->bDiagMat[0]);
-
-         /* generate the outer-product */
-         /* moved to here for speed with large numbers of baseclasses */
-         ovec = ra->obsVec;
-         for (bl=1, cnt=1; bl<=nblock;bl++){
-            bsize = TriMatSize(ra->bDiagMat[bl]);
-            m = ra->bDiagMat[bl];
-            for (i=1, cnti=cnt; i<=bsize; i++,cnti++) { /* Fill the outer product */
-               for (j=1,cntj=cnt; j<=i; j++,cntj++)
-                  m[i][j] = ovec[cnti]*ovec[cntj];
-            }
-            cnt +=bsize;
-         }
-
-    for (bl=1,cnti=1;bl<=nblock;bl++) {
-      m = ra->bDiagMat[bl];
-      bsize = TriMatSize(m);
-      for (i=1;i<=bsize;i++,cnti++) { /* Fill the accumulate stores */
-        tm = ra->bTriMat[cnti];
-        for (j=1; j<=bsize; j++)
-          for (k=1; k<=j; k++)
-            tm[j][k] += m[j][k] * acc[cnti];
-      }
-         }
+         /* buffer the previous frame, the outer products are formed in FlushBaseAccs */
+         ab = ra->aBuf;
+         ab->nFrames++;
+         CopyVector(ra->obsVec,ab->obs[ab->nFrames]);
+         CopyDVector(ra->bVector,ab->occ[ab->nFrames]);
+         if (ab->nFrames == accBlock) FlushBaseAccs(ra);
          ZeroDVector(ra->bVector);
       }
+      /* the final call (svec==NULL) completes the statistics */
+      if ((svec == NULL) && (ra->bTriMat != NULL) && (ra->aBuf->nFrames > 0))
+         FlushBaseAccs(ra);
       /* now update the observation cache */
       if (svec != NULL) {
          for (i=1;i<=VectorSize(svec);i++)
@@ -1248,6 +1289,7 @@ static RegAcc *CreateRegAcc(MemHeap *x, MixPDF *mp, AdaptXForm *xform)
     ZeroVector(regAcc->spSumSq);
   } else regAcc->spSumSq = NULL;
   regAcc->bTriMat = NULL;   
+  regAcc->aBuf = NULL;
   return regAcc;
 }
 
@@ -1651,6 +1693,8 @@ static void AccCMLLRBaseStats(MixPDF *mp, AccStruct *accs)
   int i,j,k;
   int cnti,b,bsize;
   TriMat tm;
+  double *g;
+  float *t;
  
   ra = GetRegAcc(mp);
   for (b=1,cnti=1;b<=IntVecSize(accs->blockSize);b++) {
@@ -1658,9 +1702,9 @@ static void AccCMLLRBaseStats(MixPDF *mp, AccStruct *accs)
     for (i=1;i<=bsize;i++,cnti++) {
       tm = ra->bTriMat[cnti];
       for (j=1;j<=bsize;j++) {
-         for (k=1;k<=j;k++) {
-            accs->G[cnti][j][k] += tm[j][k];
-         }      
+         g = accs->G[cnti][j]; t = tm[j];
+         for (k=1;k<=j;k++)
+            g[k] += t[k];
       }
     }
   }
@@ -2523,17 +2567,18 @@ static double GetRowLike(DMatrix gmat,DVector kmat, DVector cofact, double occ,
   double rowLike, det;
   int i, j, size,size2;
   DVector tvec;
-  DMatrix tmat;
  
   size = DVectorSize(w);
   size2 = DVectorSize(cofact);
   tvec = CreateDVector(&gstack,size);
-  tmat = CreateDMatrix(&gstack,size,size);
-  Tri2DMat(gmat,tmat);
   ZeroDVector(tvec);
-  for (i=1;i<=size;i++)
-    for (j=1;j<=size;j++)
-      tvec[i] += w[j]*tmat[i][j];
+  /* G w, reading the symmetric G from its lower triangle */
+  for (i=1;i<=size;i++) {
+    for (j=1;j<=i;j++)
+      tvec[i] += w[j]*gmat[i][j];
+    for (;j<=size;j++)
+      tvec[i] += w[j]*gmat[j][i];
+  }
   rowLike = 0;
   for (i=1;i<=size;i++)
     rowLike += (tvec[i] - 2*kmat[i])*w[i];
@@ -2663,6 +2708,30 @@ static void InitCMLLRXForm(AccStruct *accs, DVector W, DVector bias)
   FreeDVector(&gstack,cofact);
 }
 
+/* UpdateInvRow: update the inverse invA of A after row r of A has 
+   changed by d (Sherman-Morrison).  Returns FALSE if the update is
+   ill-conditioned, in which case invA must be recomputed */
+static Boolean UpdateInvRow(DMatrix invA, int r, DVector d, DVector rvec)
+{
+  int j,k,n;
+  double denom,ci;
+
+  n = NumDRows(invA);
+  for (k=1;k<=n;k++) {
+    rvec[k] = 0;
+    for (j=1;j<=n;j++)
+      rvec[k] += d[j]*invA[j][k];
+  }
+  denom = 1+rvec[r];
+  if (fabs(denom) < 1E-8) return FALSE;
+  for (j=1;j<=n;j++) {
+    ci = invA[j][r]/denom;
+    for (k=1;k<=n;k++)
+      invA[j][k] -= ci*rvec[k];
+  }
+  return TRUE;
+}
+
 static void EstCMLLRXForm(AccStruct *accs, LinXForm *xf)
 {
   DMatrix *InvG,invG,u,v;
@@ -2674,9 +2743,11 @@ static void EstCMLLRXForm(AccStruct *accs, LinXForm *xf)
   int cnt, cnti,b,bsize;
   Boolean uBias;
   double alpha, likeNew, likeOld;
-  double det=0.0,tdet;
+  double det=0.0,tdet,detA;
   DVector W, iniW, tvec, iniA;
   DVector cofact;
+  DMatrix invA;
+  DVector dRow, rvec;
   
   iniA = CreateDVector(&gstack, xf->vecSize);
   if (xf->bias == NULL) {
@@ -2705,6 +2776,9 @@ static void EstCMLLRXForm(AccStruct *accs, LinXForm *xf)
     W = CreateDVector(&gstack,dim);
     iniW = CreateDVector(&gstack,dim);
     tvec = CreateDVector(&gstack,dim);
+    invA = CreateDMatrix(&gstack,bsize,bsize);
+    dRow = CreateDVector(&gstack,bsize);
+    rvec = CreateDVector(&gstack,bsize);
     ZeroDMatrix(A); 
     for (i=1,cnti=cnt;i<=bsize;i++,cnti++) {
       A[i][i] = iniA[cnti];   
@@ -2713,11 +2787,15 @@ static void EstCMLLRXForm(AccStruct *accs, LinXForm *xf)
       InvSVD(InvG[cnti], u, w, v, InvG[cnti]);
     }
     for (iter=1;iter<=maxXFormIter;iter++) {
+      /* the cofactors of all rows come from the inverse of A, which is
+         kept up to date as rows change and recomputed once per pass */
+      detA = DMatInvert(A,invA);
       ZeroDVector(iniW);
       for (i=1,cnti=cnt;i<=bsize;i++,cnti++) {
         for (j=1;j<=bsize;j++)      iniW[j] = A[i][j];
         if (uBias)  iniW[dim] = bias[cnti];
-        det = DMatCofact(A,i,cofact);        
+        for (j=1;j<=bsize;j++)      cofact[j] = detA*invA[j][i];
+        det = detA;
 	invG = InvG[cnti];    
         alpha = GetAlpha(invG,accs->K[cnti],accs->occ,cofact);
         ZeroDVector(W);
@@ -2737,6 +2815,7 @@ static void EstCMLLRXForm(AccStruct *accs, LinXForm *xf)
         if (likeNew>likeOld) {
            det = 0; 
            for (j=1;j<=bsize;j++) {
+              dRow[j] = W[j] - A[i][j];
               A[i][j] = W[j];
               det += cofact[j]*W[j];
            }
@@ -2744,6 +2823,9 @@ static void EstCMLLRXForm(AccStruct *accs, LinXForm *xf)
               bias[cnti] = 0;
               bias[cnti] += W[dim];
            }
+           detA = det;
+           if (!UpdateInvRow(invA,i,dRow,rvec))
+              detA = DMatInvert(A,invA);
 	 } else {
             if (likeOld/likeNew>1.00001) /* put a threshold on this! */
 	      printf("  Not updating transform (Block: %d Row: %d Iter: %d (%f %f))\n",
@@ -3733,6 +3815,7 @@ static AdaptXForm *CreateBaseAdaptXForm(HMMSet *hset, char *xformName)
    xform->hset = hset;
    xform->nUse = 0;
    xform->swapXForm = NULL;
+   xform->applyStamp = 0;
    /* setup the baseclass */
    /* define a baseline xformset with no transforms */
    xform->xformSet = xformSet = (XFormSet *)New(hset->hmem,sizeof(XFormSet));
@@ -3986,7 +4069,10 @@ void ZeroAdaptAccs(HMMSet *hset, AdaptXForm *xform)
             if (ra->spSumSq != NULL) ZeroVector(ra->spSumSq);
          }
          /* Use last component of the baseclass to access baseclass stats */
-         if (ra->bTriMat != NULL) ZeroBaseTriMat(ra->bTriMat);
+         if (ra->bTriMat != NULL) {
+            ZeroBaseTriMat(ra->bTriMat);
+            ra->aBuf->nFrames = 0;
+         }
       }
    }
 }
@@ -4075,6 +4161,12 @@ Vector ApplyCompFXForm(MixPDF *mp, Vector svec, AdaptXForm *xform, LogFloat *det
     } else 
       HError(999,"Can only apply parent and current transform");
 
+    /* model transform applied lazily by DeferHMMSetXForm */
+    if ((xform->applyStamp > 0) && 
+        (((XFormInfo *)mp->info)->xfStamp != xform->applyStamp)) {
+       CompXForm(mp,xform,ai);
+       ((XFormInfo *)mp->info)->xfStamp = xform->applyStamp;
+    }
     *det = 0; 
     if ( oc != NULL ) {
       if (oc->time != t ) {
@@ -4103,6 +4195,8 @@ void ApplyHMMSetXForm(HMMSet *hset, AdaptXForm *xform)
   /* Only created XForm and parent Xform strutures */
   if ((xform != hset->curXForm) && (xform != hset->parentXForm))
     HError(999,"Can only apply parent and current transform");
+  /* the parameters now hold xform, so nothing deferred is pending */
+  xform->applyStamp = 0;
   NewHMMScan(hset,&hss);
   do {
     while (GoNextState(&hss,TRUE)) {
@@ -4110,6 +4204,8 @@ void ApplyHMMSetXForm(HMMSet *hset, AdaptXForm *xform)
 	if (hss.isCont)                     /* PLAINHS or SHAREDHS */
 	  while (GoNextMix(&hss,TRUE)) {
 	    ApplyCompXForm(hss.mp,xform);
+	    if (hss.mp->info != NULL)
+	      ((XFormInfo *)hss.mp->info)->xfStamp = 0;
 	    nAdpt++;
 	  }
       }
@@ -4119,10 +4215,27 @@ void ApplyHMMSetXForm(HMMSet *hset, AdaptXForm *xform)
   if (trace&T_ADT) printf("Adapted %d components\n",nAdpt);
 }
 
+void DeferHMMSetXForm(HMMSet *hset, AdaptXForm *xform)
+{
+  if (lazyXForm && storeMInfo && (xform == hset->curXForm)) {
+    /* 
+       defer the work: each component is transformed by ApplyCompFXForm
+       the first time it is scored, restoring the stored parameters
+       of any previous speaker as it does so 
+    */
+    xform->applyStamp = ++xformStamp;
+    if (trace&T_ADT) printf("Deferred adaptation with %s (stamp %d)\n",
+                            xform->xformName,xform->applyStamp);
+  } else
+    ApplyHMMSetXForm(hset,xform);
+}
+
 void ResetXFormHMMSet(HMMSet *hset)
 {
    HMMScanState hss;
 
+   /* stop any deferred transform being applied to the reset parameters */
+   if (hset->curXForm != NULL) hset->curXForm->applyStamp = 0;
    NewHMMScan(hset,&hss);
    do {
       while (GoNextState(&hss,TRUE)) {
@@ -4130,6 +4243,8 @@ void ResetXFormHMMSet(HMMSet *hset)
             if (hss.isCont)                     /* PLAINHS or SHAREDHS */
                while (GoNextMix(&hss,TRUE)) {
                   ResetComp(hss.mp);
+                  if (hss.mp->info != NULL)
+                     ((XFormInfo *)hss.mp->info)->xfStamp = 0;
                }
          }
       }
@@ -4202,6 +4317,7 @@ AdaptXForm *CopyAdaptXForm(MemHeap *x, AdaptXForm *xform)
    nxform->bclass = xform->bclass;
    nxform->rtree = xform->rtree;
    nxform->nUse = 0; /* This is a new transform */
+   nxform->applyStamp = 0;
    nxform->info = xform->info;
    nxform->parentXForm = xform->parentXForm;
    nxform->hset = xform->hset;
@@ -4498,13 +4614,13 @@ Boolean UpdateSpkrStats(HMMSet *hset, XFInfo *xfinfo, char *datafn)
          MakeFN(cinspkr,NULL,xfinfo->inXFormExt,newMn);
          xfinfo->inXForm = LoadOneXForm(hset,newMn,NULL);
          SetXForm(hset,xfinfo->inXForm);
-         ApplyHMMSetXForm(hset,xfinfo->inXForm);
+         DeferHMMSetXForm(hset,xfinfo->inXForm);
          if (xfinfo->al_hset != NULL) {
             MakeFN(cinspkr,xfinfo->alXFormDir,xfinfo->alXFormExt,newFn);
             MakeFN(cinspkr,NULL,xfinfo->alXFormExt,newMn);
             xfinfo->al_inXForm = LoadOneXForm(xfinfo->al_hset,newMn,newFn);
             SetXForm(xfinfo->al_hset,xfinfo->al_inXForm);
-            ApplyHMMSetXForm(xfinfo->al_hset,xfinfo->al_inXForm);
+            DeferHMMSetXForm(xfinfo->al_hset,xfinfo->al_inXForm);
          } else {
             xfinfo->al_inXForm = xfinfo->inXForm;
          }
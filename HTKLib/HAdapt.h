@@ -110,6 +110,14 @@ void ApplyHMMSetXForm(HMMSet *hset, AdaptXForm* xform);
   Apply current transform (and parents) to complete model set.
 */
 
+void DeferHMMSetXForm(HMMSet *hset, AdaptXForm* xform);
+/*
+  As ApplyHMMSetXForm, but with HADAPT:LAZYXFORM=TRUE the current
+  transform is only marked as applied, and each component is
+  transformed when it is first passed to ApplyCompFXForm.  Only
+  for model sets that are scored rather than read or saved.
+*/
+
 void ApplyCompXForm(MixPDF *mp, AdaptXForm* xform);
 /*
   Apply current transform (and parents) to a component.
@@ -118,7 +126,8 @@ void ApplyCompXForm(MixPDF *mp, AdaptXForm* xform);
 Vector ApplyCompFXForm(MixPDF *mp, Vector svec, AdaptXForm* xform, LogFloat *det, int t);
 /*
   Apply linear transform  (and parents) to observation for a component 
-  return a vector of the transformed parameters.
+  return a vector of the transformed parameters. Any model transform
+  deferred by ApplyHMMSetXForm is applied to the component first.
   IMPORTANT: Do not alter the values of the returned vector
 */
 
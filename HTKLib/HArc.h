@@ -89,6 +89,12 @@ struct _CorrN{
   float *alphaCorr; /* [starti..endi]. */
   float *betaCorr; /* [starti..endi]. */
   double *beta; /* [starti..endi]. */
+
+  int succLo;  /* range of sausage positions of the following nodes */
+  int succHi;
+  float *bestCorr; /* [succLo..succHi] best correctness to this node, given the following node at i */
+  float *bestPart; /* [succLo..succHi] contribution of this node to it */
+  int *bestJ;      /* [succLo..succHi] sausage position it came from, -1 if none */
 };
 
 
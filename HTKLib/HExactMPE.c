@@ -243,6 +243,37 @@ Boolean GetBestCorrectness /*step correctness by 1 phone.*/
   if(_bestj) *_bestj = bestj;                     /* sausage pos of best contribution */
   return(bestj!=-1);
 }
+/* SetBestCorrectness: tabulate GetBestCorrectness for cn_prev at every sausage position
+   i of the nodes following it, so that the forward and backward recursions do not 
+   repeat the search for each transition.  cn_prev->alphaCorr must be complete. */
+static void SetBestCorrectness(MemHeap *mem, CorrN *cn_prev,
+                               short int *minn_of_t, short int *maxn_of_t, short int *niphones,
+                               int **iphone, unsigned char *nonempty, int T, int N, float InsCorrectness){
+  int i, lo = cn_prev->succLo, n = cn_prev->succHi - cn_prev->succLo + 1;
+  float BestCorr;
+
+  cn_prev->bestCorr = (float*)New(mem, sizeof(float) * n) - lo;
+  cn_prev->bestPart = (float*)New(mem, sizeof(float) * n) - lo;
+  cn_prev->bestJ = (int*)New(mem, sizeof(int) * n) - lo;
+  for(i=lo;i<=cn_prev->succHi;i++){
+    if(!GetBestCorrectness(&BestCorr, cn_prev->bestPart+i, cn_prev->bestJ+i, i, cn_prev,
+                           minn_of_t,maxn_of_t,niphones,iphone,nonempty,T,N,InsCorrectness)){
+      cn_prev->bestJ[i] = -1; continue;
+    }
+    cn_prev->bestCorr[i] = BestCorr;
+    /* Checking: */
+    if(BestCorr > 10000 || ((BestCorr < -500) && cn_prev->alpha>LSMALL)){
+      if(debug_bestcorr > 0){
+        debug_bestcorr--;
+        HError(-1, "BestCorr too big (or this is a very long or strange file)... (%f)", BestCorr);
+      } else if(!debug_bestcorr){
+        HError(-1, "Not warning about this any more, BestCorr too big.");
+        debug_bestcorr--;
+      }
+    }
+  }
+}
+
 float DoCorrectness(FBLatInfo *fbInfo, MemHeap *mem, ArcInfo *ai, float prune, 
                     int beamN/*phones on either side...*/,
 		    short int *minn_of_t,    /* lowest sausage position active at time t. */
@@ -399,6 +430,14 @@ float DoCorrectness(FBLatInfo *fbInfo, MemHeap *mem, ArcInfo *ai, float prune,
     cn->beta = New(mem, sizeof(double) * (ne-ns+1)); cn->beta -= ns;
     cn->starti = ns; cn->endi = ne;
     for(i=ns;i<=ne;i++){ cn->betaCorr[i]=0; cn->beta[i]=LZERO; }
+    cn->succLo = N+1; cn->succHi = -1; cn->bestCorr = NULL;
+  }
+  for(cn=startNode;cn;cn=cn->next){ /* ... and the positions at which each node's successors look at it. */
+    CorrA *ca;
+    for(ca=cn->precTrans;ca;ca=ca->end_foll){
+      if(cn->starti < ca->start->succLo) ca->start->succLo = cn->starti;
+      if(cn->endi > ca->start->succHi) ca->start->succHi = cn->endi;
+    }
   }
 
 
@@ -414,37 +453,26 @@ float DoCorrectness(FBLatInfo *fbInfo, MemHeap *mem, ArcInfo *ai, float prune,
       for(i=1;i<=cn->endi;i++) cn->alphaCorr[i]=-10000;  /*very negative so wont be used.*/
     } else {   /* Not start node so sum over preceding nodes. */
       CorrA *ca; CorrN *cn_prev;
+      float *alphaCorr = cn->alphaCorr, *bestCorr;
+      int *bestJ;
       for(i=cn->starti;i<=cn->endi;i++){
-	cn->alphaCorr[i]=0; 
+	alphaCorr[i]=0; 
 	if(!cn->precTrans) /* has no preceding nodes-- may be the case due to pruning. */
-	  cn->alphaCorr[i]=-10000; 
-
-	for(ca=cn->precTrans;ca;ca=ca->end_foll){  /* recursively calculate the correctness of this cn at this sausage-pos i,
-                                                      given that previous cn's will have their correctnesses calculated at all positions. */
-	  float BestCorr = -10000;
-	  float occ;
-	  cn_prev = ca->start;
-
-          if(GetBestCorrectness(&BestCorr, NULL, NULL, i, cn_prev,
-                                minn_of_t,maxn_of_t,niphones,iphone, nonempty,T,N,InsCorrectness)){
-
-          
-            occ = cn_prev->alpha+ca->sc_lmlike+cn->scaled_aclike - cn->alpha; /* lg(occ as fraction of total occ of cn). */
-            if(occ<MINEARG) occ=0.0; else occ=exp(occ); 
-            cn->alphaCorr[i] += BestCorr * occ; /* these occs will sum to 1 over all preceding arcs. */
-            
-            /* Checking: */
-            if(BestCorr > 10000 || ((BestCorr < -500) && cn_prev->alpha>LSMALL)){
-              if(debug_bestcorr > 0){
-                debug_bestcorr--;
-                HError(-1, "BestCorr too big (or this is a very long or strange file)... (%f)", BestCorr);
-              } else if(!debug_bestcorr){
-                HError(-1, "Not warning about this any more, BestCorr too big.");
-                debug_bestcorr--;
-              }
-            }
-          }
-	}
+	  alphaCorr[i]=-10000; 
+      }
+      for(ca=cn->precTrans;ca;ca=ca->end_foll){  /* recursively calculate the correctness of this cn at each sausage-pos i,
+                                                    given that previous cn's will have their correctnesses calculated at all positions. */
+        float occ;
+        cn_prev = ca->start;
+        if(!cn_prev->bestCorr)
+          SetBestCorrectness(mem, cn_prev, minn_of_t,maxn_of_t,niphones,iphone,nonempty,T,N,InsCorrectness);
+
+        occ = cn_prev->alpha+ca->sc_lmlike+cn->scaled_aclike - cn->alpha; /* lg(occ as fraction of total occ of cn). */
+        if(occ<MINEARG) occ=0.0; else occ=exp(occ); 
+        bestCorr = cn_prev->bestCorr; bestJ = cn_prev->bestJ;
+        for(i=cn->starti;i<=cn->endi;i++)
+          if(bestJ[i] >= 0)
+            alphaCorr[i] += bestCorr[i] * occ; /* these occs will sum to 1 over all preceding arcs. */
       }
       if( (!cn->me_end->follTrans)) { /* end node, so get contribution to avg correctness... */
 	double alpha = cn->alpha; 
@@ -484,13 +512,15 @@ float DoCorrectness(FBLatInfo *fbInfo, MemHeap *mem, ArcInfo *ai, float prune,
 	if(cn->beta[i] > LZERO+1000){
 	  for(ca=cn->precTrans;ca;ca=ca->end_foll){
             float betaCorr,betaCorr_prev;
-            float BestCorrPart; int bestj=-1;
+            float BestCorrPart; int bestj;
             double beta_prev,beta_trans,beta_sum;
 	    cn_prev = ca->start;
+            if(!cn_prev->bestCorr)
+              SetBestCorrectness(mem, cn_prev, minn_of_t,maxn_of_t,niphones,iphone,nonempty,T,N,InsCorrectness);
+            bestj = cn_prev->bestJ[i];
 
-
-            if( GetBestCorrectness(NULL, &BestCorrPart,  &bestj, i, cn_prev,
-                                   minn_of_t,maxn_of_t,niphones,iphone, nonempty,T,N,InsCorrectness) ){ /* if there is nonzero likelihood to cn_prev.. */
+            if( bestj >= 0 ){ /* if there is nonzero likelihood to cn_prev.. */
+              BestCorrPart = cn_prev->bestPart[i];
             
               /* Add this contribution of beta to the previous beta, and
                  set the previous betaCorr to a weighted avg of the
@@ -668,7 +698,7 @@ void DoExactCorrectness(FBLatInfo *fbInfo, Lattice *lat){
 	int startT, endT;
 	int w = (int) larc->score;
 	if(w<0 || w>=nWords) HError(-1, "Problem with word numbering [2] (%d,%d)...",w,nWords);
-	GetTimes(larc, 0, &startT, &endT); /* get times [of first phone]... */
+	GetTimes(fbInfo, larc, 0, &startT, &endT); /* get times [of first phone]... */
 	if(startT<1){ HError(-1, "Invalid start time..."); startT=1;}
 	if(endT>fbInfo->T){ HError(-1, "Invalid end time..."); endT=fbInfo->T; }
 	if(startT>fbInfo->T){ HError(-1, "Invalid start time..."); startT=fbInfo->T;}
@@ -769,7 +799,7 @@ void DoExactCorrectness(FBLatInfo *fbInfo, Lattice *lat){
 	    if(Quinphone && state_quinphone != 2) HError(1, "Quinphone problem... check code, may not be compat with this quinphone set.");
 	    for(x=0;x<niphones[startPos+p];x++)if(local_iphone==iphone[startPos+p][x]){ Found=TRUE; break; } 
 	    if(!Found){ iphone[startPos+p][niphones[startPos+p]++] = local_iphone; }
-	    GetTimes(larc, j, &startT, &endT); /* set times... */
+	    GetTimes(fbInfo, larc, j, &startT, &endT); /* set times... */
 	    if(startT<1){ HError(-1, "Invalid start time..."); startT=1;}
 	    if(endT>fbInfo->T){ HError(-1, "Invalid end time..."); endT=fbInfo->T; }
 	    if(startT>fbInfo->T){ HError(-1, "Invalid start time..."); startT=fbInfo->T;}
@@ -87,7 +87,8 @@ static Boolean PhoneMEEUseContext = FALSE;                  /*Compare phones-in-
 static Boolean ExactCorrectness=FALSE; /*IMPORTANT*/         /* Do 'exact' version of MPE/MWE, not using approximation.  This is slightly better for
                                                                 e.g. Wall Street Journal and BN, you may have to tune InsCorrectness (e.g, -0.9), but its
                                                                 worse for Switchboard.  See also configs in HFBExactMPE, if this is TRUE. */
-static Boolean DoingFourthAcc=FALSE;    /* Indicate currently it is doing MPE with MMI prior */
+static Boolean DoingFourthAcc=FALSE;    /* Indicate currently it is doing MPE with MMI prior, copied to
+                                           each FBLatInfo by FBLatFirstPass */
 static int add_index = 999;   /* additional index for discriminative training: 3 for MPE with MMI prior */
 static float InsCorrectness = -1;                            /* Correctness of an inserted phone.  Can be tuned, it affects recognition insertion rate.
                                                                 E.g. InsCorrectness = -0.85 will increase insertions upon testing, relative to default = -1. */
@@ -107,6 +108,8 @@ static float latProbScale = 1.0; /*IMPORTANT*/  /* Scales the lattice-arc and lm
                                                    of the normal language model scale.  Smaller values, e.g. 1/25, 1/50 can be useful too.  */
 static float probScale = 1.0;                 /* Scales the state-output and lm probabilities.  Leave this alone for normal usage. */
 static float langProbScale = 1.0;             /* Extra scale on lm probabilities.   Leave this alone for normal usage. */
+static Boolean shareOutP = TRUE;              /* Keep the state output probs of an utterance for the next pass over the same
+                                                 data file, so the denominator pass does not rescore the numerator states. */
 
 
 static float phnInsPen = 0.0;                 /* Insertion penalty for each phone, not subject to lm scaling.  Normally zero, but setting it to e.g.
@@ -118,10 +121,10 @@ static float phnInsPen = 0.0;                 /* Insertion penalty for each phon
 
 static int StartTime=0;     /* This is a value that we use to help calculating the PreComp's of
 			       the MOutP's, to make sure not to use previously cached values. 
-			       Doesn't matter if shared between different FBLatInfo's.  */
+			       Each FBLatInfo reserves T frames of it in FBLatFirstPass, so that
+			       contexts never share cached values. */
 float hfwdbkwd_totalProbScale = 1.0;          /* (not a config.) Product of all scales affecting lm likelihoods.   Also read in HFBExactMPE.c and possibly
                                                  HMMIRest.c */
-static FBLatInfo *fbInfo; /* current fbInfo, so don't have to pass it around. */
 
 static ConfParam *cParm[MAXGLOBS];  /* config parameters */
 static int nParm = 0;
@@ -659,7 +662,7 @@ static void SetCorrectnessAsError(FBLatInfo *fbInfo, Lattice *numLat){    /* re
 
 
 /* ZeroAlpha: zero alpha's of all models */
-static void ZeroAlpha(int sq, int eq)
+static void ZeroAlpha(FBLatInfo *fbInfo, int sq, int eq)
 {
    int Nq,j,q;
    DVector aq;
@@ -677,7 +680,7 @@ static void ZeroAlpha(int sq, int eq)
 
 /* StepAlpha: calculate alphat column for time t */
 /* Calculates the forward (alpha) likelihoods given the previous alpha likelihoods, i.e. for t-1 */
-static void StepAlpha(int t)
+static void StepAlpha(FBLatInfo *fbInfo, int t)
 {
    DVector aq,laq,tmp;
    float ***outprob;
@@ -763,8 +766,64 @@ static float * NewOtprobVec(MemHeap *x, int M)
 }
 
 
+/* --------------------- Output probability cache -------------------------- */
+
+/* The stream output probabilities are cached per frame in the WtAcc hook of
+   each StreamElem (wa->time, wa->prob), which only holds the last frame seen.
+   When the same utterance is aligned against several lattices in turn (the
+   numerator and then the denominator lattices in HMMIRest), the states
+   scored at each frame are also recorded in fbInfo->likeCache, and on the
+   next pass they are put back into the WtAcc hooks before the frame is
+   scored, so only states that were not seen before need MOutP calls.
+   Since a later pass may need any frame, and the backward pass of the
+   current one reads the vectors of every frame, the cache covers the
+   whole utterance: one LikeEnt and one vector of nMix+1 floats for each
+   state scored at each frame in any pass.  The vectors of the current
+   pass would otherwise be held on aInfo->mem, so the extra cost is the
+   entries themselves and the vectors kept from earlier passes.  */
+
+typedef struct _LikeEnt{
+   StreamElem *ste;
+   float *prob;             /* as returned by ShStrP, on likeStack */
+   struct _LikeEnt *next;
+} LikeEnt;
+
+/* UseLikeCache: set up the cache for data file fn, keeping the old 
+   entries if they were computed for the same file */
+static void UseLikeCache(FBLatInfo *fbInfo, char *fn)
+{
+   int t;
+
+   if (!shareOutP || probScale != 1.0 || fbInfo->S != 1 ||
+       (fbInfo->hsKind != PLAINHS && fbInfo->hsKind != SHAREDHS)) {
+      fbInfo->likeCache = NULL;   /* outprobs are scaled/combined in place */
+      return;
+   }
+   if (fbInfo->likeCache != NULL && fbInfo->likeT == fbInfo->T &&
+       fbInfo->likeXForm == fbInfo->inXForm && strcmp(fbInfo->likeFn,fn) == 0)
+      return;
+   ResetHeap(&fbInfo->likeStack);
+   fbInfo->likeCache = (LikeEnt **)New(&fbInfo->likeStack, (fbInfo->T+1)*sizeof(LikeEnt *));
+   for (t=0; t<=fbInfo->T; t++) fbInfo->likeCache[t] = NULL;
+   fbInfo->likeT = fbInfo->T;
+   fbInfo->likeXForm = fbInfo->inXForm;
+   strcpy(fbInfo->likeFn,fn);
+}
+
+/* RestoreLikes: reload the WtAcc hooks with the cached outprobs of frame t */
+static void RestoreLikes(FBLatInfo *fbInfo, int t)
+{
+   LikeEnt *e;
+   WtAcc *wa;
+
+   for (e=fbInfo->likeCache[t]; e!=NULL; e=e->next) {
+      wa = (WtAcc *)e->ste->hook;
+      wa->prob = e->prob; wa->time = t+fbInfo->startTime;
+   }
+}
+
 /* ShStrP: Stream Outp calculation exploiting sharing */
-static float * ShStrP(Vector v, int t, StreamElem *ste, AdaptXForm *xform, MemHeap *amem)
+static float * ShStrP(FBLatInfo *fbInfo, Vector v, int t, StreamElem *ste, AdaptXForm *xform, MemHeap *amem)
 {
    WtAcc *wa;
    MixtureElem *me;
@@ -813,13 +872,19 @@ static float * ShStrP(Vector v, int t, StreamElem *ste, AdaptXForm *xform, MemHe
       outprobjs[0] = x;
       wa->prob = outprobjs;
       wa->time = t;
+      if (fbInfo->likeCache != NULL) {
+         LikeEnt *e = (LikeEnt *)New(&fbInfo->likeStack, sizeof(LikeEnt));
+         int ft = t - fbInfo->startTime;
+         e->ste = ste; e->prob = outprobjs;
+         e->next = fbInfo->likeCache[ft]; fbInfo->likeCache[ft] = e;
+      }
    }
    return outprobjs;
 }
    
 
 /* Setotprob: allocate and calculate otprob matrix at time t */
-static void Setotprob(int t)
+static void Setotprob(FBLatInfo *fbInfo, int t)
 {
    int q,j,Nq,s;
    float ***outprob;
@@ -834,6 +899,8 @@ static void Setotprob(int t)
 
    if (fbInfo->hsKind == TIEDHS)
       PrecomputeTMix(fbInfo->hset,&(fbInfo->al_ot),minFrwdP,0);
+   if (fbInfo->likeCache != NULL)
+      RestoreLikes(fbInfo, t);
   
   
    for (q=fbInfo->aInfo->qHi[t];q>=fbInfo->aInfo->qLo[t];q--) {
@@ -862,9 +929,10 @@ static void Setotprob(int t)
                                 sharing is needed in any case for lattices. */
                case SHAREDHS:
 		  if (fbInfo->S==1)
-		     outprob[j][0] = ShStrP(fbInfo->al_ot.fv[s],t+StartTime,ste,fbInfo->inXForm,fbInfo->aInfo->mem);
+		     outprob[j][0] = ShStrP(fbInfo, fbInfo->al_ot.fv[s],t+fbInfo->startTime,ste,fbInfo->inXForm,
+                                            fbInfo->likeCache!=NULL ? &fbInfo->likeStack : fbInfo->aInfo->mem);
 		  else
-		     outprob[j][s] = ShStrP(fbInfo->al_ot.fv[s],t+StartTime,ste,fbInfo->inXForm,fbInfo->aInfo->mem);
+		     outprob[j][s] = ShStrP(fbInfo, fbInfo->al_ot.fv[s],t+fbInfo->startTime,ste,fbInfo->inXForm,fbInfo->aInfo->mem);
 		  break;
                default:       HError(1, "Unknown hset kind.");
                }
@@ -885,7 +953,7 @@ static void Setotprob(int t)
    }
 }
 
-void SetModelBetaPlus(int t, int q){
+static void SetModelBetaPlus(FBLatInfo *fbInfo, int t, int q){
    double x=LZERO;
    Acoustic *ac = fbInfo->aInfo->ac+q;
    HLink hmm = ac->hmm;
@@ -913,7 +981,7 @@ void SetModelBetaPlus(int t, int q){
 
 
 /* SetBetaPlus: calculate gamma and otprob matrices */
-static void SetBetaPlus()
+static void SetBetaPlus(FBLatInfo *fbInfo)
 {
    int t,q; /*,lNq=0,q_at_gMax;*/
    LogDouble x;
@@ -924,11 +992,11 @@ static void SetBetaPlus()
    */
    ResetObsCache();  
    for (t=fbInfo->T;t>=1;t--) {
-      Setotprob(t);
+      Setotprob(fbInfo, t);
       for (q=fbInfo->aInfo->qHi[t];q>=fbInfo->aInfo->qLo[t];q--) { /*MAX(qHi[t],qLo[t]) because of the case for tee models where qHi[t]=qLo[t]-1 .*/
          Acoustic *ac = fbInfo->aInfo->ac + q;
          if(t>=ac->t_start && t<=ac->t_end){ /*in beam.*/
-            SetModelBetaPlus(t,q);
+            SetModelBetaPlus(fbInfo,t,q);
          }
          if(t==ac->t_start){ /* We need to set "aclike", the total accumulated acoustic
                                 probability for this frame. */
@@ -945,20 +1013,20 @@ static void SetBetaPlus()
 
 
 
-void UpSkipTranParms(int q, int t){
+static void UpSkipTranParms(FBLatInfo *fbInfo, int q, int t){
    Acoustic *ac = fbInfo->aInfo->ac+q;
    HLink hmm=ac->hmm;
    double occ = ac->locc;
    float mee_acc_scale = fbInfo->AccScale*(fbInfo->MPE?ac->mpe_occscale:1), abs_mee_acc_scale = fabs(mee_acc_scale); 
    int local_accindx = (mee_acc_scale > 0 ? fbInfo->num_index : fbInfo->den_index);
    TrAcc *ta,*tammi=NULL; int N = hmm->numStates; ta = ((TrAcc*)GetHook(hmm->transP)) + local_accindx;
-   if(DoingFourthAcc) tammi = ((TrAcc*)GetHook(hmm->transP)) + add_index;  
+   if(fbInfo->doFourthAcc) tammi = ((TrAcc*)GetHook(hmm->transP)) + fbInfo->fourthIndex;  
 
    if(occ > MINEARG){
       float occmmi = exp(occ);  
       ta->occ[1] += occmmi * abs_mee_acc_scale;
       ta->tran[1][N] += occmmi * abs_mee_acc_scale;
-      if(DoingFourthAcc) {   /* doing 4th acc for MPE with MMI prior */
+      if(fbInfo->doFourthAcc) {   /* doing 4th acc for MPE with MMI prior */
          tammi->occ[1] += occmmi;
          tammi->tran[1][N] += occmmi;
       }
@@ -967,7 +1035,7 @@ void UpSkipTranParms(int q, int t){
 
 /* UpTranParms: update the transition counters of given hmm */
 
-static void UpTranParms(int t, int q){ 
+static void UpTranParms(FBLatInfo *fbInfo, int t, int q){ 
    TrAcc *ta,*tammi=NULL;   
    Acoustic *ac = fbInfo->aInfo->ac+q;
    HLink hmm = ac->hmm;
@@ -979,7 +1047,7 @@ static void UpTranParms(int t, int q){
    int i,j,N;
 
    N = hmm->numStates;    ta = ((TrAcc*)GetHook(hmm->transP)) + local_accindx;
-   if(DoingFourthAcc) tammi = ((TrAcc*)GetHook(hmm->transP)) + add_index;   
+   if(fbInfo->doFourthAcc) tammi = ((TrAcc*)GetHook(hmm->transP)) + fbInfo->fourthIndex;   
 
 
    for(i=1;i<N;i++){
@@ -1001,7 +1069,7 @@ static void UpTranParms(int t, int q){
             occmmi = exp(x);
             occ = occmmi*abs_mee_acc_scale;
             ti[j] += occ; ta->occ[i] += occ;
-            if(DoingFourthAcc) {   /* do 4th acc if MPE with MMI prior */
+            if(fbInfo->doFourthAcc) {   /* do 4th acc if MPE with MMI prior */
                tammi->tran[i][j] += occmmi;
                tammi->occ[i] += occmmi;
             }
@@ -1012,58 +1080,53 @@ static void UpTranParms(int t, int q){
 
 
 
-typedef struct{
+typedef struct _MixOcc{
    MixPDF *mp;
    float occ;
    float scaledOcc; /*for MEE.*/
 } MixOcc;
 
-Boolean CachingInitialised = FALSE;
-MemHeap cacheMixoccHeap;
-
-/* Following variables relate to caching of mixture occupation probabilities. */
+/* The mixture occupation caches themselves (nPDFs, savedMixes) are held
+   in each FBLatInfo; only the heap they are allocated from is shared. */
+static Boolean CachingInitialised = FALSE;
+static MemHeap cacheMixoccHeap;
 
 
-static int nPDFs[SMAX];  /*rely on it being initialised to zeros.*/
-static int SavedMixesSize[SMAX]; 
-static MixOcc *SavedMixes[SMAX]; /* [1..S][1..nPDFs[s]] */
-
-
-void DoMixUpdate(MixPDF *mp, int s, float Lr, float meescale, int t){  
+static void DoMixUpdate(FBLatInfo *fbInfo, MixPDF *mp, int s, float Lr, float meescale, int t){  
    /* Stores the mp for update later...  The updates are performed once every time frame.  Avoids
       accumulating stats more than once for the same Gaussian.  */
   
-   int RealT = -(10+t+StartTime); /*now t is a unique identifier; the minus is to distinguish from the use of PreComp for caching of OutPs.
+   int RealT = -(10+t+fbInfo->startTime); /*now t is a unique identifier; the minus is to distinguish from the use of PreComp for caching of OutPs.
                                     10 is to avoid zero. */
    PreComp *pMix;
    pMix = (PreComp *)mp->hook;
 
    if(pMix->time != RealT){
-      int indx = nPDFs[s]++;
+      int indx = fbInfo->nPDFs[s]++;
       pMix->indx = indx;
       pMix->time = RealT;
-      if(SavedMixesSize[s] <= indx){
+      if(fbInfo->savedMixesSize[s] <= indx){
          MixOcc *NewArray;
-         int NewSize = MAX(100, SavedMixesSize[s]*2), n;
-         SavedMixesSize[s] = NewSize;
+         int NewSize = MAX(100, fbInfo->savedMixesSize[s]*2), n;
+         fbInfo->savedMixesSize[s] = NewSize;
          NewArray = New(&cacheMixoccHeap, sizeof(MixOcc) * NewSize);
          for(n=0;n<indx;n++){
-            NewArray[n] = SavedMixes[s][n];
+            NewArray[n] = fbInfo->savedMixes[s][n];
          }
-         if(SavedMixes[s]!=NULL)
-            Dispose(&gcheap, SavedMixes[s]);
-         SavedMixes[s] = NewArray;
+         if(fbInfo->savedMixes[s]!=NULL)
+            Dispose(&cacheMixoccHeap, fbInfo->savedMixes[s]);
+         fbInfo->savedMixes[s] = NewArray;
       }
-      SavedMixes[s][indx].mp = mp;
-      SavedMixes[s][indx].occ = 0;
-      SavedMixes[s][indx].scaledOcc = 0;
+      fbInfo->savedMixes[s][indx].mp = mp;
+      fbInfo->savedMixes[s][indx].occ = 0;
+      fbInfo->savedMixes[s][indx].scaledOcc = 0;
    }
-   SavedMixes[s][pMix->indx].occ += Lr;
-   SavedMixes[s][pMix->indx].scaledOcc += Lr*meescale;
+   fbInfo->savedMixes[s][pMix->indx].occ += Lr;
+   fbInfo->savedMixes[s][pMix->indx].scaledOcc += Lr*meescale;
 
 }
 
-void DoAllMixUpdates(int t){
+static void DoAllMixUpdates(FBLatInfo *fbInfo, int t){
    int s,m,k,vSize;
    MixPDF *mp;
    float Lr, unscaledLr, LrWithSign;
@@ -1080,14 +1143,14 @@ void DoAllMixUpdates(int t){
       vSize = fbInfo->hset->swidth[s];
       al_otvs = fbInfo->al_ot.fv[s];
     
-      for(m=0;m<nPDFs[s];m++){
-         unscaledLr = SavedMixes[s][m].occ;  /*differs in MPE case from Lr*/
-         LrWithSign = SavedMixes[s][m].scaledOcc; 
+      for(m=0;m<fbInfo->nPDFs[s];m++){
+         unscaledLr = fbInfo->savedMixes[s][m].occ;  /*differs in MPE case from Lr*/
+         LrWithSign = fbInfo->savedMixes[s][m].scaledOcc; 
 
          if(LrWithSign>0.0) local_accindx = fbInfo->num_index; else local_accindx = fbInfo->den_index;
          Lr = fabs(LrWithSign);
 
-         mp = SavedMixes[s][m].mp;
+         mp = fbInfo->savedMixes[s][m].mp;
          steSumLr += unscaledLr; /*just a check.*/
          mean = mp->mean; 
          variance = mp->cov.var;
@@ -1110,7 +1173,7 @@ void DoAllMixUpdates(int t){
 
 
             ma = ((MuAcc *) GetHook(mean))+local_accindx; mu_jm = ma->mu;
-            if(DoingFourthAcc) mammi = ((MuAcc *) GetHook(mean))+add_index;
+            if(fbInfo->doFourthAcc) mammi = ((MuAcc *) GetHook(mean))+fbInfo->fourthIndex;
 
             if (fbInfo->uFlags&UPVARS){ /* This code is longer than it has to be, to reduce if-statements within loops. */
                switch(mp->ckind){
@@ -1124,8 +1187,8 @@ void DoAllMixUpdates(int t){
                      mu_jm[k] += zmeanlr;
                      va->cov.var[k] += zmean*zmeanlr; 
                   }
-                  if(DoingFourthAcc){   
-                     vammi = ((VaAcc *) GetHook(variance))+add_index;
+                  if(fbInfo->doFourthAcc){   
+                     vammi = ((VaAcc *) GetHook(variance))+fbInfo->fourthIndex;
                      mammi->occ += unscaledLr;
                      vammi->occ += unscaledLr;
                      for (k=1;k<=vSize;k++) {
@@ -1148,8 +1211,8 @@ void DoAllMixUpdates(int t){
                         va->cov.inv[j][k] += zmeanj*zmeanlr; 
                      }
                   } 
-                  if(DoingFourthAcc){   
-                     vammi = ((VaAcc *) GetHook(variance))+add_index; 
+                  if(fbInfo->doFourthAcc){   
+                     vammi = ((VaAcc *) GetHook(variance))+fbInfo->fourthIndex; 
                      vammi->occ += unscaledLr; 
                      mammi->occ += unscaledLr;
                      for (k=1;k<=vSize;k++) {
@@ -1171,7 +1234,7 @@ void DoAllMixUpdates(int t){
                   zmean=up_otvs[k]-mean[k]; zmeanlr=zmean*Lr;
                   mu_jm[k] += zmeanlr;
                }
-               if(DoingFourthAcc){   
+               if(fbInfo->doFourthAcc){   
                   mammi->occ += unscaledLr;
                   for (k=1;k<=vSize;k++) {
                      zmean=up_otvs[k]-mean[k]; zmeanlr=zmean*unscaledLr;
@@ -1184,12 +1247,12 @@ void DoAllMixUpdates(int t){
       if(steSumLr > 1.01 || steSumLr < 0.99) HError(-1, "Wrong steSumLr: %f, t=%d, s=%d",steSumLr, t, s);
    }
    for(s=1;s<=fbInfo->S;s++) /*Reset.*/
-      nPDFs[s] = 0;
+      fbInfo->nPDFs[s] = 0;
 }
 
 
 /* UpMixParms: update mu/va accs of given hmm  */
-static double UpMixParms(int q, HLink hmm, int t, DVector aqt, 
+static double UpMixParms(FBLatInfo *fbInfo, int q, HLink hmm, int t, DVector aqt, 
 			 DVector aqt1, DVector gqt)
 {
    Acoustic *ac = fbInfo->aInfo->ac+q;
@@ -1257,7 +1320,7 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
          }
        
          wa = ((WtAcc*)ste->hook) + local_accindx;
-         if(DoingFourthAcc) wammi = ((WtAcc*)ste->hook) + add_index;   
+         if(fbInfo->doFourthAcc) wammi = ((WtAcc*)ste->hook) + fbInfo->fourthIndex;   
          steSumLr = 0.0;      /*  zero stream occupation count */
        
        
@@ -1287,9 +1350,9 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
                if (!mmix || (fbInfo->hsKind==DISCRETEHS)){       /*    Don't need the MOutP for 1-mix systems. */
                   x = aqt[j]+gqt[j]-outprob[j][0][0]/*-pr*/;   
                   pMix = (PreComp *)mp->hook;
-                  if(pMix->time != t+StartTime){ /* set the indx to -1, this relates to caching of the mixture occupation
+                  if(pMix->time != t+fbInfo->startTime){ /* set the indx to -1, this relates to caching of the mixture occupation
                                                     probability on each time frame. */
-                     pMix->time = t+StartTime; 
+                     pMix->time = t+fbInfo->startTime; 
 #ifdef MIX_UPDATE_SHARING
                      pMix->indx = -1;
 #endif
@@ -1308,9 +1371,9 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
 		     else
 		        prob = outprob[j][s][mx];
 		     pMix = (PreComp *)mp->hook;
-		     if(pMix->time != t+StartTime){ /* set the indx to -1, this relates to caching of the mixture occupation
+		     if(pMix->time != t+fbInfo->startTime){ /* set the indx to -1, this relates to caching of the mixture occupation
 						       probability on each time frame. */
-		        pMix->time = t+StartTime; 
+		        pMix->time = t+fbInfo->startTime; 
 #ifdef MIX_UPDATE_SHARING
 			pMix->indx = -1;
 #endif
@@ -1339,13 +1402,13 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
 	     
                   steSumLr += Lr;
 	     
-                  DoMixUpdate(mp, s, Lr, mee_acc_scale, t); /* This now does not actually update the mixture, but just notes down
+                  DoMixUpdate(fbInfo, mp, s, Lr, mee_acc_scale, t); /* This now does not actually update the mixture, but just notes down
                                                                the probability for later updating with "DoAllMixUpdates", which is called
                                                                once every time frame. */
                   /* ------------------ update mixture weight counts ----------------- */
                   if (fbInfo->uFlags&UPMIXES) {
                      wa->c[m] += Lr * abs_mee_acc_scale;
-                     if(DoingFourthAcc) wammi->c[m] += Lr;
+                     if(fbInfo->doFourthAcc) wammi->c[m] += Lr;
                   }
                } 
                /*   printf("q=%d, N=%d,j=%d, M=%d, m=%d, x=%f, prob=%f,stocc=%f\n", q,N,j,M,m,x,prob,aqt[j]+gqt[j]-outprob[j][0][0]); */
@@ -1354,8 +1417,8 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
    
          wa = ((WtAcc*)ste->hook) + local_accindx;
          wa->occ += steSumLr * abs_mee_acc_scale;
-         if(DoingFourthAcc){   /* do 4th acc if MPE with MMI prior */            
-            wammi = ((WtAcc*)ste->hook) + add_index;
+         if(fbInfo->doFourthAcc){   /* do 4th acc if MPE with MMI prior */            
+            wammi = ((WtAcc*)ste->hook) + fbInfo->fourthIndex;
             wammi->occ += steSumLr;
          }
       }
@@ -1368,7 +1431,7 @@ static double UpMixParms(int q, HLink hmm, int t, DVector aqt,
 /* -------------------- Top Level of F-B Updating ---------------- */
 
 /* CheckData: check data file consistent with HMM definition */
-static void CheckData(char *fn, BufferInfo *info) 
+static void CheckData(FBLatInfo *fbInfo, char *fn, BufferInfo *info) 
 {
    if (info->tgtVecSize!=fbInfo->hset->vecSize)
       HError(2350,"CheckData: Vector size in %s[%d] is incompatible with hset [%d]",
@@ -1383,19 +1446,19 @@ static void CheckData(char *fn, BufferInfo *info)
 
 
 /* StepForward: Step from 1 to T calc'ing Alpha columns and updating parms */
-static void StepForward()
+static void StepForward(FBLatInfo *fbInfo)
 {
    int q,t,negs;
    DVector aqt,aqt1,bqt,bqt1,tmp;
    double occ, total_occ;
    HLink hmm, up_hmm;
    ResetObsCache();
-   ZeroAlpha(1, fbInfo->Q); /*Zero the alphat column,*/
+   ZeroAlpha(fbInfo, 1, fbInfo->Q); /*Zero the alphat column,*/
    for(q=1;q<=fbInfo->Q;q++){ /*And switch: now the alphat1 column is zero.*/
       Acoustic *ac = fbInfo->aInfo->ac + q;
       tmp=ac->alphat;ac->alphat=ac->alphat1;ac->alphat1=tmp;
    }
-   ZeroAlpha(1, fbInfo->Q); /*Now the alphat column is zero too.*/
+   ZeroAlpha(fbInfo, 1, fbInfo->Q); /*Now the alphat column is zero too.*/
   
    for (q=1;q<=fbInfo->Q;q++){  /* inc access counters */
       up_hmm = fbInfo->aInfo->ac[q].hmm;
@@ -1412,7 +1475,7 @@ static void StepForward()
 
       if (fbInfo->hsKind == TIEDHS)  PrecomputeTMix(fbInfo->hset,&fbInfo->al_ot,minFrwdP,0);
 
-      StepAlpha(t); /* Calculate this time's Alpha column. */
+      StepAlpha(fbInfo, t); /* Calculate this time's Alpha column. */
 
       /* Now accumulate statistics. */
       total_occ=LZERO;
@@ -1421,7 +1484,7 @@ static void StepForward()
          int tLo = ac->t_start,
             tHi = ac->t_end;
          if(t==tLo && tHi==tLo-1 && fbInfo->uFlags&UPTRANS){ /*In the ExactMatch case, where we have a skip transition.*/
-            UpSkipTranParms(q, t);
+            UpSkipTranParms(fbInfo, q, t);
          }
          if(t>=tLo&&t<=tHi){
             hmm = ac->hmm; 
@@ -1431,14 +1494,14 @@ static void StepForward()
             aqt1 = (t==1) ? NULL:ac->alphat1; /* alpha from t-1 */
 
 	if (fbInfo->uFlags&(UPMEANS|UPVARS|UPMIXES|UPXFORM|UPMIXES))
-	  if((occ=UpMixParms(q,hmm,t,aqt,aqt1,bqt)) > LSMALL){
+	  if((occ=UpMixParms(fbInfo,q,hmm,t,aqt,aqt1,bqt)) > LSMALL){
 	    total_occ = LAdd(total_occ, occ);
 	  }
 	if (fbInfo->uFlags&UPTRANS)
-	  UpTranParms(t,q);
+	  UpTranParms(fbInfo,t,q);
       }
     }
-    DoAllMixUpdates(t);  /* Iterates over all active mpdf's and actually accumulates stats. */
+    DoAllMixUpdates(fbInfo, t);  /* Iterates over all active mpdf's and actually accumulates stats. */
   
     if(fabs(total_occ) > 0.1)
       HError( 1, "in HFwdBkwdLat.c: Wrong occ: exp(%f)\n",total_occ);
@@ -1453,11 +1516,8 @@ static void StepForward()
 
 
 
-static  char buf1[255];
-static  Boolean eSep;
-
  
-void GetTimes(LArc *larc, int i, int *start, int *end){ /* get start & end times for a lattice arc.  Frame
+void GetTimes(FBLatInfo *fbInfo, LArc *larc, int i, int *start, int *end){ /* get start & end times for a lattice arc.  Frame
                                                            duration is afrom the aInfo structure which is usually initialised
                                                            to 0.1 or by config HARC:FRAMEDUR */
    float s = larc->start->time,e; int j;
@@ -1523,10 +1583,11 @@ int MPE_GetFileLen(Lattice *lat){
 
 void FBLatClearUp(FBLatInfo *fbInfo); 
 
-void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *datafn2, Lattice *MPECorrLat){
+void FBLatFirstPass(FBLatInfo *fbInfo, FileFormat dff, char * datafn, char *datafn2, Lattice *MPECorrLat){
    int q,T2=0; Boolean MPE;
+   char buf1[255];
+   Boolean eSep;
   
-   fbInfo = _fbInfo;
    if(fbInfo->InUse) FBLatClearUp(fbInfo); 
    fbInfo->InUse=TRUE; /* will now initialise */
   
@@ -1553,12 +1614,16 @@ void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *dat
       SetNewConfig("HPARM2");
       fbInfo->up_pbuf=OpenBuffer(&fbInfo->up_dataStack,datafn2,0,dff,FALSE_dup,FALSE_dup);
       GetBufferInfo(fbInfo->up_pbuf,&fbInfo->up_info);
-      CheckData(datafn2,&fbInfo->up_info);
+      CheckData(fbInfo,datafn2,&fbInfo->up_info);
       /*      SyncBuffers(pbuf,pbuf2); */
       T2 = ObsInBuffer(fbInfo->up_pbuf);
    }else
-      CheckData(datafn,&fbInfo->al_info);
+      CheckData(fbInfo,datafn,&fbInfo->al_info);
    fbInfo->T = ObsInBuffer(fbInfo->al_pbuf);
+   fbInfo->startTime = StartTime; /* reserve T frames of the likelihood cache */
+   StartTime += fbInfo->T;
+   fbInfo->doFourthAcc = DoingFourthAcc; fbInfo->fourthIndex = add_index;
+   UseLikeCache(fbInfo, datafn);
   
    if (fbInfo->twoDataFiles && (fbInfo->T != T2))
       HError(2319,"HERest: Paired training files must be same length for single pass retraining");
@@ -1577,7 +1642,7 @@ void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *dat
    }
   
   
-   SetBetaPlus(); /* Step back through file. */
+   SetBetaPlus(fbInfo); /* Step back through file. */
   
    {
       HArc *a; ArcTrans *at; LogFloat lmprob;
@@ -1776,16 +1841,14 @@ void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *dat
 }
 
 
-void FBLatSecondPass(FBLatInfo *_fbInfo, int num_index, int den_index){
-   fbInfo = _fbInfo;
+void FBLatSecondPass(FBLatInfo *fbInfo, int num_index, int den_index){
    fbInfo->num_index = num_index; fbInfo->den_index = den_index;
 
 
    if(fbInfo->pr == 0) HError(1, "FBLatSecondPass: 1st pass not done!!");
-   StepForward();
+   StepForward(fbInfo);
 
    FBLatClearUp(fbInfo);
-   StartTime += fbInfo->T; /*relates to caching of likelihoods */
 
 }
 
@@ -1812,6 +1875,7 @@ void InitFBLat(void)
          if (GetConfFlt(cParm,nParm,"MINFORPROB",&f))  minFrwdP = f;
          if (GetConfFlt(cParm,nParm,"PROBSCALE",&f))  probScale = f;
          if (GetConfFlt(cParm,nParm,"LANGPROBSCALE",&f))  langProbScale = f;
+         if (GetConfBool(cParm,nParm,"SHAREOUTP",&b)) shareOutP = b;
          if (GetConfFlt(cParm,nParm,"LATPROBSCALE",&f))  latProbScale = f; /* this config also used in HExactMPE.c */
          if (GetConfFlt(cParm,nParm,"PHNINSPEN",&f))  phnInsPen = f; /* this config also used in HExactMPE.c */
          
@@ -1852,6 +1916,9 @@ void InitialiseFBInfo(FBLatInfo *fbInfo,
    CreateHeap(&fbInfo->tempStack,   "fbLatTempStore",       MSTAK, 1, 0.5, 1000,  10000);
    CreateHeap(&fbInfo->al_dataStack,    "fbLatDataStore",     MSTAK, 1, 0.5, 1000,  10000);
    CreateHeap(&fbInfo->miscStack,    "fbLatMiscStore",     MSTAK, 1, 0.5, 1000,  10000);
+   CreateHeap(&fbInfo->likeStack,    "fbLatLikeStore",     MSTAK, 1, 1.0, 100000,  2000000);
+   fbInfo->likeCache = NULL; fbInfo->likeT = 0;
+   fbInfo->likeFn[0] = '\0'; fbInfo->likeXForm = NULL;
    if (fbInfo->twoDataFiles)
       CreateHeap(&fbInfo->up_dataStack,   "fbLatDataStore2",  MSTAK, 1, 0.5, 1000,  10000);
 
@@ -1872,10 +1939,12 @@ void InitialiseFBInfo(FBLatInfo *fbInfo,
    if(!CachingInitialised){ /* Initialise the mix occupation-caching  stack. */
       CachingInitialised = TRUE;
       CreateHeap(&cacheMixoccHeap,    "cacheMixocc C heap",       CHEAP, 1, 0.5, 1000,  10000);
-      for(s=0;s<SMAX;s++){
-         nPDFs[s] = 0; SavedMixesSize[s]=0; SavedMixes[s]=0;
-      }
    }
+   for(s=0;s<SMAX;s++){
+      fbInfo->nPDFs[s] = 0; fbInfo->savedMixesSize[s]=0; fbInfo->savedMixes[s]=NULL;
+   }
+   fbInfo->startTime = 0;
+   fbInfo->doFourthAcc = FALSE; fbInfo->fourthIndex = add_index;
 }
 
 
@@ -41,6 +41,9 @@
    each mixture component.
 */   
 
+struct _MixOcc;   /* per-context mixture occupancy cache, private to HFBLat */
+struct _LikeEnt;  /* per-utterance output probability cache, private to HFBLat */
+
 typedef struct {
   /* protected [readonly] : */
   int T;
@@ -88,6 +91,23 @@ typedef struct {
   Boolean InUse; /* FALSE if stacks are cleared and lattices empty. */
   AdaptXForm *inXForm;/* current input transform (if any) */
   AdaptXForm *paXForm;/* current parent transform (if any) */
+
+  /* Per-context working state, so that several FBLatInfo's can be 
+     used in turn (or by separate workers) without sharing statics: */
+  int startTime;        /* offset of this utterance in the likelihood cache */
+  Boolean doFourthAcc;  /* storing MMI prior stats for MPE, see SetDoingFourthAcc */
+  int fourthIndex;      /* accumulator index used when doFourthAcc */
+  int nPDFs[SMAX];      /* number of mixtures cached at the current frame */
+  int savedMixesSize[SMAX];
+  struct _MixOcc *savedMixes[SMAX]; /* [1..S][0..nPDFs[s]-1] */
+
+  /* Stream output probabilities of the current utterance, kept between
+     the numerator and denominator passes (see HFBLAT: SHAREOUTP): */
+  MemHeap likeStack;
+  struct _LikeEnt **likeCache; /* [1..likeT] states scored at each frame */
+  int likeT;
+  char likeFn[MAXFNAMELEN];    /* data file the cache belongs to */
+  AdaptXForm *likeXForm;       /* input xform it was computed with */
   /* ... */
 } FBLatInfo;
 
@@ -121,7 +141,7 @@ void FBLatSecondPass(FBLatInfo *fbInfo,
 
 /*For use in HExactLat.c: */
 int GetNoContextPhone(LabId phone, int *nStates_quinphone, int *state_quinphone, HArc *a, int *frame_end); 
-void GetTimes(LArc *larc, int i, int *start, int *end);   /*gets times as ints. */
+void GetTimes(FBLatInfo *fbInfo, LArc *larc, int i, int *start, int *end);   /*gets times as ints. */
 
 /* EXPORT-> SetDoingFourthAcc: Indicate whether it is currently storing MMI statistics */
 void SetDoingFourthAcc(Boolean DO, int indx);
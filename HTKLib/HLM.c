@@ -485,12 +485,136 @@ static int ReadNGrams(NGramLM *nglm,int n,int count, Boolean bin)
    return(total);
 }
 
+/* ReadImageBlock: read n items of given size from the image */
+static void ReadImageBlock(void *buf, size_t size, size_t n)
+{
+   if (n>0 && fread(buf,size,n,source.f)!=n)
+      HError(8150,"ReadImageBlock: Unexpected EOF in LM image %s",source.name);
+   source.chcount += size*n;
+}
+
+#define IMAGE_CHUNK 4096
+
+/* ReadImageNGrams: read the n-grams of a memory image LM */
+static void ReadImageNGrams(NGramLM *nglm)
+{
+   LMImageHdr hdr;
+   LMImageCtx *ctx;
+   LMImageProb *prob;
+   NEntry **ctxTab[NSIZE],*ne;
+   int *nfeTab[NSIZE];
+   lmId ndx[NSIZE];
+   SEntry *cse;
+   LabId wdid;
+   MemHeap tmpHeap;
+   char *voc,*wd;
+   int i,j,k,n,l,p,np,left;
+
+   ReadImageBlock(&hdr,sizeof(LMImageHdr),1);
+   if (hdr.magic!=LMIMAGE_MAGIC || hdr.version!=LMIMAGE_VERSION)
+      HError(8150,"ReadImageNGrams: LM image %s has wrong byte order or version",
+             source.name);
+   if (hdr.nSize>NSIZE || hdr.vocSize>MAX_LMID)
+      HError(8150,"ReadImageNGrams: %d-gram LM image with %d words too large",
+             hdr.nSize,hdr.vocSize);
+   if (hdr.nSize!=nglm->nsize || hdr.vocSize!=nglm->vocSize)
+      HError(8150,"ReadImageNGrams: LM image header disagrees with counts");
+   for (l=1; l<=nglm->nsize; l++)
+      if (hdr.ngram[l]!=nglm->counts[l])
+         HError(8150,"ReadImageNGrams: %dGram count disagrees with image",l);
+
+   /* vocabulary in word index order */
+   CreateHeap(&tmpHeap,"LM image",MSTAK,1,0.0,8192,65536);
+   voc = (char *) New(&tmpHeap,hdr.vocBytes);
+   ReadImageBlock(voc,1,hdr.vocBytes);
+   for (wd=voc,i=1; i<=nglm->vocSize; i++,wd+=strlen(wd)+1) {
+      if (wd>=voc+hdr.vocBytes)
+         HError(8150,"ReadImageNGrams: Vocabulary truncated at word %d",i);
+      wdid = GetLabId(wd,TRUE);
+      if (wdid->aux != NULL)
+         HError(8150,"ReadImageNGrams: Duplicate word (%s) in 1-gram list",
+                wdid->name);
+      wdid->aux = (Ptr)(long)i;
+      nglm->wdlist[i] = wdid;
+   }
+
+   /* contexts, hung off their parents in order */
+   for (i=0;i<NSIZE;i++) ndx[i]=0;
+   ctxTab[0] = (NEntry **) New(&tmpHeap,sizeof(NEntry*));
+   nfeTab[0] = (int *) New(&tmpHeap,sizeof(int));
+   ctxTab[0][0] = GetNEntry(nglm,ndx,TRUE);
+   ctxTab[0][0]->nse = hdr.ngram[1];
+   nfeTab[0][0] = (nglm->nsize>1) ? hdr.nctx[1] : 0;
+   ctx = (LMImageCtx *) New(&tmpHeap,IMAGE_CHUNK*sizeof(LMImageCtx));
+   for (l=1; l<nglm->nsize; l++) {
+      ctxTab[l] = (NEntry **) New(&tmpHeap,(hdr.nctx[l]+1)*sizeof(NEntry*));
+      nfeTab[l] = (int *) New(&tmpHeap,(hdr.nctx[l]+1)*sizeof(int));
+      p = 0; left = nfeTab[l-1][0]; np = (l>1) ? hdr.nctx[l-1] : 1;
+      for (j=0; j<hdr.nctx[l]; j+=n) {
+         n = hdr.nctx[l]-j; if (n>IMAGE_CHUNK) n = IMAGE_CHUNK;
+         ReadImageBlock(ctx,sizeof(LMImageCtx),n);
+         for (k=0; k<n; k++) {
+            while (left==0) {
+               if (++p>=np)
+                  HError(8150,"ReadImageNGrams: Too many %dGram contexts",l);
+               left = nfeTab[l-1][p];
+            }
+            if (ctx[k].ndx<1 || ctx[k].ndx>nglm->vocSize)
+               HError(8150,"ReadImageNGrams: Unseen word (%d) in %dGram",
+                      ctx[k].ndx,l);
+            ndx[0] = ctx[k].ndx;
+            for (i=1; i<NSIZE-1; i++) ndx[i] = ctxTab[l-1][p]->word[i-1];
+            ne = GetNEntry(nglm,ndx,TRUE);
+            ne->bowt = ctx[k].bowt;
+            ne->nse = ctx[k].nse;
+            ctxTab[l][j+k] = ne;
+            nfeTab[l][j+k] = (l<nglm->nsize-1) ? ctx[k].nfe : 0;
+            left--;
+         }
+      }
+   }
+
+   /* n-grams, each level in the order of its contexts */
+   prob = (LMImageProb *) New(&tmpHeap,IMAGE_CHUNK*sizeof(LMImageProb));
+   for (l=1; l<=nglm->nsize; l++) {
+      cse = (SEntry *) New(nglm->heap,hdr.ngram[l]*sizeof(SEntry));
+      np = (l>1) ? hdr.nctx[l-1] : 1;
+      p = 0; ne = ctxTab[l-1][0]; left = ne->nse;
+      ne->se = (left>0) ? cse : NULL;
+      for (j=0; j<hdr.ngram[l]; j+=n) {
+         n = hdr.ngram[l]-j; if (n>IMAGE_CHUNK) n = IMAGE_CHUNK;
+         ReadImageBlock(prob,sizeof(LMImageProb),n);
+         for (k=0; k<n; k++,cse++) {
+            while (left==0) {
+               if (++p>=np)
+                  HError(8150,"ReadImageNGrams: Too many %dGrams",l);
+               ne = ctxTab[l-1][p]; left = ne->nse;
+               ne->se = (left>0) ? cse : NULL;
+            }
+            if (prob[k].ndx<1 || prob[k].ndx>nglm->vocSize)
+               HError(8150,"ReadImageNGrams: Unseen word (%d) in %dGram",
+                      prob[k].ndx,l);
+            cse->word = prob[k].ndx;
+            cse->prob = prob[k].prob;
+            if (l==1) nglm->unigrams[cse->word] = cse->prob;
+            left--;
+         }
+      }
+      for (p++; left==0 && p<np; p++) {
+         left = ctxTab[l-1][p]->nse; ctxTab[l-1][p]->se = NULL;
+      }
+      if (left!=0)
+         HError(8150,"ReadImageNGrams: Too few %dGrams",l);
+   }
+   DeleteHeap(&tmpHeap);
+}
+
 /* ReadBoNGram: read and store WSJ/DP format ngram */
 static void ReadBoNGram(LModel *lm,char *fn)
 {
    NGramLM *nglm;
    int i,j,k,counts[NSIZE+1];
-   Boolean ngBin[NSIZE+1];
+   Boolean ngBin[NSIZE+1],isImage=FALSE;
    char buf[MAXSTRLEN+1],syc[64];
    char ngFmtCh;
 
@@ -516,21 +640,29 @@ static void ReadBoNGram(LModel *lm,char *fn)
       case '~':
          ngBin[j] = TRUE;
          break;
+      case '@':
+         ngBin[j] = isImage = TRUE;
+         break;
       default:
          HError (9999, "ReadARPALM: unknown ngram format type '%c'", ngFmtCh);
       }
       counts[j]=k;
    }
 
-   if (ngBin[1])
+   if (ngBin[1] && !isImage)
       HError (8113, "ReadARPALM: unigram must be stored as text");
 
    nglm=CreateBoNGram(lm,counts[1],counts);
-   for (i=1;i<=nglm->nsize;i++) {
-      sprintf(syc,"\\%d-grams:",i);
-      SyncStr(buf,syc);
-      ReadNGrams(nglm,i,nglm->counts[i], ngBin[i]);
+   if (isImage) {
+      SyncStr(buf,"\\image\\");
+      ReadImageNGrams(nglm);
    }
+   else
+      for (i=1;i<=nglm->nsize;i++) {
+         sprintf(syc,"\\%d-grams:",i);
+         SyncStr(buf,syc);
+         ReadNGrams(nglm,i,nglm->counts[i], ngBin[i]);
+      }
    SyncStr(buf,"\\end\\");
    CloseSource(&source);
 
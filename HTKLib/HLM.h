@@ -76,6 +76,42 @@ typedef struct ngramlm {
    MemHeap *heap;               /* Pointer to heap */
 } NGramLM;
 
+/*
+   Memory image n-gram format.  Following the "\image\" line, the
+   n-gram data is held in native byte order as an LMImageHdr, the
+   NUL-separated vocabulary (padded to 8 bytes), the contexts of each
+   level 1..nSize-1 and then the n-grams of each level 1..nSize.
+   Both contexts and n-grams are ordered so that the children of each
+   context are contiguous and follow the order of their parents.  All
+   values are natural logs.
+*/
+#define LMIMAGE_MAGIC   0x494d4c48  /* "HLMI" in writer's byte order */
+#define LMIMAGE_VERSION 1
+#define LMIMAGE_MAXN    16          /* max n-gram order of an image */
+
+typedef struct {                /* image header */
+   unsigned int magic;          /* LMIMAGE_MAGIC */
+   unsigned int version;        /* LMIMAGE_VERSION */
+   unsigned int nSize;          /* n-gram order */
+   unsigned int vocSize;        /* number of words */
+   unsigned int vocBytes;       /* size of vocabulary block */
+   unsigned int spare;          /* keeps header size a multiple of 8 */
+   unsigned int nctx[LMIMAGE_MAXN];  /* number of contexts of each level */
+   unsigned int ngram[LMIMAGE_MAXN]; /* number of n-grams of each level */
+} LMImageHdr;
+
+typedef struct {                /* image context */
+   unsigned int ndx;            /* word index (1..vocSize) */
+   unsigned int nse;            /* number of n-grams in this context */
+   unsigned int nfe;            /* number of longer contexts */
+   float bowt;                  /* back-off weight */
+} LMImageCtx;
+
+typedef struct {                /* image n-gram */
+   unsigned int ndx;            /* word index (1..vocSize) */
+   float prob;                  /* probability */
+} LMImageProb;
+
 typedef struct matbilm {
    lmCnt numWords;              /* Number of words for language model */
    Matrix bigMat;               /* Actual probs */
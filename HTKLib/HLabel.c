@@ -121,6 +121,14 @@ static MLFEntry *mlfHead = NULL; /* head of linked list of MLFEntry */
 static MLFEntry *mlfTail = NULL; /* tail of linked list of MLFEntry */
 static MemHeap mlfHeap;          /* memory heap for MLF stuff */
 
+#define MLFHASHMIN 1024          /* initial size of MLF pattern hash table */
+
+static MLFEntry **mlfHashTab = NULL; /* fixed and anypath entries by patHash */
+static int      mlfHashSize = 0;     /* size of mlfHashTab, a power of 2 */
+static MLFEntry *genHead = NULL;     /* general pattern entries in MLF order */
+static MLFEntry *genTail = NULL;     /* tail of general pattern entries */
+static MLFEntry *mlfNext = NULL;     /* entry after last one accessed */
+
 typedef struct {
    FILE *file;
    LabId name;
@@ -132,8 +140,12 @@ static OutMLFEntry outMLFSet[MAXMLFS];      /* array of output MLFs */
 
 /* ---------------- Label Name Hashing ----------------- */
 
-#define HASHSIZE 250007                /* size of hash table */
-static NameCell *hashtab[HASHSIZE];  /* the actual table */
+#define NAMETABMIN 4096              /* initial size of name table */
+
+static NameCell **nameTab = NULL;    /* open addressed table of names */
+static unsigned *nameHash = NULL;    /* full hash value of each slot */
+static int nameTabSize = 0;          /* size of nameTab, a power of 2 */
+static int nameTabUsed = 0;          /* number of names in nameTab */
 static MemHeap namecellHeap;         /* heap for name cells */
 static long numAccesses = 0;
 static long numTests = 0;
@@ -145,24 +157,47 @@ static unsigned Hash(char *name)
 
    for (hashval=0; *name != '\0'; name++)
       hashval = *name + 31*hashval;
-   return hashval%HASHSIZE;
+   hashval ^= hashval >> 16;       /* spread into the low bits used */
+   hashval *= 0x45d9f3b;           /* to index nameTab */
+   hashval ^= hashval >> 16;
+   return hashval;
 }
 
 /* NewCell: return a pointer to a new NameCell */
 static NameCell *NewCell(char *name)
 {
-   char *s;
    NameCell *p;
    int len;
 
    len = strlen(name);
-   s = (char *)New(&namecellHeap,len+1);
-   strcpy(s,name);
-   p = (NameCell *) New(&namecellHeap,sizeof(NameCell));
-   p->name = s; p->next = NULL; p->aux = NULL;
+   p = (NameCell *) New(&namecellHeap,sizeof(NameCell)+len+1);
+   p->name = (char *)(p+1);
+   strcpy(p->name,name);
+   p->next = NULL; p->aux = NULL;
    return p;
 }
 
+/* ResizeNameTab: rehash all names into a table of size n */
+static void ResizeNameTab(int n)
+{
+   NameCell **tab;
+   unsigned *hash;
+   int i,j;
+
+   tab = (NameCell **)New(&gcheap,n*sizeof(NameCell *));
+   hash = (unsigned *)New(&gcheap,n*sizeof(unsigned));
+   for (j=0; j<n; j++) tab[j] = NULL;
+   for (i=0; i<nameTabSize; i++)
+      if (nameTab[i] != NULL) {
+         for (j=nameHash[i]&(n-1); tab[j] != NULL; j=(j+1)&(n-1));
+         tab[j] = nameTab[i]; hash[j] = nameHash[i];
+      }
+   if (nameTab != NULL) {
+      Dispose(&gcheap,nameTab); Dispose(&gcheap,nameHash);
+   }
+   nameTab = tab; nameHash = hash; nameTabSize = n;
+}
+
 /* EXPORT->InitLabel: initialise module */
 void InitLabel(void)
 {
@@ -173,8 +208,7 @@ void InitLabel(void)
 
    Register(hlabel_version,hlabel_vc_id);
    CreateHeap(&namecellHeap,"namecellHeap",MSTAK,1,0.5,5000,20000);
-   for (i=0;i<HASHSIZE;i++)
-      hashtab[i] = NULL;
+   ResizeNameTab(NAMETABMIN);
    CreateHeap(&mlfHeap,"mlfHeap",MSTAK,1,0.5,10000,50000);
    numParm = GetConfig("HLABEL", TRUE, cParm, MAXGLOBS);
    if (numParm>0){
@@ -194,28 +228,23 @@ void InitLabel(void)
 /* EXPORT->GetLabId: return id of given name */
 LabId GetLabId(char *name, Boolean insert)
 {
-   int h;
+   unsigned h;
+   int i;
    NameCell *p;
 
    ++numAccesses; ++numTests;
    if ((trace&T_HASH) && numAccesses%100 == 0) 
       PrintNameTabStats();
-   h = Hash(name); p = hashtab[h];
-   if (p==NULL) {  /* special case - this slot empty */
-      if (insert)
-         p=hashtab[h]=NewCell(name);
-      return p;
-   }
-   do{             /* general case - look for name */
-      if (strcmp(name,p->name) == 0)
+   h = Hash(name);
+   for (i=h&(nameTabSize-1); (p=nameTab[i]) != NULL; i=(i+1)&(nameTabSize-1)) {
+      if (nameHash[i] == h && strcmp(name,p->name) == 0)
          return p; /* found it */
       ++numTests;
-      p = p->next;
-   } while (p != NULL);
+   }
    if (insert){    /* name not stored */
-      p = NewCell(name);
-      p->next = hashtab[h];
-      hashtab[h] = p; 
+      p = nameTab[i] = NewCell(name); nameHash[i] = h;
+      if (2*(++nameTabUsed) > nameTabSize)
+         ResizeNameTab(2*nameTabSize);
    }
    return p;
 }
@@ -226,6 +255,7 @@ void PrintNameTabStats(void)
    printf("Name Table Statistics:\n");
    printf("Total Accesses: %ld\n", numAccesses);
    printf("Ave Search Len: %f\n",(float)numTests/(float)numAccesses); 
+   printf("Names Stored: %d in %d slots\n",nameTabUsed,nameTabSize);
    PrintHeapStats(&namecellHeap);
    printf("\n"); fflush(stdout);
 }
@@ -280,9 +310,8 @@ LabList* CreateLabelList(MemHeap *x, int maxAuxLab)
    LLink st,en;
    LabList *ll;
    
-   ll = (LabList *)New(x,sizeof(LabList));
-   st = (LLink)New(x,sizeof(Label));
-   en = (LLink)New(x,sizeof(Label));
+   st = (LLink)New(x,2*sizeof(Label)+sizeof(LabList));
+   en = st+1; ll = (LabList *)(st+2);
    st->labid = en->labid = NULL; 
    st->pred = NULL; st->succ = en;
    en->succ = NULL; en->pred = st;
@@ -339,14 +368,14 @@ LLink CreateLabel(MemHeap *x, int maxAux)
    LabId *id;
    float *s;
    
-   p = (LLink)New(x,sizeof(Label));
+   p = (LLink)New(x,sizeof(Label)+maxAux*(sizeof(LabId)+sizeof(float)));
    p->labid = NULL; p->score = 0.0; 
    p->auxLab = NULL; p->auxScore = NULL;
    p->start = p->end = 0;
    p->succ = p->pred = NULL;
-   if (maxAux > 0) {
-      id = (LabId *)New(x,sizeof(LabId)*maxAux);
-      s = (float *)New(x,sizeof(float)*maxAux);
+   if (maxAux > 0) {          /* aux arrays follow the label */
+      id = (LabId *)(p+1);
+      s = (float *)(id+maxAux);
       p->auxLab = id - 1; p->auxScore = s - 1;
       for (i=1; i<=maxAux; i++){
          p->auxLab[i] = NULL;
@@ -727,8 +756,8 @@ static void ExtendAux(MemHeap *x, LabList *ll, int n)
    
    oldn = ll->maxAuxLab; ll->maxAuxLab = n;
    for (p=ll->head->succ; p->succ!=NULL; p=p->succ){
-      id = (LabId *)New(x,sizeof(LabId)*n) - 1; 
-      s = (float *)New(x,sizeof(float)*n) - 1;
+      id = (LabId *)New(x,n*(sizeof(LabId)+sizeof(float)));
+      s = (float *)(id+n) - 1; id--;
       for (i=1; i<=oldn; i++){
          id[i] = p->auxLab[i];
          s[i] = p->auxScore[i];
@@ -1037,15 +1066,48 @@ void LTriStrip(Boolean enab)
 
 /* ------------------ Master Label File Handling -------------------- */
 
+/* ResizeMLFHash: rehash the hashed MLF entries into a table of size n */
+static void ResizeMLFHash(int n)
+{
+   MLFEntry **tab,*e,*next;
+   int i,h;
+
+   tab = (MLFEntry **)New(&gcheap,n*sizeof(MLFEntry *));
+   for (i=0; i<n; i++) tab[i] = NULL;
+   for (i=0; i<mlfHashSize; i++)
+      for (e=mlfHashTab[i]; e!=NULL; e=next) {
+         next = e->hnext; h = e->patHash&(n-1);
+         e->hnext = tab[h]; tab[h] = e;
+      }
+   if (mlfHashTab != NULL) Dispose(&gcheap,mlfHashTab);
+   mlfHashTab = tab; mlfHashSize = n;
+   if (trace&T_MHASH)
+      printf("HLabel: MLF hash table resized to %d for %d entries\n",n,mlfUsed);
+}
+
 /* StoreMLFEntry: store the given MLF entry */
 static void StoreMLFEntry(MLFEntry *e)
 {
-   e->next = NULL;
+   int h;
+
+   e->next = e->hnext = NULL; e->num = mlfUsed;
    if (mlfHead == NULL)
       mlfHead = mlfTail = e;
    else {
       mlfTail->next = e; mlfTail = e;
    }
+   if (e->patType == PAT_GENERAL) {
+      if (genHead == NULL)
+         genHead = genTail = e;
+      else {
+         genTail->hnext = e; genTail = e;
+      }
+   } else {
+      if (mlfUsed >= mlfHashSize)
+         ResizeMLFHash(mlfHashSize==0 ? MLFHASHMIN : 2*mlfHashSize);
+      h = e->patHash&(mlfHashSize-1);
+      e->hnext = mlfHashTab[h]; mlfHashTab[h] = e;
+   }
    ++mlfUsed;
 }
 
@@ -1277,6 +1339,89 @@ static void SplitPath(char *path, char *name, char *subdir, char *tryspec)
    strcpy(tryspec,buf1);
 }
 
+/* MatchMLFEntry: return true if pattern of e matches fname */
+static Boolean MatchMLFEntry(MLFEntry *e, char *fname, char *fnStart,
+                             unsigned fixedHash, unsigned anypathHash)
+{
+   switch (e->patType){
+   case PAT_GENERAL:
+      if (trace&T_MAT) 
+         printf("HLabel:  general match against %s\n",e->pattern);
+      return DoMatch(fname,e->pattern);
+   case PAT_ANYPATH:
+      if (trace&T_MAT) 
+         printf("HLabel:  anypath match against %s[%d]\n",e->pattern,e->patHash);
+      return e->patHash == anypathHash && strcmp(e->pattern,fnStart) == 0;
+   case PAT_FIXED:
+      if (trace&T_MAT) 
+         printf("HLabel:  fixed match against %s[%d]\n",e->pattern,e->patHash);
+      return e->patHash == fixedHash && strcmp(e->pattern,fname) == 0;
+   }
+   return FALSE;
+}
+
+/* NextMLFMatch: return the first entry after entry number last in the
+                 MLF table whose pattern matches fname, or NULL.  Only
+                 the hash chains for fname and the general patterns
+                 need to be examined */
+static MLFEntry *NextMLFMatch(char *fname, char *fnStart, unsigned fixedHash,
+                              unsigned anypathHash, int last)
+{
+   MLFEntry *e,*best = NULL;
+   unsigned h[2];
+   int i;
+
+   if (mlfHashSize > 0) {
+      h[0] = fixedHash&(mlfHashSize-1); h[1] = anypathHash&(mlfHashSize-1);
+      for (i=0; i<2; i++) {
+         if (i==1 && h[1]==h[0]) break;
+         for (e=mlfHashTab[h[i]]; e != NULL; e = e->hnext)
+            if (e->num > last && (best==NULL || e->num < best->num) &&
+                MatchMLFEntry(e,fname,fnStart,fixedHash,anypathHash))
+               best = e;
+      }
+   }
+   for (e=genHead; e != NULL && (best==NULL || e->num < best->num); e = e->hnext)
+      if (e->num > last && MatchMLFEntry(e,fname,fnStart,fixedHash,anypathHash))
+         return e;
+   return best;
+}
+
+/* OpenMLFEntry: open the label file defined by MLF entry e for fname,
+                 returns NULL if it cannot be found */
+static FILE *OpenMLFEntry(MLFEntry *e, char *fname, Boolean *isMLF)
+{
+   FILE *f;
+   char path[1024],name[256],tryspec[1024];
+
+   if (e->type == MLF_IMMEDIATE) {
+      f = mlfile[e->def.immed.fidx];
+      if (fseek(f,e->def.immed.offset,SEEK_SET) != 0)
+         HError(6521,"OpenLabFile: cant seek to label def in MLF");
+      *isMLF=TRUE;
+      if (trace&T_MLF)
+         printf("HLabel: Loading Immediate Def [Pattern %s]\n",
+                e->pattern);
+      mlfNext=e->next;
+      return f;
+   }
+   name[0] = '\0'; strcpy(path,fname);
+   SplitPath(path,name,e->def.subdir,tryspec);
+   if (trace&T_SUBD)
+      printf("HLabel: trying %s\n",tryspec);
+   f = fopen(tryspec,"rb");
+   while (f==NULL && e->type == MLF_FULL && strlen(path)>0) {
+      SplitPath(path,name,e->def.subdir,tryspec);
+      if (trace&T_SUBD)
+         printf("HLabel: trying %s\n",tryspec);
+      f = fopen(tryspec,"rb");
+   }
+   if (f != NULL && trace&T_MLF)
+      printf("HLabel: Loading Label File %s [Pattern %s]\n",
+             tryspec,e->pattern);
+   return f;
+}
+
 /* OpenLabFile: opens a file corresponding to given fname, the file
                 returned may be a real file or simply the MLF seek'ed
                 to the start of an immediate file definition, isMLF
@@ -1285,12 +1430,9 @@ static FILE * OpenLabFile(char *fname, Boolean *isMLF)
 {
    FILE *f;
    MLFEntry *e;
-   char path[1024],name[256],tryspec[1024];
-   Boolean isMatch = FALSE;
    unsigned fixedHash;     /* hash value for PAT_FIXED */
    unsigned anypathHash;   /* hash value for PAT_ANYPATH */ 
    char *fnStart;          /* start of actual file name */
-   static MLFEntry *q=NULL;/* entry after last one accessed - checked first */
    
    *isMLF = FALSE; 
    fixedHash = anypathHash = MLFHash(fname);
@@ -1304,64 +1446,15 @@ static FILE * OpenLabFile(char *fname, Boolean *isMLF)
       printf("HLabel: Searching for label file %s\n",fname);
    if (trace&T_MHASH) 
       printf("HLabel:  anypath hash = %d;  fixed hash = %d\n",anypathHash,fixedHash);
-   for (e=(q==NULL?mlfHead:q); e != NULL; e = (e==NULL?mlfHead:e->next)) {
-      switch (e->patType){
-      case PAT_GENERAL:
-         if (trace&T_MAT) 
-            printf("HLabel:  general match against %s\n",e->pattern);
-         isMatch = DoMatch(fname,e->pattern);
-         break;
-      case PAT_ANYPATH:
-         if (trace&T_MAT) 
-            printf("HLabel:  anypath match against %s[%d]\n",e->pattern,e->patHash);
-         if (e->patHash == anypathHash)
-            isMatch = strcmp(e->pattern,fnStart) == 0;
-         else
-            isMatch = FALSE;
-         break;
-      case PAT_FIXED:
-         if (trace&T_MAT) 
-            printf("HLabel:  fixed match against %s[%d]\n",e->pattern,e->patHash);
-         if (e->patHash == fixedHash)
-            isMatch = strcmp(e->pattern,fname) == 0;
-         else
-            isMatch = FALSE;
-         break;
-      }
-      if ( isMatch ) {
-         if (e->type == MLF_IMMEDIATE) {
-            f = mlfile[e->def.immed.fidx];
-            if (fseek(f,e->def.immed.offset,SEEK_SET) != 0)
-               HError(6521,"OpenLabFile: cant seek to label def in MLF");
-            *isMLF=TRUE;
-            if (trace&T_MLF)
-               printf("HLabel: Loading Immediate Def [Pattern %s]\n",
-                      e->pattern);
-            q=e->next;
-            return f;
-         } else {
-            name[0] = '\0'; strcpy(path,fname);
-            SplitPath(path,name,e->def.subdir,tryspec);
-            if (trace&T_SUBD)
-               printf("HLabel: trying %s\n",tryspec);
-            f = fopen(tryspec,"rb");
-            while (f==NULL && e->type == MLF_FULL && strlen(path)>0) {
-               SplitPath(path,name,e->def.subdir,tryspec);
-               if (trace&T_SUBD)
-                  printf("HLabel: trying %s\n",tryspec);
-               f = fopen(tryspec,"rb");
-            }
-            if (f != NULL) {
-               if (trace&T_MLF)
-                  printf("HLabel: Loading Label File %s [Pattern %s]\n",
-                         tryspec,e->pattern);
-               return f;
-            }
-         }
-      }
-      if (q!=NULL) e=NULL;
-      q = NULL;
-   }
+   /* entry after the last one accessed is checked first */
+   if ((e=mlfNext) != NULL && MatchMLFEntry(e,fname,fnStart,fixedHash,anypathHash))
+      if ((f=OpenMLFEntry(e,fname,isMLF)) != NULL)
+         return f;
+   mlfNext = NULL;
+   for (e=NextMLFMatch(fname,fnStart,fixedHash,anypathHash,-1); e != NULL;
+        e=NextMLFMatch(fname,fnStart,fixedHash,anypathHash,e->num))
+      if ((f=OpenMLFEntry(e,fname,isMLF)) != NULL)
+         return f;
    /* No MLF Match so try direct open */  
    if (trace&T_SUBD)
       printf("HLabel: trying actual file %s\n",fname);
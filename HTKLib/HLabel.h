@@ -117,7 +117,9 @@ typedef struct _MLFEntry{
    unsigned patHash;    /* hash of pattern if not general */
    MLFDefType type;     /* type of this definition */
    MLFDef def;          /* the actual def */
+   int num;             /* position of entry in MLF table */
    struct _MLFEntry *next;    /* next in chain */
+   struct _MLFEntry *hnext;   /* next in hash chain or general list */
 }MLFEntry;
 
 /* ------------------- Label/Name Handling ------------------- */
@@ -457,27 +457,29 @@ Boolean LatTopSort (Lattice *lat, LNode **topOrder)
 /* LatAttachInfo
 
      allocate & attach an Info structre for each node
+     (the structures are allocated as a single block)
 */
 void LatAttachInfo (MemHeap *heap, size_t size, Lattice *lat)
 {
    int i;
    LNode *ln;
+   char *info;
    
-   for (i = 0, ln = lat->lnodes; i < lat->nn; ++i, ++ln)
-      ln->hook = (Ptr) New (heap, size);
+   if (lat->nn <= 0)
+      return;
+   info = (char *) New (heap, lat->nn * size);
+   for (i = 0, ln = lat->lnodes; i < lat->nn; ++i, ++ln, info += size)
+      ln->hook = (Ptr) info;
 }
 
 /* LatDetachInfo
 
-     free Info structre for each node
+     free Info structres attached by LatAttachInfo
 */
 void LatDetachInfo (MemHeap *heap, Lattice *lat)
 {
-   int i;
-   LNode *ln;
-   
-   for (i = 0, ln = lat->lnodes; i < lat->nn; ++i, ++ln)
-      Dispose (heap, ln->hook);
+   if (lat->nn > 0)
+      Dispose (heap, lat->lnodes[0].hook);
 }
 
 
@@ -486,81 +488,110 @@ void LatDetachInfo (MemHeap *heap, Lattice *lat)
      perform forward-backward algorithm on lattice and store scores in
      FBInfo structre
      choice of using sum (LATFB_SUM) or max (LATFB_MAX) of scores
+
+     Both passes run over flat arrays in topological order rather
+     than the node/arc lists: arcs are stored once grouped by start
+     node (for the forward pass) and once grouped by end node (for the
+     backward pass), in the same order as the foll/pred lists so the
+     accumulation order (and hence the result) is unchanged.
 */
 LogDouble LatForwBackw (Lattice *lat, LatFBType type)
 {
-   int i;
+   int i, j, k, nn, na;
    LNode *ln;
    LArc *la;
    LNode **topOrder;
-   LogDouble score;
+   LogDouble score, *fw, *bw;
+   int *rank, *fst, *fend, *bst, *bstart;
+   LogDouble *flike, *blike;
 
    /* We assume that the FBinfo structures are already allocated. */
-   /* init */
-   for (i = 0, ln = lat->lnodes; i < lat->nn; ++i, ++ln) {
-      LNodeFw (ln) = LNodeBw (ln) = LZERO;
-   }
-   LNodeFw (LatStartNode (lat)) = 0.0;
-   LNodeBw (LatEndNode (lat)) = 0.0;
+   nn = lat->nn; na = lat->na;
 
    /* find topological order of nodes */
-   topOrder = (LNode **) New (&gcheap, lat->nn * sizeof(LNode *));
+   topOrder = (LNode **) New (&gstack, nn * sizeof(LNode *));
    if (!LatTopSort (lat, topOrder))
       HError (8622, "LatForwBackw: cannot calculate forw/backw score on Lattice with cycles"); 
-      
-   /* the processing in the forward and backward directions are really
-      almost the same. if the data structures had been done _slightly_
-      nicer this could be done in one loop. The only readable way now 
-      would be defining a couple of macros... */
 
-   /* forward direction */
-   for (i = 0; i < lat->nn; ++i) {
+   /* position of each node in topological order */
+   rank = (int *) New (&gstack, nn * sizeof(int));
+   for (i = 0; i < nn; ++i)
+      rank[topOrder[i] - lat->lnodes] = i;
+
+   /* arcs grouped by rank of start node (forward) and end node (backward) */
+   fst = (int *) New (&gstack, (nn + 1) * sizeof(int));
+   bst = (int *) New (&gstack, (nn + 1) * sizeof(int));
+   fend = (int *) New (&gstack, (na + 1) * sizeof(int));
+   bstart = (int *) New (&gstack, (na + 1) * sizeof(int));
+   flike = (LogDouble *) New (&gstack, (na + 1) * sizeof(LogDouble));
+   blike = (LogDouble *) New (&gstack, (na + 1) * sizeof(LogDouble));
+   fw = (LogDouble *) New (&gstack, nn * sizeof(LogDouble));
+   bw = (LogDouble *) New (&gstack, nn * sizeof(LogDouble));
+
+   for (i = 0, j = k = 0; i < nn; ++i) {
       ln = topOrder[i];
-      for (la = ln->foll; la; la = la->farc) {
+      fst[i] = j;
+      for (la = ln->foll; la; la = la->farc, ++j) {
          assert (la->start == ln);
-         
-         score = LNodeFw (ln) + LArcTotLike (lat, la);
-         switch (type) {
-         case LATFB_SUM:
-            LNodeFw (la->end) = LAdd (LNodeFw (la->end), score);
-            break;
-         case LATFB_MAX:
-            if (score > LNodeFw (la->end))
-               LNodeFw (la->end) = score;
-            break;
-         default:
-            abort ();
-         }
+         fend[j] = rank[la->end - lat->lnodes];
+         flike[j] = LArcTotLike (lat, la);
+      }
+      bst[i] = k;
+      for (la = ln->pred; la; la = la->parc, ++k) {
+         assert (la->end == ln);
+         bstart[k] = rank[la->start - lat->lnodes];
+         blike[k] = LArcTotLike (lat, la);
       }
    }
+   fst[nn] = j; bst[nn] = k;
+   if (j != na || k != na)
+      HError (8622, "LatForwBackw: inconsistent arc lists in lattice"); 
 
-   /* backward direction */
-   for (i = lat->nn - 1; i >= 0; --i) {
-      ln = topOrder[i];
-      for (la = ln->pred; la; la = la->parc) {
-         assert (la->end == ln);
-         
-         score = LNodeBw (ln) + LArcTotLike (lat, la);
-         switch (type) {
-         case LATFB_SUM:
-            LNodeBw (la->start) = LAdd (LNodeBw (la->start), score);
-            break;
-         case LATFB_MAX:
-            if (score > LNodeBw (la->start))
-               LNodeBw (la->start) = score;
-            break;
-         default:
-            abort ();
+   /* init */
+   for (i = 0; i < nn; ++i)
+      fw[i] = bw[i] = LZERO;
+   fw[rank[LatStartNode (lat) - lat->lnodes]] = 0.0;
+   bw[rank[LatEndNode (lat) - lat->lnodes]] = 0.0;
+
+   switch (type) {
+   case LATFB_SUM:
+      for (i = 0; i < nn; ++i)
+         for (j = fst[i]; j < fst[i+1]; ++j)
+            fw[fend[j]] = LAdd (fw[fend[j]], fw[i] + flike[j]);
+      for (i = nn - 1; i >= 0; --i)
+         for (k = bst[i]; k < bst[i+1]; ++k)
+            bw[bstart[k]] = LAdd (bw[bstart[k]], bw[i] + blike[k]);
+      break;
+   case LATFB_MAX:
+      for (i = 0; i < nn; ++i)
+         for (j = fst[i]; j < fst[i+1]; ++j) {
+            score = fw[i] + flike[j];
+            if (score > fw[fend[j]])
+               fw[fend[j]] = score;
          }
-      }
+      for (i = nn - 1; i >= 0; --i)
+         for (k = bst[i]; k < bst[i+1]; ++k) {
+            score = bw[i] + blike[k];
+            if (score > bw[bstart[k]])
+               bw[bstart[k]] = score;
+         }
+      break;
+   default:
+      abort ();
+   }
+
+   /* store results in FBinfo structures */
+   for (i = 0; i < nn; ++i) {
+      LNodeFw (topOrder[i]) = fw[i];
+      LNodeBw (topOrder[i]) = bw[i];
    }
 
    if (trace & T_FB) {
-      printf ("forward prob:  %f\n", LNodeFw (topOrder[lat->nn - 1]));
-      printf ("backward prob: %f\n", LNodeBw (topOrder[0]));
+      printf ("forward prob:  %f\n", fw[nn - 1]);
+      printf ("backward prob: %f\n", bw[0]);
    }
-   score = LNodeBw (topOrder[0]);
-   Dispose (&gcheap, topOrder);
+   score = bw[0];
+   Dispose (&gstack, topOrder);
 
    return score;
 }
@@ -1470,7 +1470,7 @@ static void DLinSolve(DMatrix a, int *perm, double *b)
    }
 }       
 
-/* Inverting a double matrix */
+/* Inverting a double matrix, a singular c gives a zero invc and det */
 double DMatInvert(DMatrix c, DMatrix invc)
 {
    DMatrix a;
@@ -1482,7 +1482,11 @@ double DMatInvert(DMatrix c, DMatrix invc)
    n=NumDRows(c);
    a=CreateDMatrix(&gstack,n,n);
    CopyDMatrix(c,a);           /* Make a copy of c */
-   DLUDecompose(a,perm,&sign);      /* Do LU Decomposition */
+   if (! DLUDecompose(a,perm,&sign)) {  /* Do LU Decomposition */
+      ZeroDMatrix(invc);
+      FreeDMatrix(&gstack,a);
+      return 0;
+   }
    for (j=1; j<=n; j++) {     /* Invert matrix */
       for (i=1; i<=n; i++)
          col[i]=0.0;
@@ -188,6 +188,8 @@ double DMatDet(DMatrix c);
 
 /* EXPORT-> MatInvert: puts inverse of c in invc, returns Det(c) */
   float MatInvert(Matrix c, Matrix invc);
+/* EXPORT-> DMatInvert: as MatInvert, if c is singular invc is zeroed
+   and 0 returned */
   double DMatInvert(DMatrix c, DMatrix invc);
  
 /* DMatCofact: generates the cofactors of row r of doublematrix c */
@@ -104,6 +104,32 @@ static int pde2BlockEnd = 26;          /* size of PDE blocks */
 static LogFloat pdeTh1 = -5.0;         /* threshold for 1/3 PDE */
 static LogFloat pdeTh2 = 0.0;          /* threshold for 2/3 PDE */
 
+/* XFORMC components sharing one transform: the transformed frame is
+   computed once per frame and each component only needs its own
+   transformed mean */
+typedef struct _XFProj {
+   SMatrix xform;             /* shared transform */
+   Vector x;                  /* last frame projected */
+   DVector ax;                /* xform * x */
+   struct _XFProj *next;
+} XFProj;
+
+typedef struct _XFComp {
+   MixPDF *mp;                /* component using a shared transform */
+   Vector mean;               /* mean used to compute amu */
+   DVector amu;               /* xform * mean */
+   XFProj *proj;              /* projection of its transform */
+   struct _XFComp *next;
+} XFComp;
+
+#define XFHASHSIZE 4093
+
+static Boolean cacheXFormC = FALSE;    /* cache shared XFORMC projections */
+static MemHeap xfcHeap;                /* storage for the projection cache */
+static XFComp **xfcTab = NULL;         /* hash of XFComp by component */
+static XFProj *xfProjList = NULL;      /* list of projections */
+static Vector outpBuf = NULL;          /* scratch vector for FOutP/XOutP */
+
 #ifdef PDE_STATS
 static int nGaussTot = 0;
 static int nGaussPDE1 = 0;
@@ -122,6 +148,7 @@ void InitModel(void)
    
    Register(hmodel_version,hmodel_vc_id);
    CreateHeap(&xformStack,"XFormStore",MSTAK, 1, 0.5, 100 ,  1000 );
+   CreateHeap(&xfcHeap,"XFormCCache",MSTAK, 1, 0.5, 1000 ,  100000 );
    strcpy(orphanMacFile,"newMacros");
    InitSymNames();
    nParm = GetConfig("HMODEL", TRUE, cParm, MAXGLOBS);
@@ -152,6 +179,7 @@ void InitModel(void)
       if (GetConfInt(cParm,nParm,"PDE2BLOCKEND",&i)) pde2BlockEnd = i;
       if (GetConfFlt(cParm,nParm,"PDETHRESHOLD1",&d)) pdeTh1 = d;
       if (GetConfFlt(cParm,nParm,"PDETHRESHOLD2",&d)) pdeTh2 = d;
+      if (GetConfBool(cParm,nParm,"CACHEXFORMC",&b)) cacheXFormC = b;
    }
 }
 
@@ -2458,6 +2486,7 @@ static AdaptXForm* GetAdaptXForm(HMMSet *hset, Source *src, Token *tok)
     xform->rtree = NULL;
     xform->nUse = 0;
     xform->xformName = NULL;
+    xform->applyStamp = 0;
     if (!ReadString(src,buf)){
       HRError(7013,"GetAdaptXForm: cannot read Transform Kind");
       return(NULL);
@@ -4063,6 +4092,7 @@ void ResetHMMSet(HMMSet *hset)
    hset->numFiles=0;
    hset->mmfNames=NULL;
    Dispose(hset->hmem, hset->firstElem);
+   ResetXFormCCache();
 }
 
    
@@ -4189,6 +4219,7 @@ void CreateHMMSet(HMMSet *hset, MemHeap *heap, Boolean allowTMods)
 {
    int s;
 
+   ResetXFormCCache();     /* cached components may belong to a freed set */
    /* set default values in hset structure */
    hset->hmem = heap;
    hset->hmmSetId = NULL;
@@ -5357,26 +5388,43 @@ static LogFloat DOutP(Vector x, int vecSize, MixPDF *mp)
    return -0.5*sum;
 }
 
+/* GetOutPBuf: return a scratch vector of at least size n */
+static Vector GetOutPBuf(int n)
+{
+   if (outpBuf == NULL || VectorSize(outpBuf) < n) {
+      if (outpBuf != NULL) FreeVector(&gcheap,outpBuf);
+      outpBuf = CreateVector(&gcheap,n);
+   }
+   return outpBuf;
+}
+
 /* FOutP: Log prob of x in given mixture - Full Covariance Case */
 static LogFloat FOutP(Vector x, int vecSize, MixPDF *mp)
 {
-   float sum;
+   float sum,rsum;
    int i,j;
    Vector xmm;
+   float *row;
    TriMat m = mp->cov.inv;
    
-   xmm = CreateVector(&gstack,vecSize);
+   xmm = GetOutPBuf(vecSize);
    for (i=1;i<=vecSize;i++)
       xmm[i] = x[i] - mp->mean[i];
+   /* off-diagonal terms row by row; rows of a block diagonal
+      inverse start with a run of zeros which is skipped */
    sum = 0.0;
-   for (j=1;j<vecSize;j++)
-      for (i=j+1;i<=vecSize;i++)
-         sum += xmm[i]*xmm[j]*m[i][j];
+   for (i=2;i<=vecSize;i++) {
+      row = m[i];
+      for (j=1; j<i && row[j]==0.0; j++);
+      rsum = 0.0;
+      for (; j<i; j++)
+         rsum += row[j]*xmm[j];
+      sum += rsum*xmm[i];
+   }
    sum *= 2;
    sum += mp->gConst;
    for (i=1;i<=vecSize;i++)
       sum += xmm[i] * xmm[i] * m[i][i];
-   FreeVector(&gstack,xmm);
    return -0.5*sum;
 }
 
@@ -5388,31 +5436,143 @@ static LogFloat COutP(Vector x, int vecSize, MixPDF *mp)
    return 0.0;
 }
 
+/* ProjectVector: set ax = xform * x, skipping leading zeros of each row */
+static void ProjectVector(SMatrix xform, Vector x, int vecSize, DVector ax)
+{
+   int i,j,numrows;
+   float *xrow;
+   double sum;
+
+   numrows=NumRows(xform);
+   for (i=1;i<=numrows;i++) {
+      xrow = xform[i];
+      for (j=1; j<=vecSize && xrow[j]==0.0; j++);
+      sum = 0.0;
+      for (; j<=vecSize; j++)
+         sum += xrow[j]*x[j];
+      ax[i] = sum;
+   }
+}
+
+/* EXPORT->ResetXFormCCache: discard all cached XFORMC projections */
+void ResetXFormCCache(void)
+{
+   ResetHeap(&xfcHeap);
+   xfcTab = NULL; xfProjList = NULL;
+}
+
+/* GetXFProj: return the projection of xform, creating it if needed */
+static XFProj *GetXFProj(SMatrix xform, int vecSize)
+{
+   XFProj *xp;
+
+   for (xp=xfProjList; xp!=NULL; xp=xp->next)
+      if (xp->xform == xform) return xp;
+   xp = (XFProj *)New(&xfcHeap,sizeof(XFProj));
+   xp->xform = xform;
+   xp->x = CreateVector(&xfcHeap,vecSize);
+   xp->ax = CreateDVector(&xfcHeap,NumRows(xform));
+   ZeroVector(xp->x); ZeroDVector(xp->ax);
+   xp->next = xfProjList; xfProjList = xp;
+   return xp;
+}
+
+/* GetXFComp: return the projection cache entry for mp, creating it if
+   needed.  If mp has been given a different transform since the entry
+   was made then its projection and transformed mean are recomputed */
+static XFComp *GetXFComp(MixPDF *mp, int vecSize)
+{
+   XFComp *xc;
+   int h;
+
+   if (xfcTab == NULL) {
+      xfcTab = (XFComp **)New(&xfcHeap,XFHASHSIZE*sizeof(XFComp *));
+      for (h=0; h<XFHASHSIZE; h++) xfcTab[h] = NULL;
+   }
+   h = (int)(((unsigned long)mp) % XFHASHSIZE);
+   for (xc=xfcTab[h]; xc!=NULL; xc=xc->next)
+      if (xc->mp == mp) break;
+   if (xc != NULL && xc->proj->xform == mp->cov.xform)
+      return xc;
+   if (xc == NULL) {
+      xc = (XFComp *)New(&xfcHeap,sizeof(XFComp));
+      xc->mp = mp;
+      xc->mean = CreateVector(&xfcHeap,vecSize);
+      xc->amu = NULL;
+      xc->next = xfcTab[h]; xfcTab[h] = xc;
+   }
+   xc->proj = GetXFProj(mp->cov.xform,vecSize);
+   CopyVector(mp->mean,xc->mean);
+   if (xc->amu == NULL || DVectorSize(xc->amu) != NumRows(mp->cov.xform))
+      xc->amu = CreateDVector(&xfcHeap,NumRows(mp->cov.xform));
+   ProjectVector(mp->cov.xform,xc->mean,vecSize,xc->amu);
+   return xc;
+}
+
+/* SameVector: true if the first n elements of v1 and v2 are equal */
+static Boolean SameVector(Vector v1, Vector v2, int n)
+{
+   int i;
+
+   for (i=1;i<=n;i++)
+      if (v1[i] != v2[i]) return FALSE;
+   return TRUE;
+}
+
+/* CXOutP: XOutP for a shared transform using the projection cache */
+static LogFloat CXOutP(Vector x, int vecSize, MixPDF *mp)
+{
+   XFComp *xc;
+   XFProj *xp;
+   int i,numrows;
+   double sum,d;
+
+   xc = GetXFComp(mp,vecSize);
+   if (!SameVector(mp->mean,xc->mean,vecSize)) {  /* mean has been updated */
+      CopyVector(mp->mean,xc->mean);
+      ProjectVector(mp->cov.xform,xc->mean,vecSize,xc->amu);
+   }
+   xp = xc->proj;
+   if (!SameVector(x,xp->x,vecSize)) {            /* new frame */
+      CopyVector(x,xp->x);
+      ProjectVector(xp->xform,xp->x,vecSize,xp->ax);
+   }
+   numrows = NumRows(mp->cov.xform);
+   sum = 0.0;
+   for (i=1;i<=numrows;i++) {
+      d = xp->ax[i] - xc->amu[i];
+      sum += d*d;
+   }
+   sum += mp->gConst;
+   return -0.5*sum;
+}
+
 /* XOutP: Log prob of x in given mixture - XForm Case */
 static LogFloat XOutP(Vector x, int vecSize, MixPDF *mp)
 {
-   Vector xmm,trans_xmm;
+   Vector xmm;
    int i,j;
    int numrows;
    Vector xrow;
    LogFloat sum;
+   float tx;
 
-   xmm = CreateVector(&gstack,vecSize);
-   trans_xmm = CreateVector(&gstack,vecSize);
+   if (cacheXFormC && GetUse(mp->cov.xform) > 1)
+      return CXOutP(x,vecSize,mp);
+   xmm = GetOutPBuf(vecSize);
    for (j=1;j<=vecSize;j++)
       xmm[j] = x[j] - mp->mean[j];
    numrows=NumRows(mp->cov.xform);
+   sum = 0.0;
    for (i=1;i<=numrows;i++) {
-      trans_xmm[i] = 0.0;
       xrow = mp->cov.xform[i];
-      for (j=1;j<=vecSize;j++)
-         trans_xmm[i] += xrow[j]*xmm[j];
+      for (j=1; j<=vecSize && xrow[j]==0.0; j++);
+      tx = 0.0;
+      for (; j<=vecSize; j++)
+         tx += xrow[j]*xmm[j];
+      sum += tx*tx;
    }        
-   sum = 0.0;
-   for (i=1;i<=numrows;i++)
-      sum += trans_xmm[i]*trans_xmm[i];
    sum += mp->gConst;
-   FreeVector(&gstack,xmm);
    return -0.5*sum;
 }
 
@@ -250,6 +250,7 @@ typedef struct _AdaptXForm {
   XFormSet  *xformSet;              /* set of linear transforms */
   AdaptWgt  xformWgts;              /* set of weights for all the base classes */
   struct _HMMSet *hset;                     /* transform is linked with a model set */
+  int applyStamp;                   /* >0 when applied lazily to the model set */
 } AdaptXForm;
 
 typedef struct {
@@ -471,6 +472,13 @@ void ResetHMMSet(HMMSet *hset);
   Frees memory on hmem, (and logicalHeap if HMM_STORE enabled) etc.
 */
 
+void ResetXFormCCache(void);
+/*
+  Discard the projections cached for components with shared XFORMC
+  transforms (CACHEXFORMC).  Called by CreateHMMSet and ResetHMMSet,
+  and should be called whenever components are freed and rebuilt.
+*/
+
 void SaveInOneFile(HMMSet *hset, char *fname);
 /*
    Called before SaveHMMSet to ignore all original file names and store
@@ -53,6 +53,7 @@ char *hnet_vc_id = "$Id: HNet.c,v 1.1.1.1 2006/10/11 09:54:58 jal58 Exp $";
 #define T_CST 0002         /* Trace network construction */
 #define T_MOD 0004         /* Show models making up each word */
 #define T_ALL 0010         /* Show whole network */
+#define T_MIN 0020         /* Trace network minimisation */
 
 static int trace=0;
 static ConfParam *cParm[MAXGLOBS];      /* config parameters */
@@ -97,6 +98,10 @@ Boolean remDupPron=TRUE;
 /*
    Remove duplicate pronunciations
 */
+Boolean minimiseNet=FALSE;
+/*
+   Merge equivalent nodes after network expansion
+*/
 
 Boolean sublatmarkers=FALSE;
 /*
@@ -133,6 +138,7 @@ void InitNet(void)
          subLatEnd=subLatEndBuf;
       if (GetConfBool(cParm,nParm,"REMDUPPRON",&b)) remDupPron = b;
       if (GetConfBool(cParm,nParm,"MARKSUBLAT",&b)) sublatmarkers = b;
+      if (GetConfBool(cParm,nParm,"MINIMISENET",&b)) minimiseNet = b;
       if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
    }
 }
@@ -627,27 +633,335 @@ ReturnStatus WriteOneLattice(Lattice *lat,FILE *file,LatFormat format)
    return(SUCCESS);
 }
 
+/*
+   Packed lattices store each level as a fixed header followed by
+   column arrays of 4 byte values in the usual HTK binary byte order
+
+      magic    LP_MAGIC
+      header   int[LPH_NINT] float[LPH_NFLT]
+      strings  NUL terminated strings, padded to a multiple of 4 bytes
+      words    int[nw] string offsets of the vocabulary table
+      labels   int[nl] string offsets of the alignment label table
+      nodes    double time[nn] as int pairs, high word first;
+               int word[nn],v[nn],tag[nn],sublat[nn]
+      arcs     int start[na],end[na]; float ac[na],lm[na],pr[na];
+               int align[na],nalign[na]
+      aligns   int label[nal]; float dur[nal],like[nal]
+
+   so every section sits at a 4 byte aligned offset computable from
+   the header and the file can be mapped and indexed in place.  Nodes
+   refer to words through the vocabulary table, arcs refer to a range
+   of the packed alignment array and missing strings are given as -1.
+   Likelihoods are natural logs at full precision.  Each field holds
+   exactly what WriteOneLattice would output for the same format.
+*/
+
+#define LP_MAGIC "!LATPKD\n"    /* Start of each packed lattice level */
+#define LP_VERSION 1            /* Packed lattice format version */
+
+#define LP_FIELDS (HLAT_ALABS|HLAT_TIMES|HLAT_PRON|HLAT_TAGS|HLAT_ACLIKE|\
+                   HLAT_LMLIKE|HLAT_PRLIKE|HLAT_ALIGN|HLAT_ALDUR|HLAT_ALLIKE)
+
+enum { LPH_VERSION, LPH_FORMAT, LPH_NN, LPH_NA, LPH_NW, LPH_NL, LPH_NAL,
+       LPH_POOL, LPH_UTT, LPH_VOCAB, LPH_HMMS, LPH_NET, LPH_SUBLAT,
+       LPH_NINT };
+enum { LPH_ACSCALE, LPH_LMSCALE, LPH_WDPENALTY, LPH_PRSCALE, LPH_BASE,
+       LPH_TSCALE, LPH_NFLT };
+
+/* QSCmpPtrs: order on address */
+static int QSCmpPtrs(const void *v1,const void *v2)
+{
+   char *p1,*p2;
+
+   p1=*(char**)v1; p2=*(char**)v2;
+   return(p1<p2 ? -1 : (p1>p2 ? 1 : 0));
+}
+
+/* MakePtrTable: sort and uniq the n pointers in tab, return new size */
+static int MakePtrTable(Ptr *tab,int n)
+{
+   int i,j;
+
+   if (n==0) return(0);
+   qsort(tab,n,sizeof(Ptr),QSCmpPtrs);
+   for (i=j=1;i<n;i++)
+      if (tab[i]!=tab[j-1]) tab[j++]=tab[i];
+   return(j);
+}
+
+/* FindPtr: return index of p in table made by MakePtrTable */
+static int FindPtr(Ptr *tab,int n,Ptr p)
+{
+   return((Ptr*)bsearch(&p,tab,n,sizeof(Ptr),QSCmpPtrs)-tab);
+}
+
+/* PackTime: split IEEE double t into ints w[0..1], high word first */
+static void PackTime(double t,int *w)
+{
+   static double one=1.0;
+   int tw[2],hi;
+
+   memcpy(tw,&one,sizeof(double));
+   hi=(tw[0]==0) ? 1 : 0;
+   memcpy(tw,&t,sizeof(double));
+   w[0]=tw[hi]; w[1]=tw[1-hi];
+}
+
+/* UnpackTime: inverse of PackTime */
+static double UnpackTime(int *w)
+{
+   static double one=1.0;
+   double t;
+   int tw[2],hi;
+
+   memcpy(tw,&one,sizeof(double));
+   hi=(tw[0]==0) ? 1 : 0;
+   tw[hi]=w[0]; tw[1-hi]=w[1];
+   memcpy(&t,tw,sizeof(double));
+   return(t);
+}
+
+/* PoolString: add s to string pool (just count size if pool==NULL) */
+static int PoolString(char *pool,int *size,char *s)
+{
+   int off;
+
+   if (s==NULL) return(-1);
+   off=*size;
+   if (pool!=NULL) strcpy(pool+off,s);
+   *size+=strlen(s)+1;
+   return(off);
+}
+
+/* WritePackedLattice: write a single lattice level in packed form */
+static ReturnStatus WritePackedLattice(Lattice *lat,FILE *file,LatFormat format)
+{
+   int i,j,k,nw,nl,nal,size,pass,*order,*rorder;
+   int hdr[LPH_NINT],*nword,*nv,*ntag,*nsub,*woff,*loff;
+   int *ast,*aen,*aal,*ana,*llab;
+   int *ntime;
+   float hflt[LPH_NFLT],*aac,*alm,*apr,*ldur,*llike;
+   Ptr *wtab,*ltab;
+   char *pool;
+   Boolean top,sort;
+   LNode *ln;
+   LArc *la;
+   LAlign *lal;
+
+   sort=!(lat->format&HLAT_SHARC) && !(format&HLAT_NOSORT);
+   format&=LP_FIELDS;
+   if (lat->format&HLAT_SHARC)
+      format&=~(HLAT_ACLIKE|HLAT_PRLIKE|HLAT_ALIGN);
+   top=(lat->subLatId==NULL);
+
+   order=(int *) New(&gstack, sizeof(int)*(lat->nn<lat->na ? lat->na+1 : lat->nn+1));
+   rorder=(int *) New(&gstack, sizeof(int)*(lat->nn+1));
+   ntime=(int *) New(&gstack, 2*sizeof(int)*(lat->nn+1));
+   nword=(int *) New(&gstack, sizeof(int)*(lat->nn+1));
+   nv=(int *) New(&gstack, sizeof(int)*(lat->nn+1));
+   ntag=(int *) New(&gstack, sizeof(int)*(lat->nn+1));
+   nsub=(int *) New(&gstack, sizeof(int)*(lat->nn+1));
+   wtab=(Ptr *) New(&gstack, sizeof(Ptr)*(lat->nn+1));
+   woff=(int *) New(&gstack, sizeof(int)*(lat->nn+1));
+   ast=(int *) New(&gstack, sizeof(int)*(lat->na+1));
+   aen=(int *) New(&gstack, sizeof(int)*(lat->na+1));
+   aac=(float *) New(&gstack, sizeof(float)*(lat->na+1));
+   alm=(float *) New(&gstack, sizeof(float)*(lat->na+1));
+   apr=(float *) New(&gstack, sizeof(float)*(lat->na+1));
+   aal=(int *) New(&gstack, sizeof(int)*(lat->na+1));
+   ana=(int *) New(&gstack, sizeof(int)*(lat->na+1));
+
+   /* Same node and arc order as the text form */
+   for (i=0;i<lat->nn;i++)
+      order[i]=i;
+   if (sort) {
+      slat=lat;
+      qsort(order,lat->nn,sizeof(int),QSCmpNodes);
+   }
+   for (i=0;i<lat->nn;i++) {
+      rorder[order[i]]=i;
+      lat->lnodes[order[i]].n=i;
+   }
+
+   /* Vocabulary table of words on nodes */
+   for (i=nw=0,ln=lat->lnodes;i<lat->nn;i++,ln++) {
+      if ((format&HLAT_ALABS) && ln->pred==NARC) continue;
+      if (!(format&HLAT_ALABS) && ln->word==lat->voc->subLatWord &&
+          ln->sublat!=NULL) continue;
+      if (ln->word!=NULL && ln->word!=lat->voc->nullWord)
+         wtab[nw++]=ln->word;
+   }
+   nw=MakePtrTable(wtab,nw);
+
+   for (i=0;i<lat->na;i++)
+      order[i]=i;
+   if (sort) {
+      slat=lat;
+      qsort(order,lat->na,sizeof(int),QSCmpArcs);
+   }
+
+   /* Alignment label table */
+   nal=0;
+   if (format&HLAT_ALIGN)
+      for (i=0;i<lat->na;i++)
+         nal+=NumbLArc(lat,i)->nAlign;
+   ltab=(Ptr *) New(&gstack, sizeof(Ptr)*(nal+1));
+   loff=(int *) New(&gstack, sizeof(int)*(nal+1));
+   llab=(int *) New(&gstack, sizeof(int)*(nal+1));
+   ldur=(float *) New(&gstack, sizeof(float)*(nal+1));
+   llike=(float *) New(&gstack, sizeof(float)*(nal+1));
+   for (i=nl=0;i<lat->na && nal>0;i++)
+      for (j=0,la=NumbLArc(lat,i),lal=la->lAlign;j<la->nAlign;j++,lal++)
+         ltab[nl++]=lal->label;
+   nl=MakePtrTable(ltab,nl);
+
+   /* Arcs */
+   for (i=k=0;i<lat->na;i++) {
+      la=NumbLArc(lat,order[i]);
+      ast[i]=rorder[la->start-lat->lnodes];
+      aen[i]=rorder[la->end-lat->lnodes];
+      aac[i]=alm[i]=apr[i]=0.0;
+      if (format&HLAT_ACLIKE) aac[i]=la->aclike;
+      if (format&HLAT_LMLIKE)
+         alm[i]=(lat->net==NULL ? la->lmlike*lat->lmscale+lat->wdpenalty :
+                 la->lmlike);
+      if (format&HLAT_PRLIKE) apr[i]=la->prlike;
+      aal[i]=k; ana[i]=0;
+      if ((format&HLAT_ALIGN) && la->nAlign>0) {
+         ana[i]=la->nAlign;
+         for (j=0,lal=la->lAlign;j<la->nAlign;j++,lal++,k++) {
+            llab[k]=FindPtr(ltab,nl,lal->label);
+            ldur[k]=(format&HLAT_ALDUR) ? lal->dur : 0.0;
+            llike[k]=(format&HLAT_ALLIKE) ? lal->like : 0.0;
+         }
+      }
+   }
+
+   /* Build string pool, sizing it on the first pass */
+   pool=NULL;
+   for (pass=0;pass<2;pass++) {
+      size=0;
+      for (i=0;i<LPH_NINT;i++) hdr[i]=-1;
+      if (top) {
+         hdr[LPH_UTT]=PoolString(pool,&size,lat->utterance);
+         hdr[LPH_VOCAB]=PoolString(pool,&size,lat->vocab);
+         hdr[LPH_HMMS]=PoolString(pool,&size,lat->hmms);
+         hdr[LPH_NET]=PoolString(pool,&size,lat->net);
+      }
+      else
+         hdr[LPH_SUBLAT]=PoolString(pool,&size,lat->subLatId->name);
+      for (i=0;i<nw;i++)
+         woff[i]=PoolString(pool,&size,((Word)wtab[i])->wordName->name);
+      for (i=0;i<nl;i++)
+         loff[i]=PoolString(pool,&size,((LabId)ltab[i])->name);
+      for (i=0;i<lat->nn;i++) {
+         ln=lat->lnodes+i; j=rorder[i];
+         ntag[j]=nsub[j]=-1;
+         if (format&HLAT_ALABS) continue;
+         if (ln->word==lat->voc->subLatWord && ln->sublat!=NULL)
+            nsub[j]=PoolString(pool,&size,ln->sublat->lat->subLatId->name);
+         else if ((format&HLAT_TAGS) && ln->word!=NULL)
+            ntag[j]=PoolString(pool,&size,ln->tag);
+      }
+      size=(size+3)&~3;
+      if (pass==0) {
+         pool=(char *) New(&gstack, size+1);
+         memset(pool,0,size+1);
+      }
+   }
+
+   /* Nodes */
+   for (i=0,ln=lat->lnodes;i<lat->nn;i++,ln++) {
+      j=rorder[i];
+      PackTime((format&HLAT_TIMES) ? ln->time/lat->tscale : 0.0,ntime+2*j);
+      nword[j]=nv[j]=-1;
+      if (nsub[j]>=0 || ln->word==NULL ||
+          ((format&HLAT_ALABS) && ln->pred==NARC))
+         continue;
+      if (ln->word!=lat->voc->nullWord)
+         nword[j]=FindPtr(wtab,nw,ln->word);
+      if ((format&HLAT_PRON) && ln->v>=0)
+         nv[j]=ln->v;
+   }
+
+   /* Header */
+   hdr[LPH_VERSION]=LP_VERSION; hdr[LPH_FORMAT]=format;
+   hdr[LPH_NN]=lat->nn; hdr[LPH_NA]=lat->na;
+   hdr[LPH_NW]=nw; hdr[LPH_NL]=nl; hdr[LPH_NAL]=k; hdr[LPH_POOL]=size;
+   hflt[LPH_ACSCALE]=hflt[LPH_LMSCALE]=hflt[LPH_PRSCALE]=1.0;
+   hflt[LPH_WDPENALTY]=0.0;
+   hflt[LPH_BASE]=hflt[LPH_TSCALE]=1.0;
+   if (top) {
+      if (lat->net!=NULL) {
+         hflt[LPH_LMSCALE]=lat->lmscale;
+         hflt[LPH_WDPENALTY]=lat->wdpenalty;
+      }
+      if (format&HLAT_PRLIKE) hflt[LPH_PRSCALE]=lat->prscale;
+      if (format&HLAT_ACLIKE) hflt[LPH_ACSCALE]=lat->acscale;
+      hflt[LPH_BASE]=lat->logbase;
+      hflt[LPH_TSCALE]=lat->tscale;
+   }
+
+   fprintf(file,"%s",LP_MAGIC);
+   WriteInt(file,hdr,LPH_NINT,TRUE);
+   WriteFloat(file,hflt,LPH_NFLT,TRUE);
+   if (size>0 && fwrite(pool,1,size,file)!=size) {
+      Dispose(&gstack,order);
+      slat=NULL;
+      HRError(8253,"WritePackedLattice: Cannot write string pool");
+      return(FAIL);
+   }
+   WriteInt(file,woff,nw,TRUE);
+   WriteInt(file,loff,nl,TRUE);
+   WriteInt(file,ntime,2*lat->nn,TRUE);
+   WriteInt(file,nword,lat->nn,TRUE);
+   WriteInt(file,nv,lat->nn,TRUE);
+   WriteInt(file,ntag,lat->nn,TRUE);
+   WriteInt(file,nsub,lat->nn,TRUE);
+   WriteInt(file,ast,lat->na,TRUE);
+   WriteInt(file,aen,lat->na,TRUE);
+   WriteFloat(file,aac,lat->na,TRUE);
+   WriteFloat(file,alm,lat->na,TRUE);
+   WriteFloat(file,apr,lat->na,TRUE);
+   WriteInt(file,aal,lat->na,TRUE);
+   WriteInt(file,ana,lat->na,TRUE);
+   WriteInt(file,llab,k,TRUE);
+   WriteFloat(file,ldur,k,TRUE);
+   WriteFloat(file,llike,k,TRUE);
+
+   Dispose(&gstack,order);
+   slat=NULL;
+   return(SUCCESS);
+}
+
 /* EXPORT->WriteLattice: Write lattice to file */
 ReturnStatus WriteLattice(Lattice *lat,FILE *file,LatFormat format)
 {
    LabId id;
    Lattice *list;
+   ReturnStatus (*writeOne)(Lattice *lat,FILE *file,LatFormat format);
    
-   fprintf(file,"VERSION=%s\n",L_VERSION);
-   if (lat->utterance!=NULL)
-      fprintf(file,"UTTERANCE=%s\n",lat->utterance);
-   if (lat->net!=NULL) {
-      fprintf(file,"lmname=%s\nlmscale=%-6.2f wdpenalty=%-6.2f\n",
-              lat->net,lat->lmscale,lat->wdpenalty);
-   }
-   if (format&HLAT_PRLIKE)
-      fprintf(file,"prscale=%-6.2f\n",lat->prscale);
-   if (format&HLAT_ACLIKE)
-      fprintf(file,"acscale=%-6.2f\n",lat->acscale);
-   if (lat->vocab!=NULL) fprintf(file,"vocab=%s\n",lat->vocab);
-   if (lat->hmms!=NULL) fprintf(file,"hmms=%s\n",lat->hmms);
-   if (lat->logbase != 1.0) fprintf(file,"base=%f\n",lat->logbase);
-   if (lat->tscale != 1.0) fprintf(file,"tscale=%f\n",lat->tscale);
+   /* Packed lattices carry the header in the top level itself */
+   if (format&HLAT_PACKED)
+      writeOne=WritePackedLattice;
+   else {
+      writeOne=WriteOneLattice;
+      fprintf(file,"VERSION=%s\n",L_VERSION);
+      if (lat->utterance!=NULL)
+         fprintf(file,"UTTERANCE=%s\n",lat->utterance);
+      if (lat->net!=NULL) {
+         fprintf(file,"lmname=%s\nlmscale=%-6.2f wdpenalty=%-6.2f\n",
+                 lat->net,lat->lmscale,lat->wdpenalty);
+      }
+      if (format&HLAT_PRLIKE)
+         fprintf(file,"prscale=%-6.2f\n",lat->prscale);
+      if (format&HLAT_ACLIKE)
+         fprintf(file,"acscale=%-6.2f\n",lat->acscale);
+      if (lat->vocab!=NULL) fprintf(file,"vocab=%s\n",lat->vocab);
+      if (lat->hmms!=NULL) fprintf(file,"hmms=%s\n",lat->hmms);
+      if (lat->logbase != 1.0) fprintf(file,"base=%f\n",lat->logbase);
+      if (lat->tscale != 1.0) fprintf(file,"tscale=%f\n",lat->tscale);
+   }
 
    /* First write all subsidiary sublattices */
    if (lat->subList!=NULL && !(format&HLAT_NOSUBS)) {
@@ -662,14 +976,14 @@ ReturnStatus WriteLattice(Lattice *lat,FILE *file,LatFormat format)
             HRError(8253,"WriteLattice: Sublats must be labelled");
             return(FAIL);
          }
-         if(WriteOneLattice(list,file,format)<SUCCESS){
+         if(writeOne(list,file,format)<SUCCESS){
             return(FAIL);
          }
       }
    }
    id=lat->subLatId;
    lat->subLatId=NULL;
-   if(WriteOneLattice(lat,file,format)<SUCCESS){
+   if(writeOne(lat,file,format)<SUCCESS){
       return(FAIL);
    }
    lat->subLatId=id;
@@ -874,6 +1188,225 @@ static int ReadAlign(Lattice *lat,LArc *la,char *buf)
    return(n);
 }
 
+/* PackedString: return string at offset off of pool (NULL if off<0) */
+static char *PackedString(char *pool,int size,int off,Boolean *ok)
+{
+   if (off<0) return(NULL);
+   if (off>=size) {
+      *ok=FALSE;
+      return(NULL);
+   }
+   return(pool+off);
+}
+
+/* ReadPackedLattice: Read one level of a packed lattice, the first
+   character of the magic string has already been read */
+static Lattice *ReadPackedLattice(Source *src, MemHeap *heap, Vocab *voc,
+                                  Boolean shortArc, Boolean add2Dict)
+{
+   int i,j,nn,na,nw,nl,nal,size,hdr[LPH_NINT];
+   int *nword,*nv,*ntag,*nsub,*woff,*loff,*lstate;
+   int *ast,*aen,*aal,*ana,*llab;
+   int *ntime;
+   float hflt[LPH_NFLT],*aac,*alm,*apr,*ldur,*llike;
+   char *pool,*str;
+   Word *wtab;
+   LabId *ltab,id;
+   LAlign *lal;
+   Lattice *lat;
+   LNode *ln;
+   LArc *la;
+   Boolean ok,alabs;
+
+   for (i=1;LP_MAGIC[i]!=0;i++)
+      if (GetCh(src)!=LP_MAGIC[i]) {
+         HRError(8250,"ReadLattice: Bad packed lattice header");
+         return(NULL);
+      }
+   if (!ReadInt(src,hdr,LPH_NINT,TRUE) ||
+       !ReadFloat(src,hflt,LPH_NFLT,TRUE)) {
+      HRError(8250,"ReadLattice: Premature end of packed lattice header");
+      return(NULL);
+   }
+   nn=hdr[LPH_NN]; na=hdr[LPH_NA]; nw=hdr[LPH_NW]; nl=hdr[LPH_NL];
+   nal=hdr[LPH_NAL]; size=hdr[LPH_POOL];
+   if (hdr[LPH_VERSION]!=LP_VERSION) {
+      HRError(8250,"ReadLattice: Packed lattice version %d not supported",
+              hdr[LPH_VERSION]);
+      return(NULL);
+   }
+   if (nn<=0 || na<0 || nw<0 || nl<0 || nal<0 || size<0 || (size&3)!=0) {
+      HRError(8250,"ReadLattice: Packed lattice header corrupt");
+      return(NULL);
+   }
+   if (hflt[LPH_BASE] < 0.0) {
+      HRError(8251,"ReadLattice: Illegal log base in lattice");
+      return(NULL);
+   }
+
+   lat = (Lattice *) New(heap,sizeof(Lattice));
+   lat->heap=heap; lat->subLatId=NULL; lat->chain=NULL;
+   lat->voc=voc; lat->refList=NULL; lat->subList=NULL;
+   lat->nn=nn; lat->na=na;
+   lat->lnodes=(LNode *) New(heap, sizeof(LNode)*nn);
+   if (shortArc)
+      lat->larcs=(LArc *) New(heap, sizeof(LArc_S)*na);
+   else
+      lat->larcs=(LArc *) New(heap, sizeof(LArc)*na);
+   lal=(shortArc || nal==0) ? NULL : (LAlign *) New(heap, sizeof(LAlign)*nal);
+
+   /* Read whole file image into column arrays */
+   pool=(char *) New(&gstack, size+1);
+   woff=(int *) New(&gstack, sizeof(int)*(nw+1));
+   loff=(int *) New(&gstack, sizeof(int)*(nl+1));
+   wtab=(Word *) New(&gstack, sizeof(Word)*(nw+1));
+   ltab=(LabId *) New(&gstack, sizeof(LabId)*(nl+1));
+   lstate=(int *) New(&gstack, sizeof(int)*(nl+1));
+   ntime=(int *) New(&gstack, 2*sizeof(int)*nn);
+   nword=(int *) New(&gstack, sizeof(int)*nn);
+   nv=(int *) New(&gstack, sizeof(int)*nn);
+   ntag=(int *) New(&gstack, sizeof(int)*nn);
+   nsub=(int *) New(&gstack, sizeof(int)*nn);
+   ast=(int *) New(&gstack, sizeof(int)*(na+1));
+   aen=(int *) New(&gstack, sizeof(int)*(na+1));
+   aac=(float *) New(&gstack, sizeof(float)*(na+1));
+   alm=(float *) New(&gstack, sizeof(float)*(na+1));
+   apr=(float *) New(&gstack, sizeof(float)*(na+1));
+   aal=(int *) New(&gstack, sizeof(int)*(na+1));
+   ana=(int *) New(&gstack, sizeof(int)*(na+1));
+   llab=(int *) New(&gstack, sizeof(int)*(nal+1));
+   ldur=(float *) New(&gstack, sizeof(float)*(nal+1));
+   llike=(float *) New(&gstack, sizeof(float)*(nal+1));
+
+   ok=(fread(pool,1,size,src->f)==size);
+   src->chcount+=size; pool[size]=0;
+   ok = ok && (size==0 || pool[size-1]==0) &&
+      ReadInt(src,woff,nw,TRUE) && ReadInt(src,loff,nl,TRUE) &&
+      ReadInt(src,ntime,2*nn,TRUE) && ReadInt(src,nword,nn,TRUE) &&
+      ReadInt(src,nv,nn,TRUE) && ReadInt(src,ntag,nn,TRUE) &&
+      ReadInt(src,nsub,nn,TRUE) &&
+      ReadInt(src,ast,na,TRUE) && ReadInt(src,aen,na,TRUE) &&
+      ReadFloat(src,aac,na,TRUE) && ReadFloat(src,alm,na,TRUE) &&
+      ReadFloat(src,apr,na,TRUE) &&
+      ReadInt(src,aal,na,TRUE) && ReadInt(src,ana,na,TRUE) &&
+      ReadInt(src,llab,nal,TRUE) &&
+      ReadFloat(src,ldur,nal,TRUE) && ReadFloat(src,llike,nal,TRUE);
+   if (!ok) {
+      Dispose(&gstack,pool); Dispose(heap,lat);
+      HRError(8250,"ReadLattice: Premature end of packed lattice");
+      return(NULL);
+   }
+
+   /* Header */
+   lat->utterance=SafeCopyString(heap,PackedString(pool,size,hdr[LPH_UTT],&ok));
+   lat->vocab=SafeCopyString(heap,PackedString(pool,size,hdr[LPH_VOCAB],&ok));
+   lat->hmms=SafeCopyString(heap,PackedString(pool,size,hdr[LPH_HMMS],&ok));
+   lat->net=SafeCopyString(heap,PackedString(pool,size,hdr[LPH_NET],&ok));
+   if ((str=PackedString(pool,size,hdr[LPH_SUBLAT],&ok))!=NULL)
+      lat->subLatId=GetLabId(str,TRUE);
+   lat->acscale=hflt[LPH_ACSCALE]; lat->lmscale=hflt[LPH_LMSCALE];
+   lat->wdpenalty=hflt[LPH_WDPENALTY]; lat->prscale=hflt[LPH_PRSCALE];
+   lat->logbase=hflt[LPH_BASE]; lat->tscale=hflt[LPH_TSCALE];
+   lat->framedur=0;
+   lat->format=(shortArc?HLAT_SHARC|HLAT_ALABS:HLAT_ALABS);
+   if (hdr[LPH_FORMAT]&HLAT_TIMES) lat->format|=HLAT_TIMES;
+   if (na>0) lat->format|=hdr[LPH_FORMAT]&(HLAT_ACLIKE|HLAT_LMLIKE|HLAT_PRLIKE);
+   alabs=(hdr[LPH_FORMAT]&HLAT_ALABS)!=0;
+
+   /* Map vocabulary and label tables once */
+   for (i=0;i<nw && ok;i++) {
+      if ((str=PackedString(pool,size,woff[i],&ok))==NULL) {
+         ok=FALSE; break;
+      }
+      wtab[i]=GetWord(voc,GetLabId(str,add2Dict),add2Dict);
+      if (wtab[i]==NULL || wtab[i]==voc->subLatWord) {
+         HRError(8251,"ReadLattice: Word %s not in dict",str);
+         Dispose(&gstack,pool); Dispose(heap,lat);
+         return(NULL);
+      }
+   }
+   for (i=0;i<nl && ok;i++) {
+      if ((str=PackedString(pool,size,loff[i],&ok))==NULL) {
+         ok=FALSE; break;
+      }
+      ltab[i]=GetLabId(str,TRUE);
+      if ((str=strchr(ltab[i]->name,'['))!=NULL)
+         lstate[i]=atoi(str+1);
+      else lstate[i]=-1;
+   }
+
+   /* Nodes */
+   for (i=0,ln=lat->lnodes;i<nn && ok;i++,ln++) {
+      ln->hook=NULL; ln->pred=ln->foll=NARC;
+      ln->score=0.0;
+      ln->time=UnpackTime(ntime+2*i)*lat->tscale;
+      ln->v=nv[i];
+      if (nv[i]>=0) lat->format|=HLAT_PRON;
+      ln->tag=SafeCopyString(heap,PackedString(pool,size,ntag[i],&ok));
+      if (ln->tag!=NULL) lat->format|=HLAT_TAGS;
+      ln->sublat=NULL;
+      if (nword[i]>=nw) ok=FALSE;
+      else if (nword[i]>=0) ln->word=wtab[nword[i]];
+      else ln->word=voc->nullWord;
+      if ((str=PackedString(pool,size,nsub[i],&ok))!=NULL) {
+         ln->word=voc->subLatWord;
+         id=GetLabId(str,TRUE);
+         if((ln->sublat=AdjSubList(lat,id,NULL,+1))==NULL) {
+            Dispose(&gstack,pool); Dispose(heap,lat);
+            HRError(8251,"ReadLattice: AdjSubLat failed");
+            return(NULL);
+         }
+      }
+      if (!alabs && ln->word!=voc->nullWord)
+         lat->format&=~HLAT_ALABS;
+   }
+
+   /* Arcs */
+   for (i=0,la=lat->larcs;i<na && ok;i++,la=NextLArc(lat,la)) {
+      if (ast[i]<0 || ast[i]>=nn || aen[i]<0 || aen[i]>=nn) {
+         ok=FALSE; break;
+      }
+      la->start=lat->lnodes+ast[i];
+      la->end=lat->lnodes+aen[i];
+      la->lmlike=alm[i];
+      la->farc=la->start->foll;
+      la->parc=la->end->pred;
+      la->start->foll=la;
+      la->end->pred=la;
+      if (shortArc) continue;
+      la->aclike=aac[i]; la->prlike=apr[i];
+      la->score=0.0;
+      la->nAlign=0; la->lAlign=NULL;
+      if (ana[i]>0) {
+         if (aal[i]<0 || ana[i]>nal-aal[i]) {
+            ok=FALSE; break;
+         }
+         lat->format|=HLAT_ALIGN;
+         la->nAlign=ana[i]; la->lAlign=lal+aal[i];
+         for (j=aal[i];j<aal[i]+ana[i];j++) {
+            if (llab[j]<0 || llab[j]>=nl) {
+               ok=FALSE; break;
+            }
+            lal[j].label=ltab[llab[j]]; lal[j].state=lstate[llab[j]];
+            lal[j].dur=ldur[j]; lal[j].like=llike[j];
+         }
+      }
+   }
+   Dispose(&gstack,pool);
+   if (!ok) {
+      Dispose(heap,lat);
+      HRError(8250,"ReadLattice: Packed lattice index out of range");
+      return(NULL);
+   }
+   if(CheckStEndNodes(lat)<SUCCESS){
+      Dispose(heap, lat);
+      HRError(8250,"ReadLattice: Start/End nodes incorrect");
+      return(NULL);
+   }
+   if (shortArc) lat->format&=~(HLAT_ACLIKE|HLAT_PRLIKE|HLAT_ALIGN);
+   return(lat);
+}
+
 /* ReadOneLattice: Read (one level) of lattice from file */
 Lattice *ReadOneLattice(Source *src, MemHeap *heap, Vocab *voc, 
                                Boolean shortArc, Boolean add2Dict)
@@ -894,6 +1427,11 @@ Lattice *ReadOneLattice(Source *src, MemHeap *heap, Vocab *voc,
    char *uttstr,*lmnstr,*vocstr,*hmmstr,*sublatstr,*tag;
    SubLatDef *subLatId = NULL;
 
+   /* Packed lattices are recognised by their magic string */
+   if ((i=GetCh(src))==LP_MAGIC[0])
+      return(ReadPackedLattice(src,heap,voc,shortArc,add2Dict));
+   UnGetCh(i,src);
+
    lat = (Lattice *) New(heap,sizeof(Lattice));
    lat->heap=heap; lat->subLatId=NULL; lat->chain=NULL;
    lat->voc=voc; lat->refList=NULL; lat->subList=NULL;
@@ -3413,6 +3951,278 @@ void ShowWords(Lattice *lat,Vocab *voc,HMMSetCxtInfo *hci)
 }
 
 
+/* ------------------------ Network Minimisation ---------------------- */
+
+/*
+   When MINIMISENET is set the expanded network is reduced by merging
+   equivalent nodes.  Two nodes are equivalent if they represent the
+   same model (or pronunciation and tag) and either have identical sets
+   of successors (suffix or tail merging) or identical sets of
+   predecessors (prefix merging).  Prefix merging takes the union of the
+   successors.  Since only the best token is propagated along parallel
+   links to the same node, these are reduced to the most likely one.
+   The two passes are alternated until neither finds anything to merge.
+*/
+
+typedef struct {
+   int n;            /* Number of nodes in network chain */
+   NetNode **nodes;  /* Array[0..n+1] of nodes (initial==n, final==n+1) */
+   int *rep;         /* Node this one was merged into (-1 == still live) */
+   int nh;           /* Size of hash table */
+   int *hashTab;     /* Array[0..nh-1] of first node in each bucket */
+   int *hashNext;    /* Array[0..n-1] of next node in bucket */
+   int *pst;         /* Array[0..n+1] of start of predecessors for node */
+   int *pred;        /* Array of predecessor indices (sorted per node) */
+   float *plike;     /* Likelihoods of links from predecessors */
+}
+MinNetInfo;
+
+/* QSCmpNetLinks: order on destination, then descending likelihood */
+static int QSCmpNetLinks(const void *v1,const void *v2)
+{
+   NetLink *l1,*l2;
+
+   l1=(NetLink *)v1; l2=(NetLink *)v2;
+   if (l1->node->aux!=l2->node->aux) return(l1->node->aux-l2->node->aux);
+   if (l1->like>l2->like) return(-1);
+   else if (l1->like<l2->like) return(1);
+   return(0);
+}
+
+/* MNLive: return representative (still live) node for node */
+static NetNode *MNLive(MinNetInfo *mn,NetNode *node)
+{
+   int i;
+
+   for (i=node->aux;mn->rep[i]>=0;i=mn->rep[i]);
+   return(mn->nodes[i]);
+}
+
+/* CanonLinks: redirect, sort and remove parallel links of node */
+static void CanonLinks(MinNetInfo *mn,NetNode *node)
+{
+   int i,j;
+
+   for (i=0;i<node->nlinks;i++)
+      node->links[i].node=MNLive(mn,node->links[i].node);
+   if (node->nlinks<2) return;
+   qsort(node->links,node->nlinks,sizeof(NetLink),QSCmpNetLinks);
+   for (i=1,j=0;i<node->nlinks;i++)
+      if (node->links[i].node!=node->links[j].node)
+         node->links[++j]=node->links[i];
+   node->nlinks=j+1;
+}
+
+/* SameNodeLabel: TRUE if two nodes represent the same model/word */
+static Boolean SameNodeLabel(NetNode *n1,NetNode *n2)
+{
+   if ((n1->type&n_nocontext)!=(n2->type&n_nocontext)) return(FALSE);
+   if (n1->type&n_hmm) return(n1->info.hmm==n2->info.hmm);
+   if (n1->info.pron!=n2->info.pron) return(FALSE);
+   if (n1->tag==NULL || n2->tag==NULL) return(n1->tag==n2->tag);
+   return(strcmp(n1->tag,n2->tag)==0);
+}
+
+/* NodeLabelHash: hash value consistent with SameNodeLabel */
+static unsigned NodeLabelHash(NetNode *node)
+{
+   unsigned h;
+   char *p;
+
+   h=(node->type&n_nocontext);
+   h=h*31+(unsigned)((node->type&n_hmm)?(size_t)node->info.hmm:
+                     (size_t)node->info.pron);
+   if (!(node->type&n_hmm) && node->tag!=NULL)
+      for (p=node->tag;*p!='\0';p++) h=h*31+(unsigned char)*p;
+   return(h);
+}
+
+/* SameSuccessors: TRUE if canonical link arrays are identical */
+static Boolean SameSuccessors(NetNode *n1,NetNode *n2)
+{
+   int i;
+
+   if (n1->nlinks!=n2->nlinks) return(FALSE);
+   for (i=0;i<n1->nlinks;i++)
+      if (n1->links[i].node!=n2->links[i].node || 
+          n1->links[i].like!=n2->links[i].like)
+         return(FALSE);
+   return(TRUE);
+}
+
+/* SamePredecessors: TRUE if predecessor sets of nodes i and j match */
+static Boolean SamePredecessors(MinNetInfo *mn,int i,int j)
+{
+   int k,n;
+
+   n=mn->pst[i+1]-mn->pst[i];
+   if (n!=mn->pst[j+1]-mn->pst[j]) return(FALSE);
+   for (k=0;k<n;k++)
+      if (mn->pred[mn->pst[i]+k]!=mn->pred[mn->pst[j]+k] ||
+          mn->plike[mn->pst[i]+k]!=mn->plike[mn->pst[j]+k])
+         return(FALSE);
+   return(TRUE);
+}
+
+/* CanonAllLinks: canonicalise links of initial and all live nodes */
+static void CanonAllLinks(MinNetInfo *mn)
+{
+   int i;
+
+   for (i=0;i<=mn->n;i++)
+      if (mn->rep[i]<0) CanonLinks(mn,mn->nodes[i]);
+}
+
+/* MergeSuffixes: merge live nodes with identical successors */
+static int MergeSuffixes(MinNetInfo *mn)
+{
+   NetNode *node;
+   unsigned h;
+   int i,j,k,nm=0;
+
+   CanonAllLinks(mn);
+   for (i=0;i<mn->nh;i++) mn->hashTab[i]=-1;
+   for (i=0;i<mn->n;i++) {
+      if (mn->rep[i]>=0) continue;
+      node=mn->nodes[i];
+      h=NodeLabelHash(node);
+      for (k=0;k<node->nlinks;k++) 
+         h=h*17+node->links[k].node->aux;
+      h%=mn->nh;
+      for (j=mn->hashTab[h];j>=0;j=mn->hashNext[j])
+         if (SameNodeLabel(node,mn->nodes[j]) &&
+             SameSuccessors(node,mn->nodes[j])) break;
+      if (j>=0) {
+         mn->rep[i]=j; nm++;
+      }
+      else {
+         mn->hashNext[i]=mn->hashTab[h]; mn->hashTab[h]=i;
+      }
+   }
+   return(nm);
+}
+
+/* FindPredecessors: build sorted predecessor lists for live nodes */
+static void FindPredecessors(MinNetInfo *mn)
+{
+   NetNode *node;
+   int i,k,d,*fill;
+
+   for (i=0;i<=mn->n+2;i++) mn->pst[i]=0;
+   for (i=0;i<=mn->n;i++) {
+      if (mn->rep[i]>=0) continue;
+      node=mn->nodes[i];
+      for (k=0;k<node->nlinks;k++)
+         mn->pst[node->links[k].node->aux+1]++;
+   }
+   for (i=1;i<=mn->n+2;i++) mn->pst[i]+=mn->pst[i-1];
+   fill=(int *) New(&gstack,sizeof(int)*(mn->n+2));
+   for (i=0;i<mn->n+2;i++) fill[i]=mn->pst[i];
+   /* Scanning sources in index order leaves each list sorted */
+   for (i=0;i<=mn->n;i++) {
+      if (mn->rep[i]>=0) continue;
+      node=mn->nodes[i];
+      for (k=0;k<node->nlinks;k++) {
+         d=fill[node->links[k].node->aux]++;
+         mn->pred[d]=i; mn->plike[d]=node->links[k].like;
+      }
+   }
+   Dispose(&gstack,fill);
+}
+
+/* MergePrefixes: merge live nodes with identical predecessors */
+static int MergePrefixes(MinNetInfo *mn,MemHeap *heap)
+{
+   NetNode *node,*keep;
+   NetLink *links;
+   unsigned h;
+   int i,j,k,nm=0;
+
+   CanonAllLinks(mn);
+   FindPredecessors(mn);
+   for (i=0;i<mn->nh;i++) mn->hashTab[i]=-1;
+   for (i=0;i<mn->n;i++) {
+      if (mn->rep[i]>=0) continue;
+      node=mn->nodes[i];
+      h=NodeLabelHash(node);
+      for (k=mn->pst[i];k<mn->pst[i+1];k++) h=h*17+mn->pred[k];
+      h%=mn->nh;
+      for (j=mn->hashTab[h];j>=0;j=mn->hashNext[j])
+         if (SameNodeLabel(node,mn->nodes[j]) && 
+             SamePredecessors(mn,i,j)) break;
+      if (j>=0) {
+         keep=mn->nodes[j];
+         if (node->nlinks>0) {
+            links=(NetLink *) New(heap,sizeof(NetLink)*
+                                  (keep->nlinks+node->nlinks));
+            for (k=0;k<keep->nlinks;k++) links[k]=keep->links[k];
+            for (k=0;k<node->nlinks;k++) 
+               links[keep->nlinks+k]=node->links[k];
+            keep->links=links; keep->nlinks+=node->nlinks;
+         }
+         mn->rep[i]=j; nm++;
+      }
+      else {
+         mn->hashNext[i]=mn->hashTab[h]; mn->hashTab[h]=i;
+      }
+   }
+   return(nm);
+}
+
+/* MinimiseNetwork: merge equivalent nodes in net */
+static void MinimiseNetwork(Network *net)
+{
+   MinNetInfo mn;
+   NetNode *node,**tl;
+   int i,nl,nm,nsfx=0,npfx=0,pass=0,nNode=0,nLink=0;
+
+   for (node=net->chain,nl=0,mn.n=0;node!=NULL;node=node->chain,mn.n++)
+      nl+=node->nlinks;
+   nl+=net->initial.nlinks;
+   mn.nodes=(NetNode **) New(&gstack,sizeof(NetNode *)*(mn.n+2));
+   mn.rep=(int *) New(&gstack,sizeof(int)*(mn.n+2));
+   mn.nh=mn.n+1;
+   mn.hashTab=(int *) New(&gstack,sizeof(int)*mn.nh);
+   mn.hashNext=(int *) New(&gstack,sizeof(int)*(mn.n+1));
+   mn.pst=(int *) New(&gstack,sizeof(int)*(mn.n+3));
+   mn.pred=(int *) New(&gstack,sizeof(int)*(nl+1));
+   mn.plike=(float *) New(&gstack,sizeof(float)*(nl+1));
+   for (node=net->chain,i=0;node!=NULL;node=node->chain,i++) {
+      mn.nodes[i]=node; node->aux=i;
+   }
+   mn.nodes[mn.n]=&net->initial; net->initial.aux=mn.n;
+   mn.nodes[mn.n+1]=&net->final; net->final.aux=mn.n+1;
+   for (i=0;i<mn.n+2;i++) mn.rep[i]=-1;
+
+   do {
+      nm=MergePrefixes(&mn,net->heap); npfx+=nm;
+      nm+=i=MergeSuffixes(&mn); nsfx+=i;
+      pass++;
+   } while (nm>0);
+   CanonAllLinks(&mn);
+
+   /* Rebuild chain from live nodes */
+   tl=&net->chain;
+   for (i=0;i<mn.n;i++) {
+      node=mn.nodes[i]; node->aux=0;
+      if (mn.rep[i]>=0) continue;
+      *tl=node; tl=&node->chain;
+      nNode++; nLink+=node->nlinks;
+   }
+   *tl=NULL;
+   net->initial.aux=net->final.aux=0;
+   nLink+=net->initial.nlinks;
+
+   if (trace&T_MIN) {
+      printf("Network minimisation: %d passes\n",pass);
+      printf(" %d nodes -> %d (%d prefix, %d suffix merges)\n",
+             mn.n,nNode,npfx,nsfx);
+      printf(" %d links -> %d\n",nl,nLink);
+      fflush(stdout);
+   }
+   Dispose(&gstack,mn.nodes);
+}
+
 HMMSetCxtInfo *GetHMMSetCxtInfo(HMMSet *hset, Boolean frcCxtInd)
 {
    HMMSetCxtInfo *hci;
@@ -3608,6 +4418,8 @@ Network *ExpandWordNet(MemHeap *heap,Lattice *lat,Vocab *voc,HMMSet *hset)
       lat->lnodes[i].sublat = NULL;
    DeleteHeap(&holderHeap);
 
+   if (minimiseNet)
+      MinimiseNetwork(net);
 
    /* Count the initial/final nodes/links */
    net->numLink=net->initial.nlinks;
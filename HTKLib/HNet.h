@@ -76,6 +76,7 @@ typedef int LatFormat;      /* Format of lattice. Formed by oring flags */
 
 #define HLAT_ALABS  0x0001  /* Word labels with arcs (normally with nodes) */
 #define HLAT_LBIN   0x0002  /* Binary lattices for speed */
+#define HLAT_PACKED 0x0004  /* Packed binary lattice file (arrays + tables) */
 #define HLAT_TIMES  0x0008  /* Node times */
 #define HLAT_PRON   0x0010  /* Pronunciation information */
 #define HLAT_ACLIKE 0x0020  /* Acoustic likelihoods */
@@ -282,8 +283,11 @@ void FreeLattice(Lattice *lat);
 
 ReturnStatus WriteLattice(Lattice *lat, FILE *file, LatFormat form);
 /*
-   Write lattice to given file, according to given format  
-   specifier.
+   Write lattice to given file, according to given format
+   specifier.  If form includes HLAT_PACKED the lattice is written
+   in packed binary form, holding exactly the fields the text SLF
+   would contain for the same format, so conversion either way
+   is lossless.
 */
 
 Lattice *ReadLattice(FILE *file, MemHeap *heap, Vocab *voc, 
@@ -297,7 +301,9 @@ Lattice *ReadOneLattice(Source *src, MemHeap *heap, Vocab *voc,
    using the Vocab voc.  If shortArc is true, then each arc is stored in
    short form and cannot then support alignment information.
    If add2Dict is TRUE then ReadLattice will add unseen words to voc
-   rather than generating an error.
+   rather than generating an error.  Both text SLF and packed binary
+   lattices (written with format HLAT_PACKED) are accepted, the type
+   being detected from the start of each lattice level.
 */
 
 
@@ -496,6 +502,13 @@ Network *ExpandWordNet(MemHeap *heap,Lattice *lat,Vocab *voc,HMMSet *hset);
    [ Stages (iii) and (iv) actually proceed concurrently to allow sharing
      of logical models with the same underlying physical model for the first
      and last phone of context dependent models ].
+
+   v)   Network minimisation.
+        If MINIMISENET==TRUE nodes representing the same model (or word
+	end) that have identical predecessors or identical successors
+	are merged, repeating until no more merges are possible.  This
+	removes redundant parallel paths and shares common word endings
+	without changing the set of model sequences in the network.
 */
 
 /* --- Context handling stuff useful for general network building --- */
@@ -145,6 +145,33 @@ struct _NetInst
 #endif
 };
 
+/* Traceback records are allocated from arenas of fixed size chunks */
+typedef union tbhead
+{
+   struct tbchunk *chunk;    /* Chunk containing record */
+   double align;             /* Ensure record is suitably aligned */
+}
+TBHead;
+
+typedef struct tbchunk
+{
+   struct tbchunk *next;     /* Next chunk in arena */
+   TBHead *free;             /* List of released records */
+   int nFresh;               /* Number of records never allocated */
+   int nUsed;                /* Number of records in use */
+   char *data;               /* Record storage */
+}
+TBChunk;
+
+typedef struct tbarena
+{
+   size_t size;              /* Size of record including header */
+   int nRec;                 /* Number of records per chunk */
+   TBChunk *cur;             /* Chunk currently used for allocation */
+   TBChunk *head;            /* List of all chunks */
+}
+TBArena;
+
 /* HMMSet information is some precomputed limits plus the precomps */
 typedef struct precomp
 {
@@ -213,9 +240,9 @@ struct precinfo {
    MemHeap instHeap;        /* Inst heap */
    MemHeap *stHeap;         /* Array[0..stHeapNum-1] of heaps for states */
    MemHeap rTokHeap;        /* RelToken heap */
-   MemHeap pathHeap;        /* Path heap */
-   MemHeap rPthHeap;        /* NxtPath heap */
-   MemHeap alignHeap;       /* Align heap */
+   TBArena pathArena;       /* Path records */
+   TBArena rPthArena;       /* NxtPath records */
+   TBArena alignArena;      /* Align records */
 
    int npth;                /* Current number of path records */
    int cpth;                /* Number of path records after last collection */
@@ -223,6 +250,7 @@ struct precinfo {
    Path pNoRef;             /* Head of PathNoRef linked list */
    Path pYesTail;           /* Tail of PathYesRef linked list */
    Path pNoTail;            /* Tail of PathNoRef linked list */
+   Path *commit;            /* Last path committed by PartialRecognition */
 
    int nalign;              /* Current number of align records */
    int calign;              /* Number of align records after last collection */
@@ -550,6 +578,120 @@ static LogFloat cPOutP(PSetInfo *psi,Observation *obs,StateInfo *si,int id)
    return(pre->outp);
 }
 
+/* ------------------- Traceback Record Arenas ----------------------- */
+
+/*
+   Path, NxtPath and Align records are allocated from arenas in which
+   each record is preceded by a pointer to the chunk holding it.  This
+   makes freeing a record constant time however many records are live
+   (unlike an MHEAP which has to search its block list).  Records are
+   taken from the current chunk until it is full, so records created
+   at around the same frame share chunks, and chunks that have become
+   empty are released by TrimArena after each garbage collection.
+*/
+
+#define TB_CHUNKSIZE 2048  /* Records per chunk */
+
+/* InitArena: initialise arena for records of size bytes */
+static void InitArena(TBArena *arena,size_t size)
+{
+   arena->size=sizeof(TBHead)*(1+(size+sizeof(TBHead)-1)/sizeof(TBHead));
+   arena->nRec=TB_CHUNKSIZE;
+   arena->cur=arena->head=NULL;
+}
+
+/* NewChunk: add a new empty chunk to arena */
+static TBChunk *NewChunk(TBArena *arena)
+{
+   TBChunk *chunk;
+
+   chunk=(TBChunk *) New(&gcheap,sizeof(TBChunk));
+   chunk->data=(char *) New(&gcheap,arena->size*arena->nRec);
+   chunk->free=NULL;
+   chunk->nFresh=arena->nRec;
+   chunk->nUsed=0;
+   chunk->next=arena->head;
+   arena->head=chunk;
+   return(chunk);
+}
+
+/* NewTBRec: allocate a record from arena */
+static void *NewTBRec(TBArena *arena)
+{
+   TBChunk *chunk;
+   TBHead *rec;
+
+   chunk=arena->cur;
+   if (chunk==NULL || chunk->nUsed==arena->nRec) {
+      /* Reuse a chunk that is at most half full before growing */
+      for (chunk=arena->head;chunk!=NULL;chunk=chunk->next)
+         if (chunk->nUsed<=arena->nRec/2) break;
+      if (chunk==NULL) chunk=NewChunk(arena);
+      arena->cur=chunk;
+   }
+   if (chunk->free!=NULL) {
+      rec=chunk->free;
+      chunk->free=(TBHead *) rec->chunk;
+   }
+   else {
+      rec=(TBHead *) (chunk->data+arena->size*(arena->nRec-chunk->nFresh));
+      chunk->nFresh--;
+   }
+   rec->chunk=chunk;
+   chunk->nUsed++;
+   return((void *) (rec+1));
+}
+
+/* FreeTBRec: return record to its chunk */
+static void FreeTBRec(void *p)
+{
+   TBHead *rec;
+   TBChunk *chunk;
+
+   rec=((TBHead *) p)-1;
+   chunk=rec->chunk;
+#ifdef SANITY
+   if (chunk==NULL || chunk->nUsed<=0)
+      HError(8591,"FreeTBRec: Record not allocated");
+#endif
+   rec->chunk=(TBChunk *) chunk->free;
+   chunk->free=rec;
+   chunk->nUsed--;
+}
+
+/* FreeChunk: return chunk storage to the system */
+static void FreeChunk(TBChunk *chunk)
+{
+   Dispose(&gcheap,chunk->data);
+   Dispose(&gcheap,chunk);
+}
+
+/* TrimArena: release all empty chunks apart from the current one */
+static void TrimArena(TBArena *arena)
+{
+   TBChunk *chunk,**pc;
+
+   for (pc=&arena->head;(chunk=*pc)!=NULL;) 
+      if (chunk->nUsed==0 && chunk!=arena->cur) {
+         *pc=chunk->next;
+         FreeChunk(chunk);
+      }
+      else
+         pc=&chunk->next;
+}
+
+/* ResetArena: release all records and chunks */
+static void ResetArena(TBArena *arena)
+{
+   TBChunk *chunk,*next;
+
+   for (chunk=arena->head;chunk!=NULL;chunk=next) {
+      next=chunk->next;
+      FreeChunk(chunk);
+   }
+   arena->cur=arena->head=NULL;
+}
+
 /* Move align record to (head of) YES referenced list */
 static void MoveAlignYesRef(Align *align)
 {
@@ -600,7 +742,7 @@ static Align *NewNRefAlign(NetNode *node,int state,double like,
 {
    Align *align;
 
-   align=(Align*) New(&pri->alignHeap,0);
+   align=(Align*) NewTBRec(&pri->alignArena);
    align->link=pri->aNoRef.link;
    align->knil=&pri->aNoRef;
    align->link->knil=align->knil->link=align;
@@ -635,7 +777,7 @@ static void UnlinkAlign(Align *align)
    align->node=NULL;align->prev=0;
    align->usage=0;pri->anlen--;
 #endif
-   Dispose(&pri->alignHeap,align);
+   FreeTBRec(align);
    pri->nalign--;
 }
 
@@ -838,7 +980,7 @@ static Path *NewNRefPath(void)
 {
    Path *path;
 
-   path=(Path*) New(&pri->pathHeap,0);
+   path=(Path*) NewTBRec(&pri->pathArena);
    path->link=pri->pNoRef.link;
    path->knil=&pri->pNoRef;
    path->link->knil=path->knil->link=path;
@@ -886,10 +1028,11 @@ static void DeRefPathPrev(Path *path)
 #endif
          pth->usage--;
          if (pth->usage==0) {
+            /* Add to tail so that CollectPaths frees whole chains */
             pth->link->knil=pth->knil;
             pth->knil->link=pth->link;
-            pth->link=pri->pNoRef.link;
-            pth->knil=&pri->pNoRef;
+            pth->knil=pri->pNoTail.knil;
+            pth->link=&pri->pNoTail;
             pth->link->knil=pth->knil->link=pth;
 #ifdef SANITY
             pri->pnlen++;pri->pylen--;
@@ -907,7 +1050,7 @@ static void UnlinkPath(Path *path)
    path->knil->link=path->link;
    for (pth=path->chain;pth!=NULL;pth=nth) {
       nth=pth->chain;
-      Dispose(&pri->rPthHeap,pth);
+      FreeTBRec(pth);
    }
 #ifdef SANITY
    path->link=path->knil=NULL;
@@ -917,7 +1060,7 @@ static void UnlinkPath(Path *path)
    path->chain=NULL;
    path->frame=-1;
 #endif
-   Dispose(&pri->pathHeap,path);
+   FreeTBRec(path);
    pri->npth--;
 }
 
@@ -1032,6 +1175,10 @@ static void CollectPaths(void)
       align->used=FALSE;
    }
    pri->calign=pri->nalign;
+
+   TrimArena(&pri->pathArena);
+   TrimArena(&pri->rPthArena);
+   TrimArena(&pri->alignArena);
 }
 
 static void StepWord1(NetNode *node) /* Just invalidate the tokens */
@@ -1087,7 +1234,7 @@ static void StepWord2(NetNode *node) /* Update the path - may be repeated */
 
          cur=inst->state->set+1;
          if (inst->state->n>1) {
-            rth=(NxtPath*) New(&pri->rPthHeap,0);
+            rth=(NxtPath*) NewTBRec(&pri->rPthArena);
             newpth->chain=rth;
             rth->chain=NULL;
             rth->like=newpth->like+cur->like;
@@ -1099,7 +1246,7 @@ static void StepWord2(NetNode *node) /* Update the path - may be repeated */
 	      RefAlign(cur->align);
 #endif
             for (i=2,cur++;i<inst->state->n;i++,cur++) {
-               rth->chain=(NxtPath*) New(&pri->rPthHeap,0);
+               rth->chain=(NxtPath*) NewTBRec(&pri->rPthArena);
                rth=rth->chain;
                rth->chain=NULL;
                rth->like=newpth->like+cur->like;
@@ -1827,12 +1974,9 @@ VRecInfo *InitVRecInfo(PSetInfo *psi,int nToks,Boolean models,Boolean states)
    /* Non dependent */
    CreateHeap(&pri->instHeap,"NetInst Heap",
               MHEAP,sizeof(NetInst),1.0,200,1600);
-   CreateHeap(&pri->rPthHeap,"NxtPath Heap",
-              MHEAP,sizeof(NxtPath),1.0,200,1600);
-   CreateHeap(&pri->pathHeap,"Path Heap",
-              MHEAP,sizeof(Path),1.0,200,1600);
-   CreateHeap(&pri->alignHeap,"Align Heap",
-              MHEAP,sizeof(Align),1.0,200,3200);
+   InitArena(&pri->rPthArena,sizeof(NxtPath));
+   InitArena(&pri->pathArena,sizeof(Path));
+   InitArena(&pri->alignArena,sizeof(Align));
 
 
    /* Now set up instances */
@@ -1873,9 +2017,9 @@ void DeleteVRecInfo(VRecInfo *vri)
    if (pri->nToks>1)
       DeleteHeap(&pri->rTokHeap);
    DeleteHeap(&pri->instHeap);
-   DeleteHeap(&pri->rPthHeap);
-   DeleteHeap(&pri->pathHeap);
-   DeleteHeap(&pri->alignHeap);
+   ResetArena(&pri->rPthArena);
+   ResetArena(&pri->pathArena);
+   ResetArena(&pri->alignArena);
    DeleteHeap(&vri->heap);
    Dispose(&gcheap,vri);
 }
@@ -1907,6 +2051,7 @@ void StartRecognition(VRecInfo *vri,Network *net,
    for(i=1,pre=pri->psi->mPre+1;i<=pri->psi->nmp;i++,pre++) pre->id=-1;
 
    pri->tact=pri->nact=pri->frame=0;
+   pri->commit=NULL;
 
    AttachInst(&pri->net->initial);
    inst=pri->net->initial.inst;
@@ -2015,8 +2160,10 @@ void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform
          next=pri->nxtInst->link;
       }
    
-   if ((pri->npth-pri->cpth) > vri->pCollThresh || 
-       (pri->nalign-pri->calign) > vri->aCollThresh)
+   /* Collect once the records created exceed those that survived the */
+   /*  last collection so the cost per record created stays constant */
+   if ((pri->npth-pri->cpth) > vri->pCollThresh+pri->cpth || 
+       (pri->nalign-pri->calign) > vri->aCollThresh+pri->calign)
       CollectPaths();
 
    pri->tact+=pri->nact;
@@ -2050,6 +2197,153 @@ void TracePath(FILE *file,Path *path)
    }
 }
 
+/* Partial results */
+
+/* 
+   The stable prefix is found by marking (with the used flag) the
+   path of the first active token back to the last commit and then
+   moving the stable point back until every other active token's 
+   path joins the marked chain.
+*/
+
+typedef struct {
+   Token best;          /* Most likely token */
+   Path *stable;        /* Deepest path shared by all tokens */
+   Boolean started;     /* Stable chain marked */
+   Boolean none;        /* No common path exists */
+}
+PartialInfo;
+
+/* UnmarkStable: clear marks from path back to (but excluding) end */
+static void UnmarkStable(Path *path,Path *end)
+{
+   for (;path!=NULL && path!=end;path=path->prev) {
+      path->used=FALSE;
+      if (path==pri->commit) break;
+   }
+}
+
+/* PartialToken: include token in search for best and stable paths */
+static void PartialToken(PartialInfo *pi,LogDouble like,Path *path)
+{
+   Path *p;
+
+   if (like<LSMALL) return;
+   if (like>pi->best.like) {
+      pi->best.like=like; pi->best.path=path;
+   }
+   if (pi->none) return;
+   if (!pi->started) {
+      for (p=path;p!=NULL;p=p->prev) {
+         p->used=TRUE;
+         if (p==pri->commit) break;
+      }
+      pi->stable=path; pi->started=TRUE;
+      pi->none=(path==NULL);
+      return;
+   }
+   for (p=path;p!=NULL && !p->used;p=p->prev);
+   UnmarkStable(pi->stable,p);
+   pi->stable=p;
+   pi->none=(p==NULL);
+}
+
+/* PartialTokenSet: include all tokens in set */
+static void PartialTokenSet(PartialInfo *pi,TokenSet *cur)
+{
+   int k;
+
+   if (cur->tok.like<LSMALL) return;
+   PartialToken(pi,cur->tok.like,cur->tok.path);
+   for (k=1;k<cur->n;k++)
+      PartialToken(pi,cur->tok.like+cur->set[k].like,cur->set[k].path);
+}
+
+/* CommitPath: discard history up to and including path, which is */
+/*  turned into a !NULL record that keeps its end time and likelihood */
+static void CommitPath(Path *path)
+{
+   NxtPath *pth,*nth;
+
+   DeRefPathPrev(path);
+   path->prev=NULL;
+   for (pth=path->chain;pth!=NULL;pth=nth) {
+      nth=pth->chain;
+#ifdef PHNALG
+      if (pth->align!=NULL)
+         DeRefAlign(pth->align);
+#endif
+      FreeTBRec(pth);
+   }
+   path->chain=NULL;
+   if (path->align!=NULL)
+      DeRefAlign(path->align);
+   path->align=NULL;
+   path->node=&pri->net->initial;
+   path->lm=0.0;
+   pri->commit=path;
+}
+
+/* EXPORT->PartialRecognition: Return current best partial transcription */
+Transcription *PartialRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap,
+                                  Boolean commit,int *nStable)
+{
+   Transcription *trans;
+   LabList *ll;
+   LLink lab,where;
+   NetInst *inst;
+   TokenSet *cur;
+   PartialInfo pi;
+   Path *path,*prev;
+   Boolean isStable;
+   int i,n;
+
+   pri=vri->pri;
+   if (pri==NULL)
+      HError(8570,"PartialRecognition: Visible recognition info not initialised");
+   if (pri->net==NULL)
+      HError(8570,"PartialRecognition: Recognition not started");
+
+   pi.best=null_token; pi.stable=NULL;
+   pi.started=pi.none=FALSE;
+   for (inst=pri->head.link;inst!=NULL;inst=inst->link)
+      if (inst->node!=NULL) {
+         if (node_hmm(inst->node)) 
+            n=inst->node->info.hmm->numStates-1;
+         else
+            n=1;
+         for (i=1,cur=inst->state;i<=n;i++,cur++)
+            PartialTokenSet(&pi,cur);
+         PartialTokenSet(&pi,inst->exit);
+      }
+   UnmarkStable(pi.stable,NULL);
+   if (pi.none || pi.stable==pri->commit) pi.stable=NULL;
+
+   /* Labels from best path back to the last commit */
+   trans=CreateTranscription(heap);
+   ll=CreateLabelList(heap,0);
+   AddLabelList(ll,trans);
+   *nStable=0; isStable=FALSE;
+   for (path=pi.best.path;path!=NULL && path!=pri->commit;path=prev) {
+      prev=path->prev;
+      if (path==pi.stable) isStable=TRUE;
+      if (path->node->info.pron==NULL) continue;
+      lab=CreateLabel(heap,ll->maxAuxLab);
+      lab->labid=path->node->info.pron->word->wordName;
+      lab->start=(prev==NULL?0.0:prev->frame*frameDur*1.0E7);
+      lab->end=path->frame*frameDur*1.0E7;
+      lab->score=path->like-(prev==NULL?0.0:prev->like);
+      where=ll->head->succ;
+      lab->pred=where->pred;lab->succ=where;
+      lab->succ->pred=lab->pred->succ=lab;
+      if (isStable) (*nStable)++;
+   }
+
+   if (commit && pi.stable!=NULL)
+      CommitPath(pi.stable);
+   return(trans);
+}
+
 /* EXPORT->CompleteRecognition: Free unused data and return traceback */
 Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap)
 {
@@ -2099,6 +2393,7 @@ Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap)
    pri->npth=pri->cpth=0;
    pri->nalign=pri->calign=0;
    pri->nact=pri->frame=0;
+   pri->commit=NULL;
 
    pri->pYesRef.link=&pri->pYesTail;pri->pYesTail.knil=&pri->pYesRef;
    pri->pNoRef.link=&pri->pNoTail;pri->pNoTail.knil=&pri->pNoRef;
@@ -2121,9 +2416,9 @@ Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap)
    for (i=0;i<pri->psi->stHeapNum;i++)
       ResetHeap(pri->stHeap+i);
 
-   ResetHeap(&pri->alignHeap);
-   ResetHeap(&pri->rPthHeap);
-   ResetHeap(&pri->pathHeap);
+   ResetArena(&pri->alignArena);
+   ResetArena(&pri->rPthArena);
+   ResetArena(&pri->pathArena);
    
    return(lat);
 }
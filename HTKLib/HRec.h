@@ -190,6 +190,20 @@ Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap);
    Create lattice with traceback and then free recognition data
 */
 
+Transcription *PartialRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap,
+                                  Boolean commit,int *nStable);
+/*
+   Return the best partial transcription for the observations
+   processed so far.  The first *nStable labels are shared by the
+   traceback of every active token and so will not change.  If commit
+   is TRUE the traceback before the end of these labels is discarded
+   so that it can be freed by the path garbage collection.  Committed
+   labels are not returned again and the lattice produced by 
+   CompleteRecognition starts with a !NULL arc up to the end of the
+   last committed word, so the committed words must be kept by the
+   caller.
+*/
+
 void SetPruningLevels(VRecInfo *vri,int maxBeam,LogFloat genBeam,
 		      LogFloat wordBeam,LogFloat nBeam,LogFloat tmBeam);
 /*
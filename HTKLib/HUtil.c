@@ -624,6 +624,11 @@ static char pattern[PAT_LEN];  /* A copy of the last pattern parsed */
 static char *position;         /*  and the current position in copy */
 static int maxStates;          /*  and its max number of states */
 static int maxMixes;           /*  and max number of mix comps */
+static char *strSrc = NULL;    /* item list text being parsed, if not source */
+static Boolean matchItems = TRUE; /* match hmm idents against hmm set */
+static char *scanBuf = NULL;   /* full text of item list being scanned */
+static int scanLen = 0;        /*  its length */
+static int scanSize = 0;       /*  and allocated size */
 
 /* EdError: report a syntax error in input command */
 static void EdError(char *s)
@@ -643,9 +648,23 @@ static void EdError(char *s)
 /* ReadCh: get next character from f into ch */
 static void ReadCh(void)
 {
-   ch = GetCh(source);
+   char *buf;
+
+   if (strSrc != NULL)
+      ch = (*strSrc != '\0') ? (unsigned char) *strSrc++ : EOF;
+   else
+      ch = GetCh(source);
    if (position < (pattern+PAT_LEN-1))
       *position++ = ch, *position = 0;
+   if (!matchItems && ch != EOF) {  /* keep full text when scanning */
+      if (scanLen+2 > scanSize) {
+         buf = (char *) New(&gcheap,2*scanSize);
+         memcpy(buf,scanBuf,scanLen);
+         Dispose(&gcheap,scanBuf);
+         scanBuf = buf; scanSize *= 2;
+      }
+      scanBuf[scanLen++] = ch; scanBuf[scanLen] = '\0';
+   }
 }
 
 /* SkipSpaces: skip white space */
@@ -1009,6 +1028,7 @@ static void PHIdent(ILink *models, HMMSet *hset)
    
    SkipSpaces();
    GetAlpha(pattern);
+   if (!matchItems) return;
    p = pattern; h=0;
    while ((*p != '\0') && (h<MAXSTRLEN) && (fullName)) {
      if ((*p=='*')||(*p=='?')||(*p=='%')) fullName=FALSE;
@@ -1096,9 +1116,9 @@ static void PItemSet(ILink *ilist, char *type, HMMSet *hset)
    }
 }
 
-/* EXPORT->PItemList: parse items in item list setting ilist and type */
-char *PItemList(ILink *ilist, char *type, HMMSet *hset,
-                Source *s, Boolean itrace)
+/* ParseItemList: parse item list from source or strSrc */
+static char *ParseItemList(ILink *ilist, char *type, HMMSet *hset,
+                           Boolean itrace)
 {
    int rtrace;
 
@@ -1106,7 +1126,6 @@ char *PItemList(ILink *ilist, char *type, HMMSet *hset,
    rtrace=trace;
    if (itrace)
       trace|=T_ITM;
-   source = s;
    maxMixes = MaxMixInSet(hset);
    maxStates = MaxStatesInSet(hset);
    position=pattern;
@@ -1135,6 +1154,46 @@ char *PItemList(ILink *ilist, char *type, HMMSet *hset,
    return(pattern);
 }
 
+/* EXPORT->PItemList: parse items in item list setting ilist and type */
+char *PItemList(ILink *ilist, char *type, HMMSet *hset,
+                Source *s, Boolean itrace)
+{
+   source = s; strSrc = NULL;
+   return ParseItemList(ilist,type,hset,itrace);
+}
+
+/* EXPORT->PItemListText: as PItemList but parse the given text */
+char *PItemListText(ILink *ilist, char *type, HMMSet *hset,
+                    char *text, Boolean itrace)
+{
+   char *pat;
+
+   strSrc = text;
+   pat = ParseItemList(ilist,type,hset,itrace);
+   strSrc = NULL;
+   return pat;
+}
+
+/* EXPORT->ScanItemList: parse item list in s without matching */
+char *ScanItemList(HMMSet *hset, Source *s, char **text)
+{
+   ILink ilist = NULL;
+   char type = ' ';
+   int rtrace;
+
+   if (scanBuf == NULL) {
+      scanSize = PAT_LEN;
+      scanBuf = (char *) New(&gcheap,scanSize);
+   }
+   scanLen = 0; scanBuf[0] = '\0';
+   source = s; strSrc = NULL; matchItems = FALSE;
+   rtrace = trace; trace = 0;
+   ParseItemList(&ilist,&type,hset,FALSE);
+   trace = rtrace; matchItems = TRUE;
+   *text = scanBuf;
+   return pattern;
+}
+
 /* ------------------- Generic macro handling ----------------- */
 
 /* EXPORT->GetMacroHook: Return value of hook field for any macro */
@@ -248,6 +248,19 @@ char *PItemList(ILink *ilist, char *type, HMMSet *h,
    If itrace is true enable tracing whilst producing this list.
 */
 
+char *PItemListText(ILink *ilist, char *type, HMMSet *h,
+                    char *text, Boolean itrace);
+/*
+   As PItemList but parse the item list held in text.
+*/
+
+char *ScanItemList(HMMSet *h, Source *s, char **text);
+/*
+   Parse the item list in source s without matching any items.
+   Returns the same pattern as PItemList and sets text to the full
+   text of the item list, which remains valid until the next call.
+*/
+
 /* ------------------- Generic macro handling ----------------- */
 
 /*
@@ -138,6 +138,9 @@ static char tiedMixName[MAXSTRLEN] = "TM"; /* Tied mixture base name */
 static char mmfIdMask[MAXSTRLEN] = "*"; /* MMF Id Mask for baseclass */
 static Boolean useLeafStats = TRUE; /* Use leaf stats to init macros */
 static Boolean applyVFloor = TRUE; /* apply modfied varFloors to vars in model set */ 
+static Boolean useMDL = FALSE;   /* Use MDL criterion to stop tree splitting */
+static double mdlFactor = 1.0;   /* Scale factor for MDL penalty */
+static char qsCache[MAXFNAMELEN] = ""; /* Compiled question cache file */
 
 /* ------------------ Process Command Line -------------------------- */
 
@@ -145,6 +148,7 @@ void SetConfParms(void)
 {
    Boolean b;
    int i;
+   double d;
 
    nParm = GetConfig("HHED", TRUE, cParm, MAXGLOBS);
    if (nParm>0) {
@@ -153,8 +157,11 @@ void SetConfParms(void)
       if (GetConfBool(cParm,nParm,"USELEAFSTATS",&b)) useLeafStats = b;
       if (GetConfBool(cParm,nParm,"APPLYVFLOOR",&b)) applyVFloor = b;
       if (GetConfBool(cParm,nParm,"USEMODELNAME",&b)) useModelName = b;
+      if (GetConfBool(cParm,nParm,"USEMDL",&b)) useMDL = b;
+      if (GetConfFlt(cParm,nParm,"MDLFACTOR",&d)) mdlFactor = d;
       GetConfStr(cParm,nParm,"TIEDMIXNAME",tiedMixName);
       GetConfStr(cParm,nParm,"MMFIDMASK",mmfIdMask);
+      GetConfStr(cParm,nParm,"QSCACHE",qsCache);
    }
 }
 
@@ -357,6 +364,8 @@ typedef struct _QEnt{           /* each question stored as both pattern and  */
    LabId qName;                 /* an expanded list of model names */
    IPat *patList;               
    ILink ilist;
+   int idx;                     /* position in question list */
+   struct _QCEnt *qc;           /* cache entry (QSCACHE only) */
    QLink next;
 }QEnt;
 
@@ -413,27 +422,12 @@ char *ParseAlpha(char *src, char *s)
    return NULL;
 }
 
-/* LoadQuestion: store given question in question list */
-void LoadQuestion(char *qName, ILink ilist, char *pattern)
+/* ParsePatList: return list of model patterns in item list pattern */
+IPat *ParsePatList(char *pattern)
 {
-   QLink q,c;
-   LabId labid;
-   IPat *ip;
+   IPat *ip,*patList=NULL;
    char *p,*r,buf[MAXSTRLEN];
-   
-   q=(QLink) New(&questHeap,sizeof(QEnt));
-   q->ilist=ilist;
-   labid=GetLabId(qName,TRUE);
-   for (c=qHead;c!=NULL;c=c->next) if (c->qName==labid) break;
-   if (c!=NULL)
-      HError(2661,"LoadQuestion: Question name %s invalid",qName);
-   q->qName=labid; labid->aux=q;
-   q->next = NULL; q->patList = NULL;
-   if (qHead==NULL) {
-      qHead = q; qTail = q;
-   } else {
-      qTail->next = q; qTail = q;
-   }
+
    for (p=pattern;*p && isspace((int) *p);p++);
    if (*p!='{')
       if (p==NULL) HError(2660,"LoadQuestion: no { in itemlist");
@@ -450,8 +444,33 @@ void LoadQuestion(char *qName, ILink ilist, char *pattern)
       ip=(IPat*) New(&questHeap,sizeof(IPat));
       ip->pat = NewString(&questHeap,strlen(buf));
       strcpy(ip->pat,buf);
-      ip->next = q->patList; q->patList = ip;
+      ip->next = patList; patList = ip;
    } while (p<r);
+   return patList;
+}
+
+/* LoadQuestion: store given question in question list */
+void LoadQuestion(char *qName, ILink ilist, char *pattern)
+{
+   QLink q,c;
+   LabId labid;
+   
+   q=(QLink) New(&questHeap,sizeof(QEnt));
+   q->ilist=ilist;
+   labid=GetLabId(qName,TRUE);
+   for (c=qHead;c!=NULL;c=c->next) if (c->qName==labid) break;
+   if (c!=NULL)
+      HError(2661,"LoadQuestion: Question name %s invalid",qName);
+   q->qName=labid; labid->aux=q;
+   q->next = NULL; q->patList = NULL;
+   q->qc = NULL;
+   q->idx = (qTail==NULL) ? 0 : qTail->idx+1;
+   if (qHead==NULL) {
+      qHead = q; qTail = q;
+   } else {
+      qTail->next = q; qTail = q;
+   }
+   q->patList = ParsePatList(pattern);
 }
 
 /* QMatch: return true if given name matches question */
@@ -464,6 +483,221 @@ Boolean QMatch(char *name, QLink q)
    return FALSE;
 }
 
+/* -------------------- Compiled Question Cache ----------------------- */
+
+/* When QSCACHE is set, the models each question refers to are saved
+   so that later runs with the same hmm list and question definitions
+   can skip matching the item list against every model name.  The
+   cache is a text file holding a header line
+      QSCACHE numPhysHMM signature
+   followed by one line per question
+      QS name itemlist n i1 ... in
+   where i1 ... in index the physical hmms in the order in which they
+   are held in the macro table.  The signature is a hash of the logical
+   hmm names and the physical hmms they map to */
+
+#define QTEXTLEN 16384          /* max length of cached item list text */
+
+typedef struct _QCEnt {         /* cached question */
+   char *qName;                 /* question name */
+   char *text;                  /* item list text as given to QS */
+   int nItems;                  /* number of items in ilist */
+   int *items;                  /* physical hmm index of each item */
+   struct _QCEnt *next;         /* next in hash chain */
+}QCEnt;
+
+static QCEnt **qcTab = NULL;    /* cache entries hashed by question name */
+static int qcTabSize = 0;       /* size of qcTab, a power of 2 */
+static int qcNum = 0;           /* number of entries in qcTab */
+static Boolean qcLoaded = FALSE;/* set once cache file has been read */
+static Boolean qcDirty = FALSE; /* set if any question matched */
+static unsigned long qcSig;     /* hmmSig when cache was loaded */
+static int qcNumPhys;           /* nPhysHMM when cache was loaded */
+
+static Boolean hmmIdxValid = FALSE; /* physHMM and hmmSig are current */
+static HLink *physHMM = NULL;   /* physical hmms in macro table order */
+static int nPhysHMM = 0;        /* number of entries in physHMM */
+static HLink *phTab = NULL;     /* open addressed hash of physHMM */
+static int *phIdx = NULL;       /*  and the index of each entry */
+static int phTabSize = 0;       /* size of phTab, a power of 2 */
+static unsigned long hmmSig;    /* signature of logical to physical map */
+
+/* QCStrHash: hash string s */
+static unsigned long QCStrHash(char *s)
+{
+   unsigned long h = 0;
+
+   for (; *s; s++)
+      h = (h*31 + (unsigned char)*s) & 0xffffffffUL;
+   return h;
+}
+
+/* PhysSlot: return slot of physical hmm hmm in phTab */
+static int PhysSlot(HLink hmm)
+{
+   int i;
+
+   i = (int) ((((unsigned long) hmm) >> 3) & (phTabSize-1));
+   while (phTab[i]!=NULL && phTab[i]!=hmm)
+      i = (i+1) & (phTabSize-1);
+   return i;
+}
+
+/* InitHMMIndex: index the physical hmms of hset and compute hmmSig,
+   this is only repeated once the hmm set has been edited */
+static void InitHMMIndex(void)
+{
+   MLink m;
+   int h,i,n;
+
+   if (hmmIdxValid) return;
+   n = 0;
+   for (h=0; h<MACHASHSIZE; h++)
+      for (m=hset->mtab[h]; m!=NULL; m=m->next)
+         if (m->type=='h') n++;
+   if (physHMM==NULL || n>nPhysHMM) {
+      physHMM = (HLink*) New(&questHeap,n*sizeof(HLink));
+      for (phTabSize=64; phTabSize<2*n; phTabSize*=2);
+      phTab = (HLink*) New(&questHeap,phTabSize*sizeof(HLink));
+      phIdx = (int*) New(&questHeap,phTabSize*sizeof(int));
+   }
+   for (i=0; i<phTabSize; i++) phTab[i] = NULL;
+   nPhysHMM = 0;
+   for (h=0; h<MACHASHSIZE; h++)
+      for (m=hset->mtab[h]; m!=NULL; m=m->next)
+         if (m->type=='h') {
+            i = PhysSlot((HLink) m->structure);
+            phTab[i] = (HLink) m->structure; phIdx[i] = nPhysHMM;
+            physHMM[nPhysHMM++] = (HLink) m->structure;
+         }
+   hmmSig = nPhysHMM;
+   for (h=0; h<MACHASHSIZE; h++)
+      for (m=hset->mtab[h]; m!=NULL; m=m->next)
+         if (m->type=='l') {
+            hmmSig = (hmmSig*31 + QCStrHash(m->id->name)) & 0xffffffffUL;
+            hmmSig = (hmmSig*31 + phIdx[PhysSlot((HLink) m->structure)])
+               & 0xffffffffUL;
+         }
+   hmmIdxValid = TRUE;
+}
+
+/* FindQCEnt: return cache entry for question qName, if create is
+   TRUE a new empty entry is added if none exists */
+static QCEnt *FindQCEnt(char *qName, Boolean create)
+{
+   QCEnt *qc,*next,**tab;
+   int i,size;
+
+   if (qcTab!=NULL) {
+      i = (int) (QCStrHash(qName) & (qcTabSize-1));
+      for (qc=qcTab[i]; qc!=NULL; qc=qc->next)
+         if (strcmp(qc->qName,qName)==0) return qc;
+   }
+   if (!create) return NULL;
+   if (qcNum >= qcTabSize) {    /* double size of table */
+      size = (qcTabSize==0) ? 256 : 2*qcTabSize;
+      tab = (QCEnt**) New(&questHeap,size*sizeof(QCEnt*));
+      for (i=0; i<size; i++) tab[i] = NULL;
+      for (i=0; i<qcTabSize; i++)
+         for (qc=qcTab[i]; qc!=NULL; qc=next) {
+            next = qc->next;
+            qc->next = tab[QCStrHash(qc->qName) & (size-1)];
+            tab[QCStrHash(qc->qName) & (size-1)] = qc;
+         }
+      qcTab = tab; qcTabSize = size;
+   }
+   qc = (QCEnt*) New(&questHeap,sizeof(QCEnt));
+   qc->qName = CopyString(&questHeap,qName);
+   qc->text = NULL; qc->nItems = 0; qc->items = NULL;
+   i = (int) (QCStrHash(qName) & (qcTabSize-1));
+   qc->next = qcTab[i]; qcTab[i] = qc;
+   qcNum++;
+   return qc;
+}
+
+/* LoadQuestionCache: load cached questions from file fn, the
+   cache is ignored if it was made for a different hmm list */
+static void LoadQuestionCache(char *fn)
+{
+   Source src;
+   QCEnt *qc;
+   char buf[MAXSTRLEN], text[QTEXTLEN];
+   int i, n;
+   unsigned long sig;
+
+   if (InitSource(fn,&src,NoFilter)<SUCCESS)
+      return;                   /* no cache yet */
+   if (!ReadString(&src,buf) || strcmp(buf,"QSCACHE")!=0 ||
+       !ReadInt(&src,&n,1,FALSE) || !ReadString(&src,buf))
+      HError(2614,"LoadQuestionCache: bad header in %s",fn);
+   sig = strtoul(buf,NULL,10);
+   if (n!=nPhysHMM || sig!=hmmSig) {
+      HError(-2614,"LoadQuestionCache: %s made for different hmm list",fn);
+      CloseSource(&src);
+      return;
+   }
+   while (ReadString(&src,buf)) {
+      if (strcmp(buf,"QS")!=0 || !ReadString(&src,buf) ||
+          !ReadStringWithLen(&src,text,QTEXTLEN) ||
+          !ReadInt(&src,&n,1,FALSE) || n<0)
+         HError(2614,"LoadQuestionCache: bad entry in %s",fn);
+      qc = FindQCEnt(buf,TRUE);
+      qc->text = CopyString(&questHeap,text);
+      qc->nItems = n;
+      qc->items = (int*) New(&questHeap,(n+1)*sizeof(int));
+      if (n>0 && !ReadInt(&src,qc->items,n,FALSE))
+         HError(2614,"LoadQuestionCache: bad entry for %s in %s",
+                qc->qName,fn);
+      for (i=0; i<n; i++)
+         if (qc->items[i]<0 || qc->items[i]>=nPhysHMM)
+            HError(2614,"LoadQuestionCache: bad hmm index for %s in %s",
+                   qc->qName,fn);
+   }
+   CloseSource(&src);
+}
+
+/* SaveQuestionCache: write cached questions to file fn */
+static void SaveQuestionCache(char *fn)
+{
+   FILE *f;
+   QLink q;
+   Boolean isPipe;
+   char buf[4*QTEXTLEN];
+   int i;
+
+   if ((f=FOpen(fn,NoOFilter,&isPipe))==NULL)
+      HError(2612,"SaveQuestionCache: cannot create %s",fn);
+   fprintf(f,"QSCACHE %d %lu\n",qcNumPhys,qcSig);
+   for (q=qHead; q!=NULL; q=q->next) {
+      if (q->qc==NULL || strlen(q->qc->text)>=QTEXTLEN) continue;
+      fprintf(f,"QS %s",ReWriteString(q->qName->name,NULL,DBL_QUOTE));
+      fprintf(f," %s %d",ReWriteString(q->qc->text,buf,DBL_QUOTE),
+              q->qc->nItems);
+      for (i=0; i<q->qc->nItems; i++)
+         fprintf(f," %d",q->qc->items[i]);
+      fprintf(f,"\n");
+   }
+   FClose(f,isPipe);
+}
+
+/* CacheQuestion: record the items of ilist in the cache entry for
+   question qName with item list text */
+static QCEnt *CacheQuestion(char *qName, char *text, ILink ilist)
+{
+   QCEnt *qc;
+   ILink p;
+   int i;
+
+   qc = FindQCEnt(qName,TRUE);
+   qc->text = text;
+   qc->nItems = NumItems(ilist);
+   qc->items = (int*) New(&questHeap,(qc->nItems+1)*sizeof(int));
+   for (p=ilist,i=0; p!=NULL; p=p->next,i++)
+      qc->items[i] = phIdx[PhysSlot(p->owner)];
+   qcDirty = TRUE;
+   return qc;
+}
+
 /* ----------------------- HMM Management ---------------------- */
 
 typedef enum { baseNorm=0, baseLeft, baseRight, baseMono } baseType;
@@ -2407,6 +2641,7 @@ typedef struct _Node {          /* Tree Node */
    struct _Node *no;            /* no subtree */
    struct _Node *next;          /* doubly linked chain of */
    struct _Node *prev;          /* leaf nodes */
+   double *stats;               /* total statistics while building */
 }Node;
 
 typedef struct _Tree{           /* A tree */
@@ -2418,8 +2653,26 @@ typedef struct _Tree{           /* A tree */
    struct _Tree *next;          /* next tree in list */
 }Tree;
 
+typedef unsigned long BitWord;  /* word of a cluster item bitset */
+#define BITWORD (8*sizeof(BitWord))
+
+typedef struct _TreeAccs {      /* Per item statistics for tree building */
+   int nItems;                  /* number of cluster items (CRec idx 1..) */
+   int nSlice;                  /* states per item (1 unless hmm trees) */
+   int vSize;                   /* vector size */
+   float *occ;                  /* [nSlice][nItems+1] occupation counts */
+   float *sum;                  /* [nSlice][nItems+1][vSize] sums */
+   float *sqr;                  /* [nSlice][nItems+1][vSize] sqrs */
+   int sSize;                   /* node stats per slice: n,occ,sum,sqr */
+   double *yStats;              /* scratch node stats for yes branch */
+   int nWords;                  /* BitWords per item bitset */
+   BitWord *qBits;              /* [nQuest][nWords] question answers */
+   BitWord *nBits;              /* items of node being evaluated */
+} TreeAccs;
+
 static Tree *treeList = NULL;   /* list of trees */
 static AccSum yes,no;           /* global accs for yes - no branches */
+static TreeAccs tAccs;          /* item statistics for current tree */
 static float occs[2];           /* array[Boolean]of occupation counts */
 static float  cprob;            /* complete likelihood at current node */
 static int numTreeClust;        /* number of clusters in tree */
@@ -2495,6 +2748,7 @@ Node *CreateTreeNode(CLink clist, Node *parent)
    n->macro = NULL;
    n->quest = NULL;
    n->snum = -1;
+   n->stats = NULL;
    return n;
 }
 
@@ -2588,93 +2842,176 @@ float AccSumProb(AccSum *acc)
    return(prob);
 }
 
-/* IncSumSqr: add sums and sqrs from given state into yes or no depending
-   on value of ans */
-void IncSumSqr(StateInfo *si, Boolean ans, AccSum *no, AccSum *yes, int l)
+/* InitItemAccs: allocate tAccs for n items of ilist and copy in the
+   statistics attached to each item's MixPDF hook by InitTreeAccs, so
+   that each item state has its occ, sum and sqr in contiguous storage */
+void InitItemAccs(ILink ilist, int n, int l)
 {
-   AccSum *acc,*tacc;
-   int k;
+   ILink p;
+   AccSum *acc;
+   StateElem *se;
+   float *sum,*sqr;
+   int i,j,k,N,nSlice;
+
+   N = ilist->owner->numStates;
+   nSlice = (ilist->item == ilist->owner) ? N-2 : 1;
+   tAccs.nItems = n; tAccs.nSlice = nSlice; tAccs.vSize = l;
+   tAccs.occ = (float*) New(&tmpHeap,nSlice*(n+1)*sizeof(float));
+   tAccs.sum = (float*) New(&tmpHeap,nSlice*(n+1)*l*sizeof(float));
+   tAccs.sqr = (float*) New(&tmpHeap,nSlice*(n+1)*l*sizeof(float));
+   for (i=1,p=ilist; p!=NULL; p=p->next,i++)
+      for (j=0; j<nSlice; j++) {
+         se = (nSlice>1) ? p->owner->svec+j+2 : (StateElem*)p->item;
+         acc = (AccSum *) se->info->pdf[1].spdf.cpdf[1].mpdf->hook;
+         sum = tAccs.sum+(j*(n+1)+i)*l; sqr = tAccs.sqr+(j*(n+1)+i)*l;
+         if (acc==NULL) {
+            tAccs.occ[j*(n+1)+i] = 0.0;
+            for (k=0;k<l;k++) sum[k] = sqr[k] = 0.0;
+         }
+         else {
+            tAccs.occ[j*(n+1)+i] = acc->occ;
+            for (k=0;k<l;k++) {
+               sum[k] = acc->sum[k+1]; sqr[k] = acc->sqr[k+1];
+            }
+         }
+      }
+}
+
+/* IncItemSumSqr: add sums and sqrs of state slice j of item idx into acc */
+void IncItemSumSqr(int idx, int j, AccSum *acc)
+{
+   float *sum,*sqr,*asum,*asqr;
+   int k,l,o;
    
-   acc = (AccSum *) si->pdf[1].spdf.cpdf[1].mpdf->hook;
-   if (!acc) return;
-   tacc =  (ans && yes != NULL) ? yes : no;
-   tacc->occ+=acc->occ;
-   for (k=1;k<=l;k++) {
-      tacc->sum[k] += acc->sum[k];
-      tacc->sqr[k] += acc->sqr[k];
+   l = tAccs.vSize; o = j*(tAccs.nItems+1)+idx;
+   if (tAccs.occ[o]<=0.0) return;
+   sum = tAccs.sum+o*l; sqr = tAccs.sqr+o*l;
+   asum = acc->sum+1; asqr = acc->sqr+1;
+   acc->occ += tAccs.occ[o];
+   for (k=0;k<l;k++) {
+      asum[k] += sum[k];
+      asqr[k] += sqr[k];
    }   
 }
 
-/* ClusterLogL: return log likelihood of given cluster, this is used for both
-   the complete and split clusters.  In the former case, the yes accumulator
-   will be NULL and only the no accumulator is used */
-float ClusterLogL(CLink clist,AccSum *no,AccSum *yes,float *occs)
+/* ZeroNodeStats: zero node statistics st */
+void ZeroNodeStats(double *st)
 {
-   CLink p;
-   float prob;
-   StateElem *se;
-   int l,i;
-
-   l=VectorSize(no->sum);
-   if (clist->item->item == clist->item->owner) {
-      prob=0.0;
-      occs[FALSE]=0.0;occs[TRUE]=0.0;
-      for (i=2;i<clist->item->owner->numStates;i++) {
-         ZeroAccSum(no);
-         if (yes != NULL) ZeroAccSum(yes);
-         for(p=clist;p!=NULL;p=p->next) {
-            IncSumSqr(p->item->owner->svec[i].info,p->ans,no,yes,l);
-         }
-         prob += AccSumProb(no);
-         if (yes != NULL) prob += AccSumProb(yes);
-         if (occs != NULL) {
-            occs[FALSE] += no->occ;
-            if (yes != NULL)
-               occs[TRUE] += yes->occ;
-         }
+   int i,n;
+
+   n = tAccs.nSlice*tAccs.sSize;
+   for (i=0;i<n;i++) st[i] = 0.0;
+}
+
+/* NewNodeStats: return zeroed node statistics covering all slices */
+double *NewNodeStats(void)
+{
+   double *st;
+
+   st = (double*) New(&tmpHeap,tAccs.nSlice*tAccs.sSize*sizeof(double));
+   ZeroNodeStats(st);
+   return st;
+}
+
+/* AddItemStats: add all slices of item idx to node statistics st.
+   Each slice holds a count of items with non-zero occupancy, the
+   occupancy itself and then the sums and sqrs */
+void AddItemStats(double *st, int idx)
+{
+   float *sum,*sqr;
+   double *s;
+   int j,k,l,o;
+   
+   l = tAccs.vSize;
+   for (j=0,s=st; j<tAccs.nSlice; j++,s+=tAccs.sSize) {
+      o = j*(tAccs.nItems+1)+idx;
+      if (tAccs.occ[o]<=0.0) continue;
+      sum = tAccs.sum+o*l; sqr = tAccs.sqr+o*l;
+      s[0] += 1.0; s[1] += tAccs.occ[o];
+      for (k=0;k<l;k++) {
+         s[2+k] += sum[k];
+         s[2+l+k] += sqr[k];
       }
    }
-   else {
-      ZeroAccSum(no);
-      if (yes != NULL) ZeroAccSum(yes);
-      for(p=clist;p!=NULL;p=p->next) {
-         se=(StateElem*)p->item->item;
-         IncSumSqr(se->info,p->ans,no,yes,l);
-      }
-      prob = AccSumProb(no);
-      if (yes != NULL) prob += AccSumProb(yes);
-      if (occs != NULL) {
-         occs[FALSE] = no->occ;
-         occs[TRUE] = (yes != NULL) ? yes->occ : 0.0;
+}
+
+/* AddNodeStats: add (sign>0) or subtract (sign<0) src to/from dst */
+void AddNodeStats(double *dst, double *src, int sign)
+{
+   int i,n;
+
+   n = tAccs.nSlice*tAccs.sSize;
+   if (sign>0)
+      for (i=0;i<n;i++) dst[i] += src[i];
+   else
+      for (i=0;i<n;i++) dst[i] -= src[i];
+}
+
+/* StatsLogL: return log likelihood of node statistics st less those
+   in sub (if not NULL), the remaining occupancy is stored in occ.
+   Subtracting the yes statistics from the node total in this way
+   gives the no statistics without a pass over the cluster items */
+float StatsLogL(double *st, double *sub, float *occ)
+{
+   double *s,*u,n,x,sum,sqr,variance,prob,sprob;
+   int j,k,l;
+
+   l = tAccs.vSize;
+   prob = 0.0; *occ = 0.0;
+   for (j=0; j<tAccs.nSlice; j++) {
+      s = st+j*tAccs.sSize;
+      u = (sub!=NULL) ? sub+j*tAccs.sSize : NULL;
+      n = (u!=NULL) ? s[0]-u[0] : s[0];
+      if (n<0.5) continue;      /* no items with data in this slice */
+      x = (u!=NULL) ? s[1]-u[1] : s[1];
+      *occ += x; sprob = 0.0;
+      for (k=2;k<2+l;k++) {
+         sum = (u!=NULL) ? s[k]-u[k] : s[k];
+         sqr = (u!=NULL) ? s[k+l]-u[k+l] : s[k+l];
+         variance=(sqr-(sum*sum/x))/x;
+         if (variance<=MINLARG) {
+            sprob = LZERO; break;
+         }
+         sprob+=-0.5*x*(1.0+log(TPI*variance));
       }
+      prob += sprob;
    }
    return(prob);
 }
 
-/* AnswerQuestion: set ans field in each cluster item in preparation for
-   a possible split */
-void AnswerQuestion(CLink clist,QLink q)
+/* StatsCount: return number of item slices with data in st */
+int StatsCount(double *st)
 {
-   CLink p;
-   ILink i;
-  
-   for (p=clist;p!=NULL;p=p->next) 
-      p->ans = FALSE;
-   if (q!=NULL)
-      for (i=q->ilist;i!=NULL;i=i->next)
-         if ((p=(CLink) i->item)!=NULL)
-            p->ans=TRUE;
+   int j,n;
+
+   for (j=0,n=0; j<tAccs.nSlice; j++)
+      n += (int) st[j*tAccs.sSize];
+   return n;
+}
+
+/* BitCount: return number of bits set in x */
+int BitCount(BitWord x)
+{
+   int n;
+
+   for (n=0; x!=0; x&=x-1) n++;
+   return n;
 }
 
 /* ValidProbNode: set tProb and sProb of given node according to best
-   possible question which is stored in quest field.  */
+   possible question which is stored in quest field.  Only the yes
+   statistics are accumulated for each question, the no statistics
+   are the cached node total less the yes statistics */
 void ValidProbNode(Node *node,float thresh)
 {
    QLink q,qbest;
+   CLink p;
+   BitWord *qb,*nb,x;
+   double *ys;
    float best,sProb;
+   int i,w,wLo,wHi,nYes,nAll,nItems;
    
-   node->tProb = ClusterLogL(node->clist,&no,NULL,occs);
-   node->occ = occs[FALSE];
+   node->tProb = StatsLogL(node->stats,NULL,&node->occ);
    if (trace & T_TREE_BESTQ) {
       char buf[20];
       if (node->parent==NULL)
@@ -2689,9 +3026,38 @@ void ValidProbNode(Node *node,float thresh)
    }
    qbest = NULL;
    best = node->tProb;
+   ys = tAccs.yStats; nAll = StatsCount(node->stats);
+   nb = tAccs.nBits; wLo = tAccs.nWords; wHi = -1; nItems = 0;
+   for (w=0;w<tAccs.nWords;w++) nb[w] = 0;
+   for (p=node->clist;p!=NULL;p=p->next,nItems++) {
+      w = p->idx/BITWORD;
+      nb[w] |= (BitWord)1 << (p->idx%BITWORD);
+      if (w<wLo) wLo = w;
+      if (w>wHi) wHi = w;
+   }
    for (q=qHead;q!=NULL;q=q->next) {
-      AnswerQuestion(node->clist,q);
-      sProb = ClusterLogL(node->clist,&no,&yes,occs);
+      /* count items answering yes before touching any statistics */
+      qb = tAccs.qBits+q->idx*tAccs.nWords;
+      for (w=wLo,nYes=0;w<=wHi;w++)
+         nYes += BitCount(qb[w]&nb[w]);
+      if (nYes>0 && nYes<nItems) {
+         ZeroNodeStats(ys);
+         for (w=wLo;w<=wHi;w++)
+            for (x=qb[w]&nb[w],i=w*BITWORD; x!=0; x>>=1,i++)
+               if (x&1) AddItemStats(ys,i);
+         nYes = StatsCount(ys);
+      }
+      else if (nYes>0)
+         nYes = nAll;
+      if (nYes==0 || nYes==nAll) { 
+         /* question does not split the data at this node */
+         sProb=node->tProb;
+         occs[TRUE] = (nYes==0) ? 0.0 : node->occ;
+         occs[FALSE] = node->occ - occs[TRUE];
+      }
+      else
+         sProb = StatsLogL(ys,NULL,occs+TRUE) + 
+            StatsLogL(node->stats,ys,occs+FALSE);
       if (node->occ<=0.0 || (outlierThresh >= 0.0 &&  
                              (occs[FALSE]<outlierThresh || occs[TRUE]<outlierThresh)))
          sProb=node->tProb;
@@ -2719,28 +3085,35 @@ void ValidProbNode(Node *node,float thresh)
    node->sProb=best; node->quest=qbest;
 }
 
-/* SplitTreeNode: split the given node */
+/* SplitTreeNode: split the given node.  The statistics of the
+   smaller child are summed from its items and the other child takes
+   over the parent statistics less those of the smaller child */
 void SplitTreeNode(Tree *tree, Node *node)
 {
    CLink cl,nextcl;
+   Node *small,*large;
+   BitWord *qb;
+   int nYes,nNo;
 
    if (node->quest == NULL) return;
    cprob += node->sProb - node->tProb;
 
-   AnswerQuestion(node->clist,node->quest);
+   qb = tAccs.qBits+node->quest->idx*tAccs.nWords;
    node->yes = CreateTreeNode(NULL,node);
    node->yes->ans= TRUE;
    node->no = CreateTreeNode(NULL,node);
    node->no->ans=TRUE;
 
+   nYes = nNo = 0;
    for(cl=node->clist;cl!=NULL;cl=nextcl) {
       nextcl=cl->next;
+      cl->ans = (qb[cl->idx/BITWORD] >> (cl->idx%BITWORD)) & 1;
       switch(cl->ans) {
       case FALSE: cl->next=node->no->clist;
-         node->no->clist=cl;
+         node->no->clist=cl; nNo++;
          break;
       case TRUE:  cl->next=node->yes->clist;
-         node->yes->clist=cl;
+         node->yes->clist=cl; nYes++;
          break;
       default:
          HError(2694,"SplitTreeNode: Unspecified question result");
@@ -2748,6 +3121,14 @@ void SplitTreeNode(Tree *tree, Node *node)
    }
    node->clist = NULL;
 
+   small = (nYes<nNo) ? node->yes : node->no;
+   large = (nYes<nNo) ? node->no : node->yes;
+   small->stats = NewNodeStats();
+   for(cl=small->clist;cl!=NULL;cl=cl->next)
+      AddItemStats(small->stats,cl->idx);
+   large->stats = node->stats; node->stats = NULL;
+   AddNodeStats(large->stats,small->stats,-1);
+
    /* unlink node from leaf chain and link in yes and no */
    node->yes->next = node->no;
    node->no->prev = node->yes;
@@ -2780,15 +3161,17 @@ Node *FindBestSplit(Node *first, float threshold)
    return(best);
 }
 
-/* MergeCost: return logL reduction if node b is merged with node a.
-   On entry, atail points to last cluster item in node a clist. */
-float MergeCost(Node *a, Node *b, CLink atail)
+/* MergeCost: return logL reduction if node b is merged with node a */
+float MergeCost(Node *a, Node *b)
 {
    float combProb;              /* combined logL */
+   float occ;
+   int n;
    
-   atail->next = b->clist;
-   combProb = ClusterLogL(a->clist,&no,NULL,occs);
-   atail->next = NULL;
+   n = tAccs.nSlice*tAccs.sSize;
+   memcpy(tAccs.yStats,a->stats,n*sizeof(double));
+   AddNodeStats(tAccs.yStats,b->stats,1);
+   combProb = StatsLogL(tAccs.yStats,NULL,&occ);
    return a->tProb + b->tProb - combProb;
 }
 
@@ -2809,7 +3192,7 @@ Boolean MergeNode(Node *node, float threshold)
    /* find bestnode to merge */
    minCost = threshold;min=NULL;
    for (p=node->next;p!=NULL;p=p->next) {
-      cost = MergeCost(node,p,ctail);
+      cost = MergeCost(node,p);
       if (trace & T_TREE_ALLM) {
          char buf1[20],buf2[20];
          if (node->parent==NULL) sprintf(buf1," ROOT ");
@@ -2841,6 +3224,7 @@ Boolean MergeNode(Node *node, float threshold)
          fflush(stdout);
       }
       ctail->next = min->clist;
+      AddNodeStats(node->stats,min->stats,1);
       node->tProb += min->tProb - minCost;
       node->occ += min->occ;
       if (min->parent->yes == min)     min->parent->yes = node;
@@ -2898,7 +3282,7 @@ void TieLeafNodes(Tree *tree, char *macRoot)
    cprob=0.0; occ=0.0;
    clidx = numTreeClust;
    for (node=tree->leaf;node!=NULL;node=node->next) {
-      cprob += ClusterLogL(node->clist,&no,NULL,occs); /*==node->tProb;*/
+      cprob += StatsLogL(node->stats,NULL,occs); /*==node->tProb;*/
       occ += occs[FALSE];
       sprintf(clnum,"%d",clidx--); /* construct macro name */
       strcpy(buf,macRoot);
@@ -2928,7 +3312,7 @@ void TieLeafNodes(Tree *tree, char *macRoot)
          l = VectorSize(no.sum);
          ZeroAccSum(&no);
          for(cl=node->clist;cl!=NULL;cl=cl->next) 
-            IncSumSqr(((StateElem*)cl->item->item)->info,FALSE,&no,NULL,l);
+            IncItemSumSqr(cl->idx,0,&no);
       }
       ApplyTie(ilist,buf,(ilist->item==ilist->owner?'h':'s'));
       id=GetLabId(buf,FALSE);
@@ -2950,17 +3334,19 @@ void TieLeafNodes(Tree *tree, char *macRoot)
          }
       }
       FreeItems(&ilist);        /* free items at this node */
-      node->clist=NULL;
+      node->clist=NULL; node->stats=NULL;
    }
 }
 
 /* BuildTree: build a tree for objects stored in ilist and return
    the actual clusters in rlist, the number of clusters
-   in numCl.  The value of threshold determines when to stop.
+   in numCl.  The value of threshold determines when to stop
+   unless USEMDL is set in which case the threshold is replaced 
+   by the MDL penalty for adding a leaf node to the tree.
    macRoot is the root prefix of the name to use in the tie  */
 void BuildTree(ILink ilist,float threshold, char *macRoot)
 {
-   int i,j,l,N,snum,state,numItems;
+   int i,j,l,N,snum,state,numItems,nQuest;
    char buf[256];
    HMMDef *hmm;
    CLink clHead,cl;
@@ -3016,19 +3402,42 @@ void BuildTree(ILink ilist,float threshold, char *macRoot)
       cl->idx = i; cl->next = clHead;
       clHead = cl;
    }
+   InitItemAccs(ilist,i-1,l);
+   tAccs.sSize = 2+2*l;
+   tAccs.yStats = NewNodeStats();
    
-   /* For each question make each hmm (item) point to its */
-   /*  corresponding cluster member (CREC) via hmm->hook */
+   /* Answer each question once for every cluster member (CREC) */
+   /*  which each hmm (item) points to via hmm->hook */
+   nQuest = (qTail==NULL) ? 0 : qTail->idx+1;
+   tAccs.nWords = tAccs.nItems/BITWORD+1;
+   tAccs.nBits = (BitWord*) New(&tmpHeap,tAccs.nWords*sizeof(BitWord));
+   tAccs.qBits = (BitWord*) New(&tmpHeap,
+                                (nQuest+1)*tAccs.nWords*sizeof(BitWord));
+   memset(tAccs.qBits,0,(nQuest+1)*tAccs.nWords*sizeof(BitWord));
    for (q=qHead; q!=NULL; q=q->next)
       for (p=q->ilist; p!=NULL; p=p->next)
-         p->item = p->owner->hook;
+         if ((cl=(CLink) p->owner->hook)!=NULL)
+            tAccs.qBits[q->idx*tAccs.nWords+cl->idx/BITWORD] |= 
+               (BitWord)1 << (cl->idx%BITWORD);
    for (p=ilist;p!=NULL;p=p->next,i++)
       p->owner->hook=NULL;
 
    /* Create the root of the tree */
    node = tree->leaf = tree->root = CreateTreeNode(clHead,NULL);
-   cprob = node->tProb = ClusterLogL(node->clist,&no,NULL,occs);
-   node->occ = occs[FALSE];
+   node->stats = NewNodeStats();
+   for (cl=clHead; cl!=NULL; cl=cl->next)
+      AddItemStats(node->stats,cl->idx);
+   cprob = node->tProb = StatsLogL(node->stats,NULL,&node->occ);
+   if (useMDL) {
+      /* each split adds nSlice Gaussians of 2*l parameters whose 
+         description length is 0.5*log(occ) per parameter */
+      threshold = (node->occ>1.0) ? 
+         mdlFactor*tAccs.nSlice*l*log(node->occ) : 0.0;
+      if (trace & T_IND) {
+         printf(" MDL threshold %.2f\n",threshold);
+         fflush(stdout);
+      }
+   }
    numTreeClust=1; numItems=NumItems(ilist);
    if (trace & T_IND) {
       if (state<0) 
@@ -5020,11 +5429,39 @@ void QuestionCommand(void)
    ILink ilist=NULL;
    char type='h';
    char qName[255];
-   char *pattern;
+   char *pattern,*text;
+   QCEnt *qc=NULL;
+   int i;
 
    ChkedAlpha("QS question name",qName);
-   /* get copy of original item list whilst parsing it */
-   pattern=PItemList(&ilist,&type,hset,&source,trace&T_ITM);
+   if (qsCache[0]!='\0') {
+      InitHMMIndex();
+      if (!qcLoaded) {
+         LoadQuestionCache(qsCache);
+         qcLoaded = TRUE; qcSig = hmmSig; qcNumPhys = nPhysHMM;
+      }
+      if (hmmSig!=qcSig) {
+         HError(-2614,"QuestionCommand: hmm list changed, %s not used",
+                qsCache);
+         qsCache[0] = '\0';
+      }
+   }
+   if (qsCache[0]!='\0') {
+      /* look up item list text in the cache before matching it */
+      pattern=ScanItemList(hset,&source,&text);
+      text=CopyString(&questHeap,text);
+      qc=FindQCEnt(qName,FALSE);
+      if (qc!=NULL && qc->text!=NULL && strcmp(qc->text,text)==0) {
+         for (i=qc->nItems-1; i>=0; i--)
+            AddItem(physHMM[qc->items[i]],physHMM[qc->items[i]],&ilist);
+      } else {
+         pattern=PItemListText(&ilist,&type,hset,text,trace&T_ITM);
+         qc=CacheQuestion(qName,text,ilist);
+      }
+   }
+   else
+      /* get copy of original item list whilst parsing it */
+      pattern=PItemList(&ilist,&type,hset,&source,trace&T_ITM);
    if (trace & T_QST) {
       printf("\nQS %s %s Define question\n",qName,pattern);
       fflush(stdout);
@@ -5033,6 +5470,7 @@ void QuestionCommand(void)
       HError(-2631,"QuestionCommand: No items for question %s\n",qName);
    else {
       LoadQuestion(qName,ilist,pattern);
+      qTail->qc = qc;
       if (trace & T_QST) {
          printf(" QS: Refers to %d of %d models\n",
                 NumItems(ilist),hset->numLogHMM);
@@ -6454,11 +6892,16 @@ void DoEdit(char * editFn)
       default: 
          HError(2650,"DoEdit: Command %s not recognised",cmds);
       }
+      if (thisCommand != QS && thisCommand != TR &&
+          thisCommand != SH && thisCommand != ST)
+         hmmIdxValid = FALSE;
       if (thisCommand != TR && thisCommand != SH && thisCommand != ST)
          lastCommand = thisCommand;
       prevCommand = thisCommand;
    }
    CloseSource(&source);
+   if (qcDirty && qsCache[0]!='\0')
+      SaveQuestionCache(qsCache);
    
    if (saveHMMSet) {
       /* Save the Edited HMM Files */
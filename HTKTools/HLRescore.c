@@ -599,6 +599,7 @@ void ProcessLattice (char *latfn)
             switch (*p) {
             case 'A': form|=HLAT_ALABS; break;
             case 'B': form|=HLAT_LBIN; break;
+            case 'P': form|=HLAT_PACKED; break;
             case 't': form|=HLAT_TIMES; break;
             case 'v': form|=HLAT_PRON; break;
             case 'a': form|=HLAT_ACLIKE; break;
@@ -760,6 +761,7 @@ void ProcessLabels (char *labfn)
             switch (*p) {
             case 'A': form|=HLAT_ALABS; break;
             case 'B': form|=HLAT_LBIN; break;
+            case 'P': form|=HLAT_PACKED; break;
             case 't': form|=HLAT_TIMES; break;
             case 'v': form|=HLAT_PRON; break;
             case 'a': form|=HLAT_ACLIKE; break;
@@ -121,6 +121,8 @@ static UPDSet uFlagsMLE = 0; /*which we only update with MLE, ignoring the MMI p
 
 static int parMode   = -1;       /* enable one of the parallel modes */
 /* i.e.  0 for reestimation, 1,2,3... for accumulating .acc files. */
+static int nSplit    = 0;        /* if >1, -p N only processes utterances n with n%nSplit == N-1 */
+static int nUtt      = 0;        /* index of current utterance in the argument list */
  
 
 static Boolean stats = FALSE;    /* enable statistics reports */
@@ -302,6 +304,7 @@ void SetConfParms(void)
       }
 
       if (GetConfBool(cParm,nParm,"USELLF",&b))  useLLF = b;
+      if (GetConfInt(cParm,nParm,"NSPLIT",&i)) nSplit = i;
 
       if (GetConfStr(cParm,nParm,"UPDATEMODE",buf)) {
          if (!strcmp (buf, "DUMP")) updateMode = UPMODE_DUMP;
@@ -596,6 +599,8 @@ int main(int argc, char *argv[])
          HError(2319,"HMMIRest: Unknown switch %s",s);
       }
    } /*matches while(NextArg() == SWITCHARG)*/
+   if (nSplit > 1 && parMode < 0)
+      HError(2319,"HMMIRest: NSPLIT=%d needs -p N to select the utterance subset",nSplit);
 
 
    InitVocab(&vocab); /* The actual dict is not needed, only the structure; this relates to HNet and reading lattices. */
@@ -677,12 +682,19 @@ int main(int argc, char *argv[])
          }
       } else {
          /*parMode not zero -> load data files & align..*/
-         Boolean isPipe;
+         Boolean isPipe, skipUtt;
        
          if(NextArg() != STRINGARG)
             HError(2319,"HERest: data file name expected");
        
-         if ( maxSnt != 0  && nSnt>maxSnt ) GetStrArg(); /*Pass over file. */
+         /* With NSPLIT each of the -p 1..nSplit workers takes every nSplit'th utterance
+            of the same script, so that the workers can be run concurrently */
+         skipUtt = nSplit > 1 && parMode > 0 && (nUtt % nSplit) != (parMode-1) % nSplit;
+         nUtt++;
+         if (skipUtt){
+            GetStrArg(); if (twoDataFiles) GetStrArg();
+         }
+         else if ( maxSnt != 0  && nSnt>maxSnt ) GetStrArg(); /*Pass over file. */
          else {   /* apply F-B.  */
 
             if (twoDataFiles){
@@ -100,6 +100,8 @@ static char * roPrefix=NULL;      /* Prefix for direct audio output name */
 static char * roSuffix=NULL;      /* Suffix for direct audio output name */
 static int roCounter = 0;         /* Counter for audio output name */
 static Boolean replay = FALSE;    /* enable audio replay */
+static int partFrames = 0;        /* Frames between partial results */
+static Boolean partCommit = FALSE;/* Commit stable part of partial results */
 
 /* Language model */
 static double lmScale = 1.0;      /* bigram and log(1/NSucc) scale factor */
@@ -135,6 +137,9 @@ static Boolean saveBinary=FALSE;  /* Save tmf in binary format */
 
 /* Heaps */
 static MemHeap ansHeap;
+static MemHeap partHeap;
+static MemHeap commitHeap;
+static LabList *commitList = NULL; /* Words committed in this utterance */
 static MemHeap modelHeap;
 static MemHeap netHeap;
 static MemHeap bufHeap;
@@ -170,6 +175,8 @@ void SetConfParms(void)
       if (GetConfStr(cParm,nParm,"LABFILEMASK",buf)) {
          labFileMask = CopyString(&gstack, buf);
       }
+      if (GetConfInt(cParm,nParm,"PARTIALFRAMES",&i)) partFrames = i;
+      if (GetConfBool(cParm,nParm,"COMMITPARTIAL",&b)) partCommit = b;
    }
 }
 
@@ -194,7 +201,7 @@ void ReportUsage(void)
    printf(" -n i [N] N-best recognition (using i tokens) off\n");
    printf(" -o s    output label formating NCSTWMX       none\n");
    printf(" -p f    inter model trans penalty (log)      0.0\n");
-   printf(" -q s    output lattice formating ABtvaldmn   tvaldmn\n");
+   printf(" -q s    output lattice formating ABPtvaldmn  tvaldmn\n");
    printf(" -r f    pronunciation prob scale factor      1.0\n");
    printf(" -s f    grammar scale factor                 1.0\n");
    printf(" -t f [f f] set pruning threshold             0.0\n");
@@ -458,6 +465,8 @@ int main(int argc, char *argv[])
       HError(-3230,"HVite: Performing nbest recognition with 1-best and latttices output");
    if ((update>0) && (!xfInfo.useOutXForm))
       HError(3230,"HVite: Must use -K option with incremental adaptation");
+   if (partCommit && (latExt!=NULL || states || models || update>0))
+      HError(3230,"HVite: COMMITPARTIAL cannot be used with lattice, alignment or adaptation output");
 
 
    Initialise();
@@ -552,6 +561,8 @@ void Initialise(void)
    if(ReadDict(dictFn,&vocab)<SUCCESS) 
       HError(3213, "Main: ReadDict failed");
    CreateHeap(&ansHeap,"Lattice heap",MSTAK,1,0.0,4000,4000);
+   CreateHeap(&partHeap,"Partial result heap",MSTAK,1,0.0,4000,4000);
+   CreateHeap(&commitHeap,"Committed word heap",MSTAK,1,0.0,4000,4000);
    if (trace & T_MEM){
       printf("Memory State After Initialisation\n");
       PrintAllHeapStats();
@@ -636,6 +647,45 @@ int DoOnlineAdaptation(Lattice *lat, ParmBuf pbuf, int nFrames)
    return nFrames;
 } 
 
+/* ReportPartial: output current partial result, stable words first */
+void ReportPartial(HTime frameDur)
+{
+   Transcription *trans;
+   LLink lab;
+   int i,nStable;
+
+   trans=PartialRecognition(vri,frameDur,&partHeap,partCommit,&nStable);
+   printf("Partial @%-4d ",vri->frame);
+   for (i=0,lab=trans->head->head->succ;lab->succ!=NULL;lab=lab->succ,i++) {
+      if (i==nStable) printf("| ");
+      printf("%s ",lab->labid->name);
+      if (partCommit && i<nStable)  /* no longer in the recogniser */
+         AddLabel(&commitHeap,commitList,lab->labid,
+                  lab->start,lab->end,lab->score);
+   }
+   printf("\n");
+   fflush(stdout);
+   ResetHeap(&partHeap);
+}
+
+/* SpliceCommitted: insert the committed words before each list in trans */
+void SpliceCommitted(Transcription *trans)
+{
+   LabList *ll;
+   LLink lab,cl,where;
+
+   for (ll=trans->head;ll!=NULL;ll=ll->next) {
+      where=ll->head->succ;
+      for (cl=commitList->head->succ;cl->succ!=NULL;cl=cl->succ) {
+         lab=CreateLabel(&ansHeap,ll->maxAuxLab);
+         lab->labid=cl->labid; lab->score=cl->score;
+         lab->start=cl->start; lab->end=cl->end;
+         lab->pred=where->pred; lab->succ=where;
+         lab->succ->pred=lab->pred->succ=lab;
+      }
+   }
+}
+
 /* ProcessFile: process given file. If fn=NULL then direct audio */
 Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam, Boolean restartable)
 {
@@ -647,6 +697,7 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
    LArc *arc,*cur;
    LNode *node;
    Transcription *trans;
+   LLink lab;
    MLink m;
    LogFloat lmlk,aclk;
    int s,j,tact,nFrames;
@@ -674,6 +725,8 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
 
    StartRecognition(vri,net,lmScale,wordPen,prScale);
    SetPruningLevels(vri,maxActive,currGenBeam,wordBeam,nBeam,tmBeam);
+   ResetHeap(&commitHeap);
+   commitList=CreateLabelList(&commitHeap,0);
  
    tact=0;nFrames=0;
    StartBuffer(pbuf);
@@ -704,6 +757,8 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
                 vri->nact,vri->genMaxTok.like/vri->frame);
          fflush(stdout);
       }
+      if (partFrames>0 && vri->frame%partFrames==0)
+         ReportPartial(pbinfo.tgtSampRate/10000000.0);
       nFrames++;
       tact+=vri->nact;
    }
@@ -745,10 +800,15 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
          node=NULL;
       }
       aclk=lmlk=0.0;
+      if (partCommit) {
+         for (lab=commitList->head->succ;lab->succ!=NULL;lab=lab->succ)
+            printf("%s ",lab->labid->name);
+      }
       while(node!=NULL) {
          for (arc=NULL,cur=node->foll;cur!=NULL;cur=cur->farc) arc=cur;
          if (arc==NULL) break;
-         if (arc->end->word!=NULL)
+         if (arc->end->word!=NULL && 
+             !(partCommit && arc->end->word==vocab.nullWord))
             printf("%s ",arc->end->word->wordName->name);
          aclk+=arc->aclike+arc->prlike*lat->prscale;
          lmlk+=arc->lmlike*lat->lmscale+lat->wdpenalty;
@@ -777,6 +837,7 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
                switch (*p) {
                case 'A': form|=HLAT_ALABS; break;
                case 'B': form|=HLAT_LBIN; break;
+               case 'P': form|=HLAT_PACKED; break;
                case 't': form|=HLAT_TIMES; break;
                case 'v': form|=HLAT_PRON; break;
                case 'a': form|=HLAT_ACLIKE; break;
@@ -800,6 +861,8 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
       /* output N-best transcriptions as usual */
       else
       trans=TranscriptionFromLattice(&ansHeap,lat,nTrans);
+      if (partCommit)
+         SpliceCommitted(trans);
       
       if (labForm!=NULL)
          FormatTranscription(trans,pbinfo.tgtSampRate,states,models,
@@ -927,7 +990,7 @@ void DoAlignment(void)
 	 GenAdaptXForm(&hset,incXForm);
          xfInfo.inXForm = GetMLLRDiagCov(incXForm);;
 	 SetXForm(&hset,xfInfo.inXForm);
-	 ApplyHMMSetXForm(&hset,xfInfo.inXForm);
+	 DeferHMMSetXForm(&hset,xfInfo.inXForm);
       }
       ResetHeap(&netHeap);
    }
@@ -986,7 +1049,7 @@ void DoRecognition(void)
 	    GenAdaptXForm(&hset,incXForm);
             xfInfo.inXForm = GetMLLRDiagCov(incXForm);;
             SetXForm(&hset,xfInfo.inXForm);
-	    ApplyHMMSetXForm(&hset,xfInfo.inXForm);
+	    DeferHMMSetXForm(&hset,xfInfo.inXForm);
          }
       }
    }
@@ -1019,7 +1082,7 @@ void DoRecognition(void)
 	    GenAdaptXForm(&hset,incXForm);
             xfInfo.inXForm = GetMLLRDiagCov(incXForm);;
             SetXForm(&hset,xfInfo.inXForm);
-	    ApplyHMMSetXForm(&hset,xfInfo.inXForm);
+	    DeferHMMSetXForm(&hset,xfInfo.inXForm);
          }
       }
    }